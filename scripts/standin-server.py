@@ -0,0 +1,527 @@
+#!/usr/bin/env python3
+#
+# This file is part of Genie
+#
+# Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Local stand-in for the servers genie-client talks to.
+
+Serves, on one port:
+
+  /<locale>/voice/stream   the STT websocket: a JSON handshake, binary audio
+                           messages, an empty message at the end of speech,
+                           then one JSON result; interim results as the
+                           audio comes if the handshake asks for them
+  /<locale>/voice/tts      WAV audio for the text in the query (GET) or in
+                           the JSON body (POST)
+  any other websocket      the conversation protocol of conversation::Client:
+                           each command gets an echo, a text reply and an
+                           askSpecial that ends the turn
+
+Every reply can be delayed and made to fail with a given probability, to see
+how the client copes. Point the client at it with
+
+  [general]
+  url=ws://127.0.0.1:8080/me/api/conversation
+  nlUrl=http://127.0.0.1:8080
+  auth_mode=none
+
+Only the Python standard library is needed. Speex audio ([stt] codec=speex)
+is decoded with libspeex through ctypes when it is installed, and a
+malformed bitstream fails the session; without libspeex it is only counted,
+so a broken bitstream goes unnoticed.
+"""
+
+import argparse
+import asyncio
+import base64
+import ctypes
+import ctypes.util
+import hashlib
+import io
+import json
+import random
+import struct
+import sys
+import time
+import urllib.parse
+import wave
+
+WS_GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+OP_CONT = 0x0
+OP_TEXT = 0x1
+OP_BINARY = 0x2
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xA
+
+TTS_SAMPLE_RATE = 16000
+
+# speex/speex.h
+SPEEX_GET_FRAME_SIZE = 3
+SPEEX_MODE_FOR_RATE = {8000: 0, 16000: 1, 32000: 2}
+
+
+def log(*args):
+    print(time.strftime("%H:%M:%S"), *args, flush=True)
+
+
+class WebSocket:
+    """Server side of an RFC 6455 connection, just enough for the client."""
+
+    def __init__(self, reader, writer):
+        self.reader = reader
+        self.writer = writer
+        self.closed = False
+
+    async def recv(self):
+        """Return the next (opcode, payload) data message, or None once the
+        connection is closed. Pings are answered here."""
+        message = None
+        opcode = None
+        while True:
+            try:
+                head = await self.reader.readexactly(2)
+            except (asyncio.IncompleteReadError, ConnectionError):
+                self.closed = True
+                return None
+            fin = head[0] & 0x80
+            op = head[0] & 0x0F
+            length = head[1] & 0x7F
+            if length == 126:
+                length = struct.unpack("!H", await self.reader.readexactly(2))[0]
+            elif length == 127:
+                length = struct.unpack("!Q", await self.reader.readexactly(8))[0]
+            mask = await self.reader.readexactly(4) if head[1] & 0x80 else None
+            payload = await self.reader.readexactly(length)
+            if mask:
+                payload = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+
+            if op == OP_PING:
+                await self.send(OP_PONG, payload)
+                continue
+            if op == OP_PONG:
+                continue
+            if op == OP_CLOSE:
+                if not self.closed:
+                    await self.close(payload[:2] if len(payload) >= 2 else b"")
+                return None
+
+            if op != OP_CONT:
+                opcode = op
+                message = bytearray()
+            message += payload
+            if fin:
+                return opcode, bytes(message)
+
+    async def send(self, opcode, payload):
+        if self.closed:
+            return
+        if isinstance(payload, str):
+            payload = payload.encode("utf-8")
+        head = bytearray([0x80 | opcode])
+        if len(payload) < 126:
+            head.append(len(payload))
+        elif len(payload) < 65536:
+            head.append(126)
+            head += struct.pack("!H", len(payload))
+        else:
+            head.append(127)
+            head += struct.pack("!Q", len(payload))
+        try:
+            self.writer.write(bytes(head) + payload)
+            await self.writer.drain()
+        except ConnectionError:
+            self.closed = True
+
+    async def send_json(self, obj):
+        await self.send(OP_TEXT, json.dumps(obj))
+
+    async def close(self, code=b"\x03\xe8"):
+        await self.send(OP_CLOSE, code)
+        self.closed = True
+        self.writer.close()
+
+
+class SpeexDecoder:
+    """Decoder for the Speex uplink, through libspeex. Each message must be
+    whole frames followed by a terminator, the way SpeexEncoder::take()
+    writes them."""
+
+    lib = None
+
+    @classmethod
+    def load(cls):
+        name = ctypes.util.find_library("speex")
+        if name is None:
+            return False
+        lib = ctypes.CDLL(name)
+        lib.speex_lib_get_mode.restype = ctypes.c_void_p
+        lib.speex_lib_get_mode.argtypes = [ctypes.c_int]
+        lib.speex_decoder_init.restype = ctypes.c_void_p
+        lib.speex_decoder_init.argtypes = [ctypes.c_void_p]
+        lib.speex_decoder_ctl.argtypes = [ctypes.c_void_p, ctypes.c_int,
+                                          ctypes.c_void_p]
+        lib.speex_decoder_destroy.argtypes = [ctypes.c_void_p]
+        lib.speex_decode_int.argtypes = [ctypes.c_void_p, ctypes.c_void_p,
+                                         ctypes.c_void_p]
+        lib.speex_bits_init.argtypes = [ctypes.c_void_p]
+        lib.speex_bits_destroy.argtypes = [ctypes.c_void_p]
+        lib.speex_bits_read_from.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                             ctypes.c_int]
+        lib.speex_bits_remaining.argtypes = [ctypes.c_void_p]
+        cls.lib = lib
+        return True
+
+    def __init__(self, sample_rate):
+        lib = self.lib
+        self.sample_rate = sample_rate
+        # a SpeexBits, only ever looked into by libspeex
+        self.bits = ctypes.create_string_buffer(64)
+        lib.speex_bits_init(self.bits)
+        mode = lib.speex_lib_get_mode(SPEEX_MODE_FOR_RATE[sample_rate])
+        self.state = lib.speex_decoder_init(mode)
+        frame_size = ctypes.c_int(0)
+        lib.speex_decoder_ctl(self.state, SPEEX_GET_FRAME_SIZE,
+                              ctypes.byref(frame_size))
+        self.frame_length = frame_size.value
+        self.frame = (ctypes.c_int16 * self.frame_length)()
+
+    def close(self):
+        self.lib.speex_decoder_destroy(self.state)
+        self.lib.speex_bits_destroy(self.bits)
+
+    def decode(self, payload):
+        """Return the number of samples in one message, or raise ValueError
+        if it is not whole frames and a terminator."""
+        lib = self.lib
+        lib.speex_bits_read_from(self.bits, payload, len(payload))
+        samples = 0
+        while True:
+            remaining = lib.speex_bits_remaining(self.bits)
+            result = lib.speex_decode_int(self.state, self.bits, self.frame)
+            if result == 0:
+                samples += self.frame_length
+                continue
+            if result == -2:
+                raise ValueError("corrupt frame after %d samples" % samples)
+            # -1 is the terminator, which takes 5 bits, or running out of
+            # bits without one
+            if remaining < 5:
+                raise ValueError("no terminator after %d samples" % samples)
+            left = lib.speex_bits_remaining(self.bits)
+            if left >= 8:
+                raise ValueError("%d bits after the terminator" % left)
+            return samples
+
+
+class StandIn:
+    def __init__(self, args):
+        self.args = args
+        self.random = random.Random(args.seed)
+        self.message_id = 0
+        self.turns = 0
+
+    def fails(self, rate):
+        return rate > 0 and self.random.random() < rate
+
+    async def delay(self, ms):
+        if ms > 0:
+            jitter = ms * self.args.jitter
+            await asyncio.sleep(max(0, ms + self.random.uniform(-jitter, jitter)) / 1000)
+
+    # Connection handling
+    # ======================================================================
+
+    async def handle(self, reader, writer):
+        try:
+            request = await reader.readuntil(b"\r\n\r\n")
+        except (asyncio.IncompleteReadError, asyncio.LimitOverrunError,
+                ConnectionError):
+            writer.close()
+            return
+
+        lines = request.decode("latin-1").split("\r\n")
+        method, target, _ = lines[0].split(" ", 2)
+        headers = {}
+        for line in lines[1:]:
+            if ":" in line:
+                name, value = line.split(":", 1)
+                headers[name.strip().lower()] = value.strip()
+        url = urllib.parse.urlsplit(target)
+        query = urllib.parse.parse_qs(url.query)
+
+        try:
+            if headers.get("upgrade", "").lower() == "websocket":
+                await self.delay(self.args.connect_delay)
+                ws = await self.accept(reader, writer, headers)
+                if url.path.endswith("/voice/stream"):
+                    await self.stt(ws)
+                else:
+                    await self.conversation(ws, query)
+            else:
+                body = b""
+                if "content-length" in headers:
+                    body = await reader.readexactly(int(headers["content-length"]))
+                if url.path.endswith("/voice/tts"):
+                    await self.tts(writer, method, query, body)
+                else:
+                    self.respond(writer, 404, "text/plain", b"not found\n")
+        except (ConnectionError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            writer.close()
+
+    async def accept(self, reader, writer, headers):
+        key = headers["sec-websocket-key"].encode("ascii")
+        accept = base64.b64encode(hashlib.sha1(key + WS_GUID).digest())
+        writer.write(b"HTTP/1.1 101 Switching Protocols\r\n"
+                     b"Upgrade: websocket\r\n"
+                     b"Connection: Upgrade\r\n"
+                     b"Sec-WebSocket-Accept: " + accept + b"\r\n\r\n")
+        await writer.drain()
+        return WebSocket(reader, writer)
+
+    def respond(self, writer, status, content_type, body):
+        reason = {200: "OK", 404: "Not Found", 500: "Internal Server Error"}
+        head = ("HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n"
+                "Connection: close\r\n\r\n" %
+                (status, reason[status], content_type, len(body)))
+        writer.write(head.encode("ascii") + body)
+
+    # Speech-To-Text: /<locale>/voice/stream
+    # ======================================================================
+
+    async def stt(self, ws):
+        """One session: the handshake, the audio, the result.
+
+        The client may open the connection well before the wake word (see
+        [stt] prewarm), so the clock starts with the first audio."""
+        hello = await ws.recv()
+        if hello is None:
+            return
+        handshake = json.loads(hello[1])
+        audio_format = handshake.get("format", "pcm")
+        sample_rate = handshake.get("sample_rate", 16000)
+        interim = handshake.get("interim", False)
+
+        decoder = None
+        if audio_format == "speex" and SpeexDecoder.lib:
+            if sample_rate not in SPEEX_MODE_FOR_RATE:
+                log("STT: Speex cannot code audio at %s Hz" % sample_rate)
+                await ws.send_json({"status": 400, "code": "E_BAD_FORMAT"})
+                await ws.close()
+                return
+            decoder = SpeexDecoder(sample_rate)
+        try:
+            await self.stt_audio(ws, audio_format, decoder, interim)
+        finally:
+            if decoder:
+                decoder.close()
+
+    async def stt_audio(self, ws, audio_format, decoder, interim):
+        words = self.args.stt_text.split()
+        partials = 0
+        first_audio = None
+        messages = 0
+        size = 0
+        # audio decoded from the Speex messages, and what was wrong with
+        # the first malformed one
+        samples = 0
+        error = None
+        while True:
+            message = await ws.recv()
+            if message is None:
+                log("STT: connection closed before the end of speech")
+                return
+            opcode, payload = message
+            if opcode != OP_BINARY:
+                continue
+            if not payload:
+                break
+            if first_audio is None:
+                first_audio = time.monotonic()
+            messages += 1
+            size += len(payload)
+            if decoder and not error:
+                try:
+                    samples += decoder.decode(payload)
+                except ValueError as e:
+                    error = "message %d: %s" % (messages, e)
+
+            # one more word every --stt-interim-ms of audio, the way a
+            # recognizer settles on a transcript while the user speaks
+            elapsed = (time.monotonic() - first_audio) * 1000
+            if interim and elapsed >= (partials + 1) * self.args.stt_interim_ms:
+                partials += 1
+                await ws.send_json({"status": 0, "result": "partial",
+                                    "text": " ".join(words[:partials])})
+
+        audio_ms = (time.monotonic() - first_audio) * 1000 if first_audio else 0
+        log("STT: %s, %d messages, %d bytes over %.0f ms" %
+            (audio_format, messages, size, audio_ms))
+        if decoder and not error:
+            log("STT: decoded %.0f ms of Speex audio" %
+                (samples * 1000 / decoder.sample_rate))
+
+        await self.delay(self.args.stt_delay)
+        if error:
+            log("STT: malformed Speex audio, %s" % error)
+            await ws.send_json({"status": 400, "code": "E_BAD_AUDIO"})
+        elif self.fails(self.args.stt_fail_rate):
+            log("STT: injected failure")
+            await ws.send_json({"status": 500, "code": "E_INJECTED"})
+        else:
+            text = self.args.stt_text
+            if self.fails(self.args.stt_revise_rate):
+                # the final transcript is not what the partials said
+                log("STT: injected revision")
+                text += " please"
+            await ws.send_json({"status": 0, "result": "ok", "text": text})
+        await ws.close()
+
+    # Text-To-Speech: /<locale>/voice/tts
+    # ======================================================================
+
+    async def tts(self, writer, method, query, body):
+        if method == "POST":
+            text = json.loads(body or b"{}").get("text", "")
+        else:
+            text = query.get("text", [""])[0]
+
+        await self.delay(self.args.tts_delay)
+        if self.fails(self.args.tts_fail_rate):
+            log("TTS: injected failure")
+            self.respond(writer, 500, "text/plain", b"injected failure\n")
+            await writer.drain()
+            return
+
+        # a quiet tone, about as long as saying the text would take
+        samples = TTS_SAMPLE_RATE * self.args.tts_ms_per_char * max(1, len(text)) // 1000
+        buf = io.BytesIO()
+        with wave.open(buf, "wb") as wav:
+            wav.setnchannels(1)
+            wav.setsampwidth(2)
+            wav.setframerate(TTS_SAMPLE_RATE)
+            pattern = struct.pack("<4h", 0, 300, 0, -300)
+            wav.writeframes(pattern * (samples // 4))
+        log("TTS: %d characters, %d ms of audio" %
+            (len(text), samples * 1000 // TTS_SAMPLE_RATE))
+        self.respond(writer, 200, "audio/x-wav", buf.getvalue())
+        await writer.drain()
+
+    # Conversation protocol, see conversation::Client
+    # ======================================================================
+
+    def next_id(self):
+        self.message_id += 1
+        return self.message_id
+
+    async def conversation(self, ws, query):
+        conversation_id = query.get("id", ["genie-client"])[0]
+        log("Conversation: connected (%s)" % conversation_id)
+        await ws.send_json({"type": "id", "id": conversation_id})
+
+        while True:
+            message = await ws.recv()
+            if message is None:
+                log("Conversation: closed")
+                return
+            opcode, payload = message
+            if opcode != OP_TEXT:
+                continue
+            request = json.loads(payload)
+            kind = request.get("type")
+            if kind == "command":
+                await self.command(ws, request.get("text", ""))
+            elif kind in ("ping", "req-subproto", "tt"):
+                # the client pings to keep the connection up, and the
+                # extension protocols are not needed for a turn
+                pass
+            else:
+                log("Conversation: ignoring %s" % kind)
+
+    async def command(self, ws, text):
+        self.turns += 1
+        log("Conversation: turn %d, command %r" % (self.turns, text))
+        await ws.send_json({"type": "command", "id": self.next_id(),
+                            "text": text})
+
+        await self.delay(self.args.genie_delay)
+        if self.fails(self.args.genie_fail_rate):
+            log("Conversation: injected failure")
+            await ws.send_json({"type": "error", "error": "injected failure"})
+        else:
+            await ws.send_json({"type": "text", "id": self.next_id(),
+                                "text": self.args.reply})
+        await ws.send_json({"type": "askSpecial", "ask": None})
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Stand-in STT, TTS and conversation server for genie-client",
+        epilog="Speex STT audio is only decoded and checked when libspeex "
+               "is installed; without it, it is only counted.")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--seed", type=int, default=None,
+                        help="seed for the injected failures and jitter")
+    parser.add_argument("--jitter", type=float, default=0.0,
+                        help="randomize every delay by up to this fraction")
+    parser.add_argument("--connect-delay", type=float, default=0,
+                        help="ms before accepting a websocket")
+    parser.add_argument("--stt-delay", type=float, default=150,
+                        help="ms from the end of speech to the STT result")
+    parser.add_argument("--stt-fail-rate", type=float, default=0)
+    parser.add_argument("--stt-text", default="hey genie what time is it",
+                        help="transcription returned for every command")
+    parser.add_argument("--stt-interim-ms", type=float, default=300,
+                        help="ms of audio per word of the interim results")
+    parser.add_argument("--stt-revise-rate", type=float, default=0,
+                        help="fraction of final transcripts that differ from "
+                             "the interim results")
+    parser.add_argument("--genie-delay", type=float, default=300,
+                        help="ms from a command to its reply")
+    parser.add_argument("--genie-fail-rate", type=float, default=0)
+    parser.add_argument("--reply", default="It is time for a benchmark.",
+                        help="text of the reply to every command")
+    parser.add_argument("--tts-delay", type=float, default=100,
+                        help="ms before the TTS audio starts")
+    parser.add_argument("--tts-fail-rate", type=float, default=0)
+    parser.add_argument("--tts-ms-per-char", type=int, default=60,
+                        help="length of the TTS audio per character of text")
+    args = parser.parse_args()
+
+    if not SpeexDecoder.load():
+        log("libspeex not found, Speex STT audio will not be decoded or "
+            "checked")
+    standin = StandIn(args)
+
+    async def serve():
+        server = await asyncio.start_server(standin.handle, args.host, args.port)
+        log("Listening on %s:%d" % (args.host, args.port))
+        async with server:
+            await server.serve_forever()
+
+    try:
+        asyncio.run(serve())
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
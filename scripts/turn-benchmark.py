@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+#
+# This file is part of Genie
+#
+# Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Measure whole turns of genie-client against the local stand-in server.
+
+Starts scripts/standin-server.py, then runs genie-client with the replay
+audio backend looping over a recording of the wake word followed by a
+command, and collects, for each turn, the time from the wake word to the end
+of the turn and the "Processing Performance" breakdown the client prints
+(STT, Genie, TTS and the gaps between them).
+
+The client runs in a scratch directory that mirrors the directory of the
+base config, so relative paths in it (assets, keyword files) still work;
+only the server URLs, the authentication and the audio backend are changed.
+
+Options that are not the runner's are passed on to the stand-in server, e.g.
+  scripts/turn-benchmark.py --input turn.wav -n 50 --stt-delay 300 --jitter 0.2
+"""
+
+import argparse
+import configparser
+import os
+import queue
+import re
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+STAGES = ["STT", "STT->Genie", "Genie", "Genie->TTS", "TTS", "Total"]
+STAGE_LINE = re.compile(r"^\s*(%s):\s+([\d.]+) ms" %
+                        "|".join(re.escape(s) for s in STAGES))
+ERROR_LINE = re.compile(r"STT completed with an error|STT failed while listening")
+# with [stt] interim
+MATCHED_LINE = re.compile(r"Stable partial transcript matched the final one, "
+                          r"([\d.]+) ms early")
+DIFFERED_LINE = re.compile(r"does not match the stable partial")
+
+
+def read_lines(stream, lines):
+    for line in iter(stream.readline, ""):
+        lines.put((time.monotonic(), line.rstrip("\n")))
+    lines.put((time.monotonic(), None))
+
+
+def start_server(script, port, extra):
+    server = subprocess.Popen(
+        [sys.executable, script, "--port", str(port)] + extra,
+        stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, bufsize=1)
+    line = server.stdout.readline()
+    if "Listening" not in line:
+        server.kill()
+        sys.exit("stand-in server failed to start: %s" % line.strip())
+    # keep draining its output so it never blocks on a full pipe
+    threading.Thread(target=lambda: server.stdout.read(), daemon=True).start()
+    return server
+
+
+def prepare_workdir(base_config, port, recording):
+    config = configparser.ConfigParser(interpolation=None, strict=False,
+                                       comment_prefixes=("#", ";"))
+    # the keys are case sensitive, e.g. nlUrl
+    config.optionxform = str
+    if base_config:
+        config.read(base_config)
+
+    def section(name):
+        if not config.has_section(name):
+            config.add_section(name)
+        return config[name]
+
+    general = section("general")
+    general["url"] = "ws://127.0.0.1:%d/me/api/conversation" % port
+    general["nlUrl"] = "http://127.0.0.1:%d" % port
+    general["auth_mode"] = "none"
+    general["conversationId"] = "turn-benchmark"
+    audio = section("audio")
+    audio["backend"] = "replay"
+    audio["input"] = os.path.abspath(recording)
+    audio["replay_loop"] = "true"
+    audio["replay_realtime"] = "true"
+
+    workdir = tempfile.mkdtemp(prefix="genie-turn-benchmark-")
+    if base_config:
+        base_dir = os.path.dirname(os.path.abspath(base_config))
+        for name in os.listdir(base_dir):
+            if name != "config.ini":
+                os.symlink(os.path.join(base_dir, name),
+                           os.path.join(workdir, name))
+    with open(os.path.join(workdir, "config.ini"), "w") as f:
+        config.write(f)
+    return workdir
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def print_summary(results, failures, differed):
+    print("#################### Turn Benchmark ####################")
+    print("%12s: %d turns, %d failed" % ("Turns", len(results["Wake->Done"]),
+                                           failures))
+    if results["Early"] or differed:
+        print("%12s: %d matched, %d differed" %
+              ("Interim", len(results["Early"]), differed))
+    print("%12s  %8s %8s %8s %8s" % ("", "avg", "p50", "p90", "max"))
+    for name in ["Wake->Done"] + STAGES + ["Early"]:
+        values = results[name]
+        if not values:
+            continue
+        print("%12s: %8.1f %8.1f %8.1f %8.1f ms" %
+              (name, sum(values) / len(values), percentile(values, 0.5),
+               percentile(values, 0.9), max(values)))
+    print("########################################################")
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    root = os.path.dirname(here)
+
+    parser = argparse.ArgumentParser(
+        description="Turn latency benchmark for genie-client",
+        epilog="Other options are passed to standin-server.py")
+    parser.add_argument("--client",
+                        default=os.path.join(root, "build", "src", "genie-client"),
+                        help="genie-client binary")
+    parser.add_argument("--config", default=os.path.join(root, "config.ini"),
+                        help="base config.ini, relative paths resolve next to it")
+    parser.add_argument("--input", required=True,
+                        help="recording of the wake word and a command, or a "
+                             "directory of them")
+    parser.add_argument("-n", "--iterations", type=int, default=20,
+                        help="turns to measure")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--timeout", type=float, default=30,
+                        help="seconds to wait for each turn")
+    parser.add_argument("--log", help="write the client output to this file")
+    args, server_args = parser.parse_known_args()
+
+    server = start_server(os.path.join(here, "standin-server.py"), args.port,
+                          server_args)
+    workdir = prepare_workdir(args.config if os.path.exists(args.config) else None,
+                              args.port, args.input)
+    client = subprocess.Popen([os.path.abspath(args.client)], cwd=workdir,
+                              stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                              text=True, bufsize=1)
+    lines = queue.Queue()
+    threading.Thread(target=read_lines, args=(client.stdout, lines),
+                     daemon=True).start()
+    log = open(args.log, "w") if args.log else None
+
+    results = {name: [] for name in ["Wake->Done"] + STAGES + ["Early"]}
+    failures = 0
+    differed = 0
+    wake = None
+    in_block = False
+    deadline = time.monotonic() + args.timeout
+    try:
+        while len(results["Wake->Done"]) < args.iterations:
+            try:
+                t, line = lines.get(timeout=max(0, deadline - time.monotonic()))
+            except queue.Empty:
+                print("No turn finished in %.0f s, giving up" % args.timeout,
+                      file=sys.stderr)
+                break
+            if line is None:
+                print("genie-client exited with %s" % client.wait(),
+                      file=sys.stderr)
+                break
+            if log:
+                log.write("%.3f %s\n" % (t, line))
+
+            matched = MATCHED_LINE.search(line)
+            if "Detected keyword" in line:
+                wake = t
+            elif matched:
+                results["Early"].append(float(matched.group(1)))
+            elif DIFFERED_LINE.search(line):
+                differed += 1
+            elif ERROR_LINE.search(line):
+                failures += 1
+                wake = None
+                deadline = time.monotonic() + args.timeout
+            elif "Processing Performance" in line:
+                in_block = True
+            elif in_block:
+                match = STAGE_LINE.match(line)
+                if match:
+                    results[match.group(1)].append(float(match.group(2)))
+                elif line.startswith("####"):
+                    in_block = False
+                    if wake is not None:
+                        results["Wake->Done"].append((t - wake) * 1000)
+                        print("turn %d: %.0f ms from the wake word" %
+                              (len(results["Wake->Done"]), (t - wake) * 1000))
+                    wake = None
+                    deadline = time.monotonic() + args.timeout
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if client.poll() is None:
+            # the client prints its own stats on SIGUSR1, keep them in the log
+            client.send_signal(signal.SIGUSR1)
+            time.sleep(1)
+            client.terminate()
+        while log:
+            try:
+                t, line = lines.get(timeout=2)
+            except queue.Empty:
+                break
+            if line is None:
+                break
+            log.write("%.3f %s\n" % (t, line))
+        if log:
+            log.close()
+        server.terminate()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    print_summary(results, failures, differed)
+    return 0 if results["Wake->Done"] else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -18,11 +18,17 @@
 
 #include <glib-unix.h>
 #include <glib.h>
+#include <string.h>
 
 #include "app.hpp"
 #include "audio/audioinput.hpp"
 #include "audio/audioplayer.hpp"
 #include "audio/audiovolume.hpp"
+#include "audio/beamformer.hpp"
+#include "audio/downmix.hpp"
+#include "audio/latency.hpp"
+#include "audio/resampler.hpp"
+#include "audio/wakeword.hpp"
 #include "config.hpp"
 #include "dns_controller.hpp"
 #include "evinput.hpp"
@@ -85,6 +91,12 @@ int genie::App::process_args(int argc, char *argv[]) {
   static GOptionEntry entries[] = {
       {"version", 'v', 0, G_OPTION_ARG_NONE, &opt_version,
        "Show application version", NULL},
+      {"benchmark", 0, 0, G_OPTION_ARG_STRING, &benchmark_name,
+       "Run a micro-benchmark and exit (available: beamformer, downmix, "
+       "resampler, wakeword)",
+       "NAME"},
+      {"benchmark-input", 0, 0, G_OPTION_ARG_FILENAME, &benchmark_input,
+       "Recordings for the benchmark, a file or a directory", "PATH"},
       {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
   context = g_option_context_new(PACKAGE_NAME);
@@ -115,10 +127,15 @@ int genie::App::exec(int argc, char *argv[]) {
 
   g_unix_signal_add(SIGINT, sigint_handler, main_loop);
   g_unix_signal_add(SIGTERM, sigterm_handler, main_loop);
+  g_unix_signal_add(SIGUSR1, sigusr1_handler, this);
 
   config = std::make_unique<Config>();
   config->load();
 
+  if (benchmark_name) {
+    return run_benchmark(benchmark_name) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   init_soup();
 
   g_setenv("PULSE_PROP_media.role", "voice-assistant", TRUE);
@@ -163,6 +180,31 @@ int genie::App::exec(int argc, char *argv[]) {
   return EXIT_SUCCESS;
 }
 
+/**
+ * @brief Run the micro-benchmark selected with `--benchmark`.
+ *
+ * Benchmarks run after the configuration is loaded but before any component
+ * is started, so they can exercise the same code paths on the target device
+ * without touching the audio hardware.
+ */
+bool genie::App::run_benchmark(const char *name) {
+  if (strcmp(name, "beamformer") == 0) {
+    return Beamformer::benchmark();
+  }
+  if (strcmp(name, "downmix") == 0) {
+    return downmix::benchmark();
+  }
+  if (strcmp(name, "resampler") == 0) {
+    return Resampler::benchmark();
+  }
+  if (strcmp(name, "wakeword") == 0) {
+    return WakeWord::benchmark(this, benchmark_input);
+  }
+
+  g_printerr("Unknown benchmark '%s'\n", name);
+  return false;
+}
+
 gboolean genie::App::sigint_handler(gpointer data) {
   GMainLoop *loop = static_cast<GMainLoop *>(data);
   g_main_loop_quit(loop);
@@ -175,6 +217,25 @@ gboolean genie::App::sigterm_handler(gpointer data) {
   exit(0);
 }
 
+gboolean genie::App::sigusr1_handler(gpointer data) {
+  App *self = static_cast<App *>(data);
+  self->print_stats();
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Dump runtime statistics of the audio pipeline.
+ *
+ * Triggered by sending `SIGUSR1` to the process.
+ */
+void genie::App::print_stats() {
+  if (audio_input)
+    audio_input->print_stats();
+  latency::print_stats();
+  if (stt)
+    stt->print_stats();
+}
+
 void genie::App::print_processing_entry(const char *name, double duration_ms,
                                         double total_ms) {
   g_print("%12s: %8.3lf ms (%3d%%)\n", name, duration_ms,
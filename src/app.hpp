@@ -107,6 +107,7 @@ public:
 
   static gboolean sigint_handler(gpointer data);
   static gboolean sigterm_handler(gpointer data);
+  static gboolean sigusr1_handler(gpointer data);
 
   // Public Instance Members
   // -------------------------------------------------------------------------
@@ -133,6 +134,22 @@ public:
     return g_idle_add(handle<E>, dispatch_user_data);
   }
 
+  /**
+   * @brief Handle a state `event` immediately. Must be called on the main
+   * thread.
+   *
+   * Takes ownership of the `event`, which is deleted after the current state
+   * reacts to it (unless the state defers it).
+   */
+  template <typename E> void handle_event(E *event) {
+    g_assert(std::this_thread::get_id() == main_thread);
+    // steal the event so we won't free it and the state can defer it
+    current_event = event;
+    current_state->react(event);
+    delete current_event;
+    current_event = nullptr;
+  }
+
   SoupSession *get_soup_session() { return soup_session.get(); }
 
   /**
@@ -182,6 +199,11 @@ private:
   GMainLoop *main_loop;
   auto_gobject_ptr<SoupSession> soup_session;
 
+  // set by `--benchmark=NAME`, see `run_benchmark()`
+  gchar *benchmark_name = nullptr;
+  // set by `--benchmark-input=PATH`, for benchmarks that replay recordings
+  gchar *benchmark_input = nullptr;
+
   // ### Component Instances ###
 
   std::unique_ptr<AudioInput> audio_input;
@@ -271,11 +293,13 @@ private:
   // =========================================================================
 
   int process_args(int argc, char *argv[]);
+  bool run_benchmark(const char *name);
 
   void init_soup();
 
   void print_processing_entry(const char *name, double duration_ms,
                               double total_ms);
+  void print_stats();
   void replay_deferred_events();
 
   /**
@@ -285,8 +309,8 @@ private:
    * `DispatchUserData` structure that contains pointers to the `App` instance
    * and the dispatched `state::events::Event`.
    *
-   * This method calls `state::State::react()` on the `current_state` with
-   * the `state::events::Event`, then deletes the event.
+   * This method calls `handle_event()` with the `state::events::Event`,
+   * which reacts to it in the `current_state` and then deletes it.
    */
   template <typename E> static gboolean handle(gpointer user_data) {
     g_debug("HANDLE EVENT %s", typeid(E).name());
@@ -294,12 +318,8 @@ private:
         static_cast<DispatchUserData *>(user_data);
     App *self = dispatch_user_data->app;
     E *event = static_cast<E *>(dispatch_user_data->event);
-    // steal the event so we won't free it and the state can defer it
-    self->current_event = event;
     dispatch_user_data->event = nullptr;
-    self->current_state->react(event);
-    delete self->current_event;
-    self->current_event = nullptr;
+    self->handle_event(event);
     delete dispatch_user_data;
     return false;
   }
@@ -17,6 +17,7 @@
 // limitations under the License.
 
 #include "input.hpp"
+#include <algorithm>
 
 // Define the following to dump audio streams for debugging reasons
 // #define DEBUG_DUMP_STREAMS
@@ -25,16 +26,15 @@
 FILE *fp_input;
 FILE *fp_input_mono;
 FILE *fp_playback;
-FILE *fp_filter;
 #endif
 
-genie::AudioInputAlsa::AudioInputAlsa(App *app) : app(app) {}
+genie::AudioInputAlsa::AudioInputAlsa(App *app, AudioFramePool *frame_pool)
+    : AudioInputDriver(frame_pool), app(app),
+      downmix_kernels(downmix::best()) {}
 
 genie::AudioInputAlsa::~AudioInputAlsa() {
   free(pcm);
-  free(pcm_mono);
   free(pcm_playback);
-  free(pcm_filter);
   if (alsa_handle != NULL) {
     snd_pcm_close(alsa_handle);
   }
@@ -42,7 +42,6 @@ genie::AudioInputAlsa::~AudioInputAlsa() {
   fclose(fp_input);
   fclose(fp_input_mono);
   fclose(fp_playback);
-  fclose(fp_filter);
 #endif
 }
 
@@ -70,8 +69,11 @@ bool genie::AudioInputAlsa::init_pcm(gchar *input_audio_device) {
     return false;
   }
 
-  error_code = snd_pcm_hw_params_set_access(alsa_handle, hardware_params,
-                                            SND_PCM_ACCESS_RW_INTERLEAVED);
+  use_mmap = app->config->audio_alsa_mmap;
+  error_code = snd_pcm_hw_params_set_access(
+      alsa_handle, hardware_params,
+      use_mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED
+               : SND_PCM_ACCESS_RW_INTERLEAVED);
   if (error_code != 0) {
     g_error("'snd_pcm_hw_params_set_access' failed with '%s'\n",
             snd_strerror(error_code));
@@ -87,7 +89,7 @@ bool genie::AudioInputAlsa::init_pcm(gchar *input_audio_device) {
   }
 
   error_code =
-      snd_pcm_hw_params_set_rate(alsa_handle, hardware_params, sample_rate, 0);
+      snd_pcm_hw_params_set_rate(alsa_handle, hardware_params, capture_rate, 0);
   if (error_code != 0) {
     g_error("'snd_pcm_hw_params_set_rate' failed with '%s'\n",
             snd_strerror(error_code));
@@ -102,48 +104,76 @@ bool genie::AudioInputAlsa::init_pcm(gchar *input_audio_device) {
     return false;
   }
 
+  if (app->config->audio_alsa_period_size > 0) {
+    snd_pcm_uframes_t period_size = app->config->audio_alsa_period_size;
+    error_code = snd_pcm_hw_params_set_period_size_near(
+        alsa_handle, hardware_params, &period_size, 0);
+    if (error_code != 0) {
+      g_error("'snd_pcm_hw_params_set_period_size_near' failed with '%s'\n",
+              snd_strerror(error_code));
+      return false;
+    }
+  }
+
+  if (app->config->audio_alsa_buffer_size > 0) {
+    snd_pcm_uframes_t buffer_size = app->config->audio_alsa_buffer_size;
+    error_code = snd_pcm_hw_params_set_buffer_size_near(
+        alsa_handle, hardware_params, &buffer_size);
+    if (error_code != 0) {
+      g_error("'snd_pcm_hw_params_set_buffer_size_near' failed with '%s'\n",
+              snd_strerror(error_code));
+      return false;
+    }
+  }
+
   error_code = snd_pcm_hw_params(alsa_handle, hardware_params);
   if (error_code != 0) {
     g_error("'snd_pcm_hw_params' failed with '%s'\n", snd_strerror(error_code));
     return false;
   }
 
+  snd_pcm_uframes_t period_size = 0, buffer_size = 0;
+  snd_pcm_hw_params_get_period_size(hardware_params, &period_size, NULL);
+  snd_pcm_hw_params_get_buffer_size(hardware_params, &buffer_size);
+  g_message("ALSA capture: %s access, period %lu frames, buffer %lu frames",
+            use_mmap ? "mmap" : "read", (unsigned long)period_size,
+            (unsigned long)buffer_size);
+
   snd_pcm_hw_params_free(hardware_params);
 
+  // ask for monotonic timestamps of the last period update, so frames can be
+  // timestamped with when they were captured rather than when we read them
+  snd_pcm_sw_params_t *software_params = NULL;
+  error_code = snd_pcm_sw_params_malloc(&software_params);
+  if (error_code == 0) {
+    snd_pcm_sw_params_current(alsa_handle, software_params);
+    snd_pcm_sw_params_set_tstamp_mode(alsa_handle, software_params,
+                                      SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type(alsa_handle, software_params,
+                                      SND_PCM_TSTAMP_TYPE_MONOTONIC);
+    error_code = snd_pcm_sw_params(alsa_handle, software_params);
+    if (error_code != 0) {
+      g_warning("'snd_pcm_sw_params' failed with '%s', frames will be "
+                "timestamped when read",
+                snd_strerror(error_code));
+    }
+    snd_pcm_sw_params_free(software_params);
+  }
+
   error_code = snd_pcm_prepare(alsa_handle);
   if (error_code != 0) {
     g_error("'snd_pcm_prepare' failed with '%s'\n", snd_strerror(error_code));
     return false;
   }
 
-  return true;
-}
-
-bool genie::AudioInputAlsa::init_speex() {
-  spx_int32_t tmp;
-
-  echo_state =
-      speex_echo_state_init_mc(frame_length, (sample_rate * 300) / 1000, 1, 1);
-  speex_echo_ctl(echo_state, SPEEX_ECHO_SET_SAMPLING_RATE, &(sample_rate));
-
-  pp_state = speex_preprocess_state_init(512, sample_rate);
-
-  // Not supported with the prebuilt speex
-  // tmp = true;
-  // speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_AGC, &tmp);
-
-  tmp = true;
-  speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_DENOISE, &tmp);
-
-  tmp = true;
-  speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_DEREVERB, &tmp);
-
-  tmp = -1;
-  speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_ECHO_SUPPRESS, &tmp);
-
-  speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_ECHO_STATE, echo_state);
-
-  g_print("Initialized speex echo-cancellation\n");
+  if (use_mmap) {
+    // unlike snd_pcm_readi, mmap access does not start the stream for us
+    error_code = snd_pcm_start(alsa_handle);
+    if (error_code != 0) {
+      g_error("'snd_pcm_start' failed with '%s'\n", snd_strerror(error_code));
+      return false;
+    }
+  }
 
   return true;
 }
@@ -155,13 +185,22 @@ bool genie::AudioInputAlsa::init(gchar *audio_input_device, int m_sample_rate,
     return false;
   }
   sample_rate = m_sample_rate;
+  capture_rate = app->config->audio_alsa_capture_rate
+                     ? app->config->audio_alsa_capture_rate
+                     : sample_rate;
   frame_length = max_frame_length;
 
+  const auto &mics = app->config->beamformer_mics;
   channels = 1;
-  if (app->config->audio_input_stereo2mono) {
+  if (!mics.empty()) {
+    // one channel per mic, then the loopback channel
+    has_loopback = app->config->audio_ec_loopback;
+    channels = mics.size() + (has_loopback ? 1 : 0);
+  } else if (app->config->audio_input_stereo2mono) {
     channels = 2;
     if (app->config->audio_ec_loopback) {
       channels = 3;
+      has_loopback = true;
     }
   }
 
@@ -169,25 +208,35 @@ bool genie::AudioInputAlsa::init(gchar *audio_input_device, int m_sample_rate,
     return false;
   }
 
-  if (app->config->audio_ec_enabled) {
-    if (!init_speex()) {
-      return false;
-    }
-  }
-
 #ifdef DEBUG_DUMP_STREAMS
   fp_input = fopen("/tmp/input.raw", "wb+");
   fp_input_mono = fopen("/tmp/input_mono.raw", "wb+");
   fp_playback = fopen("/tmp/playback.raw", "wb+");
-  fp_filter = fopen("/tmp/filter.raw", "wb+");
 #endif
-  pcm = (int16_t *)malloc(max_frame_length * channels * sizeof(int16_t));
-  if (!pcm) {
-    g_error("failed to allocate memory for audio buffer\n");
-    return false;
+  size_t max_read_length = max_frame_length;
+  if (capture_rate != sample_rate) {
+    // mono and reference are resampled independently
+    resampler = std::make_unique<Resampler>(capture_rate, sample_rate,
+                                            has_loopback ? 2 : 1);
+    if (!resampler->init(app->config->audio_resampler_quality)) {
+      g_error("failed to resample capture from %zu to %zu Hz", capture_rate,
+              sample_rate);
+      return false;
+    }
+    native_length =
+        (max_frame_length * capture_rate + sample_rate - 1) / sample_rate;
+    max_read_length = native_length;
+    native_mono.reset(new int16_t[native_length]);
+    native_playback.reset(new int16_t[native_length]);
+    resampled_capacity =
+        max_frame_length + resampler->max_output(native_length);
+    resampled.reset(new int16_t[resampled_capacity]);
+    resampled_playback.reset(new int16_t[resampled_capacity]);
+    g_message("ALSA capture at %zu Hz, resampled to %zu Hz with quality %zu",
+              capture_rate, sample_rate, app->config->audio_resampler_quality);
   }
 
-  pcm_mono = (int16_t *)malloc(max_frame_length * sizeof(int16_t));
+  pcm = (int16_t *)malloc(max_read_length * channels * sizeof(int16_t));
   if (!pcm) {
     g_error("failed to allocate memory for audio buffer\n");
     return false;
@@ -199,81 +248,275 @@ bool genie::AudioInputAlsa::init(gchar *audio_input_device, int m_sample_rate,
     return false;
   }
 
-  pcm_filter = (int16_t *)malloc(max_frame_length * sizeof(int16_t));
-  if (!pcm_filter) {
-    g_error("failed to allocate memory for audio buffer\n");
-    return false;
+  if (!mics.empty()) {
+    // runs on the device stream, before any resampling
+    beamformer = std::make_unique<Beamformer>(capture_rate, mics, channels,
+                                              max_read_length);
+    beamformer->init(app->config->beamformer_auto_steer,
+                     app->config->beamformer_azimuth);
   }
 
   return true;
 }
 
-genie::AudioFrame genie::AudioInputAlsa::read_frame(int32_t frame_length) {
-  int read_frames = 0;
-  int error;
-
-  if (alsa_handle != NULL) {
-    read_frames = snd_pcm_readi(alsa_handle, pcm, frame_length);
-    if (read_frames < 0) {
-      g_critical("'snd_pcm_readi' failed with '%s'", snd_strerror(read_frames));
-      return AudioFrame(0);
+/**
+ * @brief Split `count` interleaved frames starting at `in` into the mic
+ * signal, written at `mono`, and the playback reference, written at
+ * `reference`.
+ */
+void genie::AudioInputAlsa::deinterleave(const int16_t *in, int16_t *mono,
+                                         int16_t *reference, size_t count) {
+  if (beamformer) {
+    beamformer->process(in, mono, count);
+    if (has_loopback) {
+      for (size_t i = 0; i < count; i++) {
+        reference[i] = in[i * channels + channels - 1];
+      }
     }
+#ifdef DEBUG_DUMP_STREAMS
+    fwrite(in, sizeof(int16_t), count * channels, fp_input);
+#endif
+    return;
   }
 
+  switch (channels) {
+    case 1:
+      memcpy(mono, in, count * sizeof(int16_t));
+      break;
+    case 2:
+      downmix_kernels.stereo(in, mono, count);
+      break;
+    default:
+      downmix_kernels.split3(in, mono, reference, count);
+      break;
+  }
+
+#ifdef DEBUG_DUMP_STREAMS
+  fwrite(in, sizeof(int16_t), count * channels, fp_input);
+#endif
+}
+
+/**
+ * @brief Bring the stream back after an xrun or a suspend.
+ *
+ * @return true if capture can continue
+ */
+bool genie::AudioInputAlsa::recover(int error, const char *what) {
+  g_warning("'%s' failed with '%s', recovering", what, snd_strerror(error));
+  if (error == -EPIPE)
+    xrun_count++;
+  error = snd_pcm_recover(alsa_handle, error, 1);
+  if (error == 0 && use_mmap) {
+    error = snd_pcm_start(alsa_handle);
+  }
+  if (error < 0) {
+    g_critical("failed to recover the capture stream: '%s'",
+               snd_strerror(error));
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Copy `frame_length` frames out of the ALSA ring buffer with
+ * `snd_pcm_readi`, and deinterleave them into `mono` and `reference`.
+ */
+bool genie::AudioInputAlsa::read_interleaved(int16_t *mono,
+                                             int16_t *reference,
+                                             int32_t frame_length) {
+  // mono capture can land straight in the destination
+  int16_t *dest = channels == 1 ? mono : pcm;
+
+  int read_frames = snd_pcm_readi(alsa_handle, dest, frame_length);
+  if (read_frames < 0) {
+    g_critical("'snd_pcm_readi' failed with '%s'", snd_strerror(read_frames));
+    if (read_frames == -EPIPE || read_frames == -ESTRPIPE)
+      recover(read_frames, "snd_pcm_readi");
+    return false;
+  }
   if (read_frames != frame_length) {
     g_message("read %d frames instead of %d", read_frames, frame_length);
-    return AudioFrame(0);
+    return false;
   }
 
-  int16_t *pcm_out = pcm;
-
-  if (alsa_handle != NULL && channels >= 2) {
-    // lossy stereo to mono conversion for the first 2 channels (l/r)
-    // extract the playback signal from the 3rd channel
-    for (int32_t i = 0, j = 0; i < (frame_length * channels);
-         i += channels, j++) {
-      int16_t left = *(int16_t *)&pcm[i];
-      int16_t right = *(int16_t *)&pcm[i + 1];
-      if (app->config->audio_input_stereo2mono) {
-        int16_t mix = (int16_t)((int32_t(left) + right) / 2);
-        pcm_mono[j] = mix;
-      } else {
-        pcm_mono[j] = left;
-      }
-      if (app->config->audio_ec_loopback && channels == 3) {
-        int16_t ref = *(int16_t *)&pcm[i + 2];
-        pcm_playback[j] = ref;
+  if (channels > 1)
+    deinterleave(pcm, mono, reference, frame_length);
+#ifdef DEBUG_DUMP_STREAMS
+  else
+    fwrite(mono, sizeof(int16_t), frame_length, fp_input);
+#endif
+  return true;
+}
+
+/**
+ * @brief Deinterleave `frame_length` frames directly from the mmap'ed ALSA
+ * ring buffer into `mono` and `reference`, without an intermediate copy.
+ *
+ * The frame may wrap around the end of the ring buffer, in which case it is
+ * consumed in two `snd_pcm_mmap_begin()`/`snd_pcm_mmap_commit()` rounds.
+ */
+bool genie::AudioInputAlsa::read_mmap(int16_t *mono, int16_t *reference,
+                                      int32_t frame_length) {
+  snd_pcm_uframes_t done = 0;
+
+  while (done < (snd_pcm_uframes_t)frame_length) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa_handle);
+    if (avail < 0) {
+      if (!recover(avail, "snd_pcm_avail_update"))
+        return false;
+      continue;
+    }
+
+    if ((snd_pcm_uframes_t)avail < frame_length - done) {
+      int error = snd_pcm_wait(alsa_handle, 1000);
+      if (error < 0) {
+        if (!recover(error, "snd_pcm_wait"))
+          return false;
+      } else if (error == 0) {
+        g_critical("timed out waiting for capture data");
+        return false;
       }
+      continue;
     }
 
-    if (app->config->audio_ec_enabled && channels == 3) {
-      speex_echo_cancellation(echo_state, (const spx_int16_t *)pcm_mono,
-                              (const int16_t *)pcm_playback,
-                              (spx_int16_t *)pcm_filter);
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t count = frame_length - done;
+    int error = snd_pcm_mmap_begin(alsa_handle, &areas, &offset, &count);
+    if (error < 0) {
+      if (!recover(error, "snd_pcm_mmap_begin"))
+        return false;
+      continue;
+    }
 
-      /* preprecessor is run after AEC. This is not a mistake! */
-      if (pp_state) {
-        speex_preprocess_run(pp_state, (spx_int16_t *)pcm_filter);
-      }
+    // interleaved: all channels share areas[0], one frame every `step` bits
+    const int16_t *in = (const int16_t *)((const char *)areas[0].addr +
+                                          areas[0].first / 8 +
+                                          offset * (areas[0].step / 8));
+    deinterleave(in, mono + done, reference + done, count);
+
+    snd_pcm_sframes_t committed =
+        snd_pcm_mmap_commit(alsa_handle, offset, count);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != count) {
+      if (!recover(committed < 0 ? committed : -EPIPE, "snd_pcm_mmap_commit"))
+        return false;
+      // the samples we just consumed may have been overwritten, start over
+      done = 0;
+      continue;
+    }
+    done += count;
+  }
 
-#ifdef DEBUG_DUMP_STREAMS
-      fwrite(pcm_playback, sizeof(int16_t), frame_length, fp_playback);
-      fwrite(pcm_filter, sizeof(int16_t), frame_length, fp_filter);
-#endif
-      pcm_out = pcm_filter;
-    } else {
-      pcm_out = pcm_mono;
+  return true;
+}
+
+/**
+ * @brief Monotonic time at which the newest sample we have read was
+ * captured.
+ *
+ * `snd_pcm_htimestamp` reports when the last period was written by the
+ * hardware, and how many frames were still unread at that point; the
+ * newest sample we read is that many frames older.
+ */
+gint64 genie::AudioInputAlsa::capture_time() {
+  snd_pcm_uframes_t avail;
+  snd_htimestamp_t tstamp;
+  if (snd_pcm_htimestamp(alsa_handle, &avail, &tstamp) == 0 &&
+      (tstamp.tv_sec != 0 || tstamp.tv_nsec != 0)) {
+    return (gint64)tstamp.tv_sec * G_USEC_PER_SEC + tstamp.tv_nsec / 1000 -
+           (gint64)avail * G_USEC_PER_SEC / capture_rate;
+  }
+  return g_get_monotonic_time();
+}
+
+bool genie::AudioInputAlsa::read_native(int16_t *mono, int16_t *reference,
+                                        int32_t frame_length) {
+  return use_mmap ? read_mmap(mono, reference, frame_length)
+                  : read_interleaved(mono, reference, frame_length);
+}
+
+/**
+ * @brief Read and resample device chunks until `resampled` holds at least
+ * `frame_length` samples.
+ *
+ * At integer ratios such as 48 to 16 kHz every chunk resamples to exactly
+ * one frame, so apart from the filter delay no latency is added.
+ */
+bool genie::AudioInputAlsa::read_resampled(int32_t frame_length) {
+  while (resampled_count < (size_t)frame_length) {
+    size_t missing = frame_length - resampled_count;
+    size_t length =
+        std::min((missing * capture_rate + sample_rate - 1) / sample_rate,
+                 native_length);
+    if (!read_native(native_mono.get(), native_playback.get(), length))
+      return false;
+
+    size_t produced =
+        resampler->process(0, native_mono.get(), length,
+                           resampled.get() + resampled_count,
+                           resampled_capacity - resampled_count);
+    if (has_loopback) {
+      resampler->process(1, native_playback.get(), length,
+                         resampled_playback.get() + resampled_count,
+                         resampled_capacity - resampled_count);
     }
-#ifdef DEBUG_DUMP_STREAMS
-    fwrite(pcm_mono, sizeof(int16_t), frame_length, fp_input_mono);
-#endif
+    resampled_count += produced;
+  }
+  return true;
+}
+
+genie::AudioFrame genie::AudioInputAlsa::read_frame(int32_t frame_length) {
+  if (alsa_handle == NULL) {
+    return AudioFrame(0);
+  }
+  if ((size_t)frame_length > this->frame_length) {
+    g_error("cannot read %d frames into buffers of %zu", frame_length,
+            this->frame_length);
+    return AudioFrame(0);
+  }
+
+  AudioFrame frame = frame_pool->acquire(frame_length);
+
+  if (!resampler) {
+    if (!read_native(frame.samples, pcm_playback, frame_length)) {
+      return AudioFrame(0);
+    }
+    frame.timestamp = capture_time();
+  } else {
+    if (!read_resampled(frame_length)) {
+      return AudioFrame(0);
+    }
+    memcpy(frame.samples, resampled.get(), frame_length * sizeof(int16_t));
+    resampled_count -= frame_length;
+    memmove(resampled.get(), resampled.get() + frame_length,
+            resampled_count * sizeof(int16_t));
+    if (has_loopback) {
+      memcpy(pcm_playback, resampled_playback.get(),
+             frame_length * sizeof(int16_t));
+      memmove(resampled_playback.get(),
+              resampled_playback.get() + frame_length,
+              resampled_count * sizeof(int16_t));
+    }
+
+    // the newest sample we hand out is behind the newest one captured by
+    // what is left over, plus the delay of the filter
+    frame.timestamp = capture_time() -
+                      (gint64)(resampled_count + resampler->latency()) *
+                          G_USEC_PER_SEC / sample_rate;
   }
 
 #ifdef DEBUG_DUMP_STREAMS
-  fwrite(pcm, sizeof(int16_t), frame_length * channels, fp_input);
+  fwrite(frame.samples, sizeof(int16_t), frame_length, fp_input_mono);
+  if (has_loopback)
+    fwrite(pcm_playback, sizeof(int16_t), frame_length, fp_playback);
 #endif
 
-  AudioFrame frame(frame_length);
-  memcpy(frame.samples, pcm_out, frame_length * sizeof(int16_t));
   return frame;
 }
+
+void genie::AudioInputAlsa::print_stats() {
+  if (beamformer)
+    beamformer->print_stats();
+  if (resampler)
+    resampler->print_stats();
+}
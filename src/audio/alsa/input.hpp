@@ -20,21 +20,25 @@
 
 #include "../../app.hpp"
 #include "../audiodriver.hpp"
+#include "../beamformer.hpp"
+#include "../downmix.hpp"
+#include "../resampler.hpp"
 
 #include <alsa/asoundlib.h>
-
-#include <speex/speex_echo.h>
-#include <speex/speex_preprocess.h>
+#include <atomic>
 
 namespace genie {
 
 class AudioInputAlsa : public AudioInputDriver {
 public:
-  AudioInputAlsa(App *app);
+  AudioInputAlsa(App *app, AudioFramePool *frame_pool);
   ~AudioInputAlsa();
   bool init(gchar *audio_input_device, int sample_rate, int channels,
             int max_frame_length);
   AudioFrame read_frame(int32_t frame_length);
+  size_t xruns() { return xrun_count.load(); }
+  const int16_t *reference() { return has_loopback ? pcm_playback : nullptr; }
+  void print_stats();
 
 private:
   // initialized once and never overwritten
@@ -42,18 +46,44 @@ private:
   snd_pcm_t *alsa_handle = NULL;
 
   bool init_pcm(gchar *input_audio_device);
-  bool init_speex();
 
-  SpeexEchoState *echo_state;
-  SpeexPreprocessState *pp_state;
+  bool read_interleaved(int16_t *mono, int16_t *reference,
+                        int32_t frame_length);
+  bool read_mmap(int16_t *mono, int16_t *reference, int32_t frame_length);
+  bool read_native(int16_t *mono, int16_t *reference, int32_t frame_length);
+  bool read_resampled(int32_t frame_length);
+  void deinterleave(const int16_t *in, int16_t *mono, int16_t *reference,
+                    size_t count);
+  bool recover(int error, const char *what);
+  gint64 capture_time();
 
   int16_t *pcm;
-  int16_t *pcm_mono;
   int16_t *pcm_playback;
-  int16_t *pcm_filter;
+  // selected once for the CPU we run on
+  const downmix::Kernels &downmix_kernels;
+  // rate of the frames we hand out, and rate the device runs at
   size_t sample_rate;
+  size_t capture_rate;
   int16_t channels;
+  // the last channel is the playback reference
+  bool has_loopback = false;
+  std::unique_ptr<Beamformer> beamformer;
   size_t frame_length;
+  bool use_mmap = false;
+  std::atomic<size_t> xrun_count{0};
+
+  // only when capturing at a different rate than `sample_rate`: the device
+  // is read in chunks of `native_length` frames, which are resampled into
+  // `resampled` until a whole frame is available; what is left over starts
+  // the next frame
+  std::unique_ptr<Resampler> resampler;
+  size_t native_length = 0;
+  std::unique_ptr<int16_t[]> native_mono;
+  std::unique_ptr<int16_t[]> native_playback;
+  std::unique_ptr<int16_t[]> resampled;
+  std::unique_ptr<int16_t[]> resampled_playback;
+  size_t resampled_capacity = 0;
+  size_t resampled_count = 0;
 };
 
 } // namespace genie
@@ -24,21 +24,69 @@
 
 namespace genie {
 
+class AudioFramePool;
+
+/**
+ * @brief A buffer of mono 16-bit samples.
+ *
+ * Frames are either backed by a block borrowed from an `AudioFramePool`, in
+ * which case the block is returned to the pool when the frame is destroyed,
+ * or by a plain heap allocation.
+ */
 struct AudioFrame {
   int16_t *samples;
   size_t length;
+  // g_get_monotonic_time() when the newest (last) sample of the frame was
+  // captured, 0 if unknown
+  gint64 timestamp;
 
-  AudioFrame(size_t len) : samples(new int16_t[len]), length(len) {}
-  ~AudioFrame() { delete[] samples; }
+  AudioFrame() : samples(nullptr), length(0), timestamp(0), pool(nullptr) {}
+  AudioFrame(size_t len)
+      : samples(new int16_t[len]), length(len), timestamp(0), pool(nullptr) {}
+  AudioFrame(int16_t *samples, size_t len, AudioFramePool *pool)
+      : samples(samples), length(len), timestamp(0), pool(pool) {}
+  ~AudioFrame() { reset(); }
 
   AudioFrame(const AudioFrame &) = delete;
   AudioFrame &operator=(const AudioFrame &) = delete;
 
   AudioFrame(AudioFrame &&other)
-      : samples(other.samples), length(other.length) {
+      : samples(other.samples), length(other.length),
+        timestamp(other.timestamp), pool(other.pool) {
     other.samples = nullptr;
     other.length = 0;
+    other.timestamp = 0;
+    other.pool = nullptr;
+  }
+  AudioFrame &operator=(AudioFrame &&other) {
+    if (this != &other) {
+      reset();
+      samples = other.samples;
+      length = other.length;
+      timestamp = other.timestamp;
+      pool = other.pool;
+      other.samples = nullptr;
+      other.length = 0;
+      other.timestamp = 0;
+      other.pool = nullptr;
+    }
+    return *this;
+  }
+
+private:
+  AudioFramePool *pool;
+
+  void reset() {
+    if (pool)
+      release_to_pool();
+    else
+      delete[] samples;
+    samples = nullptr;
+    length = 0;
+    timestamp = 0;
+    pool = nullptr;
   }
+  void release_to_pool();
 };
 
 enum class Sound_t {
@@ -56,7 +104,7 @@ enum class AudioTaskType {
   URL,
 };
 
-enum class AudioDriverType { ALSA, PULSEAUDIO };
+enum class AudioDriverType { ALSA, PULSEAUDIO, REPLAY };
 
 static inline const char *audio_driver_type_to_string(AudioDriverType driver) {
   switch (driver) {
@@ -64,6 +112,8 @@ static inline const char *audio_driver_type_to_string(AudioDriverType driver) {
       return "alsa";
     case AudioDriverType::PULSEAUDIO:
       return "pulseaudio";
+    case AudioDriverType::REPLAY:
+      return "replay";
     default:
       g_assert_not_reached();
       return "";
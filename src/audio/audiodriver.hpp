@@ -18,15 +18,38 @@
 
 #pragma once
 
+#include "framepool.hpp"
+
 namespace genie {
 
 class AudioInputDriver {
 public:
-  AudioInputDriver(){};
+  AudioInputDriver(AudioFramePool *frame_pool) : frame_pool(frame_pool){};
   virtual ~AudioInputDriver(){};
   virtual bool init(gchar *audio_input_device, int sample_rate, int channels,
                     int max_frame_length) = 0;
   virtual AudioFrame read_frame(int32_t frame_length) = 0;
+
+  /**
+   * @brief Number of overruns reported by the audio device since startup,
+   * if the driver can tell.
+   */
+  virtual size_t xruns() { return 0; }
+
+  /**
+   * @brief The playback signal captured along with the last frame, for echo
+   * cancellation, or `nullptr` if the driver does not capture one.
+   */
+  virtual const int16_t *reference() { return nullptr; }
+
+  /**
+   * @brief Print driver specific statistics, see `AudioInput::print_stats()`.
+   */
+  virtual void print_stats() {}
+
+protected:
+  // frames handed out by read_frame() should be acquired from this pool
+  AudioFramePool *const frame_pool;
 };
 
 class AudioVolumeDriver {
@@ -0,0 +1,161 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "audiofile.hpp"
+#include "downmix.hpp"
+#include <algorithm>
+#include <glib.h>
+#include <string.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::audiofile"
+
+static uint16_t read_le16(const char *data) {
+  const guint8 *p = (const guint8 *)data;
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const char *data) {
+  const guint8 *p = (const guint8 *)data;
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static bool is_audio_file(const char *name) {
+  return g_str_has_suffix(name, ".wav") || g_str_has_suffix(name, ".raw") ||
+         g_str_has_suffix(name, ".pcm");
+}
+
+static bool load_wav(const std::string &path, const char *data, size_t size,
+                     int sample_rate, std::vector<int16_t> &samples) {
+  int format = 0, channels = 0, rate = 0, bits = 0;
+  size_t offset = 12;
+  while (offset + 8 <= size) {
+    const char *id = data + offset;
+    size_t length = read_le32(data + offset + 4);
+    offset += 8;
+    if (length > size - offset)
+      length = size - offset;
+
+    if (memcmp(id, "fmt ", 4) == 0 && length >= 16) {
+      format = read_le16(data + offset);
+      channels = read_le16(data + offset + 2);
+      rate = (int)read_le32(data + offset + 4);
+      bits = read_le16(data + offset + 14);
+    } else if (memcmp(id, "data", 4) == 0) {
+      // 1 is PCM, 0xFFFE is WAVE_FORMAT_EXTENSIBLE, which only matters to us
+      // for more than 2 channels
+      if ((format != 1 && format != 0xFFFE) || bits != 16 ||
+          (channels != 1 && channels != 2)) {
+        g_critical("%s: only 16-bit PCM mono or stereo WAV files are "
+                   "supported",
+                   path.c_str());
+        return false;
+      }
+      if (rate != sample_rate) {
+        g_critical("%s: sample rate is %d Hz, expected %d Hz",
+                   path.c_str(), rate, sample_rate);
+        return false;
+      }
+
+      size_t frames = length / (2 * channels);
+      size_t start = samples.size();
+      samples.resize(start + frames);
+      if (channels == 1) {
+        memcpy(&samples[start], data + offset, frames * sizeof(int16_t));
+      } else {
+        std::vector<int16_t> stereo(2 * frames);
+        memcpy(stereo.data(), data + offset, 2 * frames * sizeof(int16_t));
+        genie::downmix::best().stereo(stereo.data(), &samples[start], frames);
+      }
+      return true;
+    }
+
+    // chunks are padded to an even length
+    offset += length + (length & 1);
+  }
+
+  g_critical("%s: no audio data in WAV file", path.c_str());
+  return false;
+}
+
+static bool load_raw(const std::string &path, const char *data, size_t size,
+                     std::vector<int16_t> &samples) {
+  if (size % sizeof(int16_t)) {
+    g_warning("%s: odd length for 16-bit raw audio, ignoring the last byte",
+              path.c_str());
+  }
+
+  size_t start = samples.size();
+  samples.resize(start + size / sizeof(int16_t));
+  memcpy(&samples[start], data, (samples.size() - start) * sizeof(int16_t));
+  return true;
+}
+
+bool genie::audiofile::load(const std::string &path, int sample_rate,
+                            std::vector<int16_t> &samples) {
+  gchar *data;
+  gsize size;
+  GError *error = nullptr;
+  if (!g_file_get_contents(path.c_str(), &data, &size, &error)) {
+    g_critical("Failed to read %s: %s", path.c_str(), error->message);
+    g_error_free(error);
+    return false;
+  }
+
+  bool ok;
+  if (size >= 12 && memcmp(data, "RIFF", 4) == 0 &&
+      memcmp(data + 8, "WAVE", 4) == 0) {
+    ok = load_wav(path, data, size, sample_rate, samples);
+  } else {
+    ok = load_raw(path, data, size, samples);
+  }
+  g_free(data);
+  return ok;
+}
+
+bool genie::audiofile::list(const std::string &path,
+                            std::vector<std::string> &files) {
+  if (!g_file_test(path.c_str(), G_FILE_TEST_IS_DIR)) {
+    files.push_back(path);
+    return true;
+  }
+
+  GError *error = nullptr;
+  GDir *dir = g_dir_open(path.c_str(), 0, &error);
+  if (!dir) {
+    g_critical("Failed to open directory %s: %s", path.c_str(),
+               error->message);
+    g_error_free(error);
+    return false;
+  }
+
+  std::vector<std::string> names;
+  const gchar *name;
+  while ((name = g_dir_read_name(dir))) {
+    if (is_audio_file(name))
+      names.push_back(name);
+  }
+  g_dir_close(dir);
+  std::sort(names.begin(), names.end());
+
+  for (const auto &name : names) {
+    files.push_back(path + "/" + name);
+  }
+  return true;
+}
@@ -0,0 +1,45 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace genie {
+namespace audiofile {
+
+/**
+ * @brief Append the samples of a recording to `samples`.
+ *
+ * WAV files must be 16-bit PCM at `sample_rate`, mono or stereo (which is
+ * downmixed). Anything else is read as raw signed 16-bit little-endian mono
+ * samples.
+ */
+bool load(const std::string &path, int sample_rate,
+          std::vector<int16_t> &samples);
+
+/**
+ * @brief The recordings at `path`: the file itself, or the `.wav`, `.raw`
+ * and `.pcm` files of a directory in name order.
+ */
+bool list(const std::string &path, std::vector<std::string> &files);
+
+} // namespace audiofile
+} // namespace genie
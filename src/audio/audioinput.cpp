@@ -18,7 +18,14 @@
 
 #include "audioinput.hpp"
 #include "alsa/input.hpp"
+#include "latency.hpp"
 #include "pulseaudio/input.hpp"
+#include "pulseaudio/stream.hpp"
+#include "replay/input.hpp"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
 
 // note: we need to redefine G_LOG_DOMAIN here or the definition will
 // bleed into the functions declared in the header, which will break
@@ -28,19 +35,34 @@
 
 genie::AudioInput::AudioInput(App *app)
     : app(app), vad_instance(WebRtcVad_Create()), wakeword(nullptr),
-      input(nullptr), state(State::WAITING) {
+      frame_pool(nullptr), input(nullptr), capture_ring(nullptr),
+      channel(nullptr), state(State::WAITING), capture_underruns(0),
+      cursor(0), gate_context_samples(0), gate_bypass_until(0) {
   wakeword = std::make_unique<WakeWord>(app);
 
   sample_rate = wakeword->sample_rate;
-  pv_frame_length = wakeword->pv_frame_length;
-  int32_t max_frame_length =
-      std::max(AUDIO_INPUT_VAD_FRAME_LENGTH, pv_frame_length);
+  wakeword_frame_length = (int32_t)wakeword->frame_length;
+  vad_frame_length = sample_rate * app->config->vad_frame_ms / 1000;
   channels = 1;
+  capture_period = sample_rate * app->config->audio_capture_period_ms / 1000;
+  // the drivers read a whole capture period into buffers of this size, and
+  // the detection thread cuts VAD and wake word frames from the same pool
+  int32_t max_frame_length =
+      std::max({(int32_t)vad_frame_length, wakeword_frame_length,
+                (int32_t)capture_period});
+
+  frame_pool = std::make_unique<AudioFramePool>(
+      max_frame_length, app->config->audio_frame_pool_size);
 
   if (app->config->audio_backend == AudioDriverType::ALSA) {
-    input = std::make_unique<AudioInputAlsa>(app);
+    input = std::make_unique<AudioInputAlsa>(app, frame_pool.get());
+  } else if (app->config->audio_backend == AudioDriverType::PULSEAUDIO &&
+             app->config->audio_pulse_stream_input) {
+    input = std::make_unique<AudioInputPulseStream>(app, frame_pool.get());
   } else if (app->config->audio_backend == AudioDriverType::PULSEAUDIO) {
-    input = std::make_unique<AudioInputPulseSimple>(app);
+    input = std::make_unique<AudioInputPulseSimple>(app, frame_pool.get());
+  } else if (app->config->audio_backend == AudioDriverType::REPLAY) {
+    input = std::make_unique<AudioInputReplay>(app, frame_pool.get());
   } else {
     g_assert_not_reached();
   }
@@ -51,45 +73,103 @@ genie::AudioInput::AudioInput(App *app)
     return;
   }
 
+  processing = std::make_unique<AudioProcessingChain>(sample_rate,
+                                                      capture_period);
+  if (!processing->init(app, input->reference() != nullptr)) {
+    g_error("failed to initialize capture processing");
+    return;
+  }
+
   if (WebRtcVad_Init(vad_instance)) {
     g_error("failed to initialize webrtc vad\n");
     return;
   }
 
-  int vadMode = 3;
+  int vadMode = (int)app->config->vad_mode;
   if (WebRtcVad_set_mode(vad_instance, vadMode)) {
     g_error("unable to set vad mode to %d", vadMode);
     return;
   }
 
-  if (WebRtcVad_ValidRateAndFrameLength(sample_rate, pv_frame_length)) {
-    g_debug("invalid rate %zd or framelength %d", sample_rate, pv_frame_length);
+  if (WebRtcVad_ValidRateAndFrameLength(sample_rate, vad_frame_length)) {
+    g_error("invalid vad rate %zd or frame length %zd", sample_rate,
+            vad_frame_length);
+    return;
   }
+  g_message("VAD mode %d, %zu ms frames (%zd samples)", vadMode,
+            app->config->vad_frame_ms, vad_frame_length);
 
-  vad_start_frame_count = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
+  vad_start_frame_count = ms_to_frames(vad_frame_length,
                                        app->config->vad_start_speaking_ms);
   g_message("Calculated start VAD: %zd ms -> %zd frames",
             app->config->vad_start_speaking_ms, vad_start_frame_count);
 
-  vad_done_frame_count = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
+  vad_done_frame_count = ms_to_frames(vad_frame_length,
                                       app->config->vad_done_speaking_ms);
   g_message("Calculated done VAD: %zd ms -> %zd frames",
             app->config->vad_done_speaking_ms, vad_done_frame_count);
 
+  size_t vad_frame_ms = app->config->vad_frame_ms;
+  if (app->config->vad_adaptive_endpointing) {
+    endpointer = std::make_unique<Endpointer>(
+        vad_frame_ms, app->config->vad_min_done_speaking_ms,
+        app->config->vad_done_speaking_ms);
+    g_message("Adaptive endpointing: %zu to %zu ms of silence",
+              app->config->vad_min_done_speaking_ms,
+              app->config->vad_done_speaking_ms);
+  } else {
+    // still tracks the end of speech, to measure the endpoint latency
+    endpointer = std::make_unique<Endpointer>(
+        vad_frame_ms, app->config->vad_done_speaking_ms,
+        app->config->vad_done_speaking_ms);
+  }
+
   vad_input_detected_noise_frame_count = ms_to_frames(
-      AUDIO_INPUT_VAD_FRAME_LENGTH, app->config->vad_input_detected_noise_ms);
+      vad_frame_length, app->config->vad_input_detected_noise_ms);
   g_message("Calculated input detection consecutive noise frame count: %zd ms "
             "-> %zd frames",
             app->config->vad_input_detected_noise_ms,
             vad_input_detected_noise_frame_count);
 
   vad_listen_timeout_frame_count = ms_to_frames(
-      AUDIO_INPUT_VAD_FRAME_LENGTH, app->config->vad_listen_timeout_ms);
+      vad_frame_length, app->config->vad_listen_timeout_ms);
   g_message("Calculated listen timeout frame count: %zd ms "
             "-> %zd frames",
             app->config->vad_listen_timeout_ms, vad_listen_timeout_frame_count);
 
+  capture_ring = std::make_unique<CaptureRing>(
+      sample_rate * app->config->audio_capture_buffer_ms / 1000,
+      capture_period, sample_rate);
+
+  // the pre-roll is read back from the capture ring, it cannot be longer
+  preroll_samples = sample_rate * app->config->audio_preroll_ms / 1000;
+  size_t max_preroll = capture_ring->capacity() - capture_period;
+  if (preroll_samples > max_preroll) {
+    g_warning("[audio] preroll_ms %zu is longer than the capture buffer, "
+              "using %zu ms",
+              app->config->audio_preroll_ms,
+              max_preroll * 1000 / sample_rate);
+    preroll_samples = max_preroll;
+  }
+  if (app->config->pv_energy_gate) {
+    size_t hangover =
+        std::max<size_t>(1, ms_to_frames(wakeword_frame_length,
+                                         app->config->pv_gate_hangover_ms));
+    energy_gate = std::make_unique<EnergyGate>(
+        app->config->pv_gate_open_db, app->config->pv_gate_min_dbfs,
+        hangover);
+    gate_context_samples = std::min(
+        sample_rate * app->config->pv_gate_context_ms / 1000, max_preroll);
+    g_message("Wake-word energy gate: +%.1f dB over the noise floor, %zu "
+              "frames hangover, %zu samples context",
+              app->config->pv_gate_open_db, hangover, gate_context_samples);
+  }
+
+  channel =
+      std::make_unique<FrameChannel>(app, app->config->audio_channel_size);
+
   g_message("Initialized audio input with %s backend\n", audio_driver_type_to_string(app->config->audio_backend));
+  capture_thread = std::thread(&AudioInput::capture_loop, this);
   input_thread = std::thread(&AudioInput::loop, this);
 }
 
@@ -97,6 +177,7 @@ genie::AudioInput::~AudioInput() { WebRtcVad_Free(vad_instance); }
 
 void genie::AudioInput::close() {
   state.store(State::CLOSED);
+  capture_thread.join();
   input_thread.join();
 }
 
@@ -134,6 +215,62 @@ void genie::AudioInput::wake() {
   state.compare_exchange_strong(expect, State::WOKE);
 }
 
+/**
+ * @brief Abandon the command being captured, if any, and go back to waiting
+ * for the wake word.
+ *
+ * For turns that end before the end of speech (an STT failure, a stop
+ * request), so the wake word is heard again right away instead of after the
+ * VAD or the listen timeout gives up. Like `wake()`, this can be called from
+ * any thread.
+ */
+void genie::AudioInput::cancel() {
+  State current = state.load();
+  while ((current == State::WOKE || current == State::LISTENING) &&
+         !state.compare_exchange_weak(current, State::WAITING)) {
+  }
+  cancel_requested = true;
+}
+
+static void print_pool_stats(const char *name,
+                             const genie::BlockPool::Stats &stats) {
+  g_print("%12s: %zu/%zu in use, high water %zu, %zu acquired, %zu "
+          "exhausted\n",
+          name, stats.in_use, stats.capacity, stats.high_water, stats.acquired,
+          stats.exhausted);
+}
+
+/**
+ * @brief Print the audio input statistics.
+ *
+ * Safe to call from the main thread while the input thread is running.
+ */
+void genie::AudioInput::print_stats() {
+  g_print("################ Audio Input Stats ###################\n");
+  print_pool_stats("Frame pool", frame_pool->stats());
+  g_print("%12s: %zu frames larger than %zu samples\n", "Oversized",
+          frame_pool->oversized(), frame_pool->max_frame_length());
+  print_pool_stats("Event pool", state::events::InputFrame::pool_stats());
+  capture_ring->print_stats();
+  g_print("%12s: %zu failed reads, %zu device xruns\n", "",
+          capture_underruns.load(), input->xruns());
+  input->print_stats();
+  processing->print_stats();
+  wakeword->print_stats();
+  endpointer->print_stats();
+  if (energy_gate) {
+    energy_gate->print_stats();
+    // what the engine would have cost on the frames it did not see
+    double frame_us =
+        (double)wakeword_frame_length * G_USEC_PER_SEC / sample_rate;
+    g_print("%12s: ~%.1f%% CPU saved\n", "",
+            100 * energy_gate->skipped_ratio() * wakeword->average_us() /
+                frame_us);
+  }
+  channel->print_stats();
+  g_print("######################################################\n");
+}
+
 /**
  * @brief Convert `ms` milliseconds to number of frames at a given
  * `frame_length` (in samples).
@@ -150,24 +287,40 @@ size_t genie::AudioInput::ms_to_frames(size_t frame_length, size_t ms) {
   return (size_t)((sample_rate * ((double)ms / 1000)) / frame_length);
 }
 
+/**
+ * @brief Run the VAD on `frame`.
+ *
+ * @return VAD_NOT_SILENT, VAD_IS_SILENT, or -1 on error
+ */
+int genie::AudioInput::process_vad(const AudioFrame &frame) {
+  int result = WebRtcVad_Process(vad_instance, sample_rate, frame.samples,
+                                 vad_frame_length);
+  latency::record(latency::Stage::VAD, frame.timestamp);
+  return result;
+}
+
 void genie::AudioInput::transition(State to_state) {
   // Reset state variables
   state_woke_frame_count = 0;
   state_vad_silent_count = 0;
   state_vad_noise_count = 0;
 
+  // another thread may have moved the state since this iteration read it
+  // (cancel(), close()), and then it wins
+  State expect = loop_state;
   switch (to_state) {
     case State::WAITING:
       g_message("[AudioInput] -> State::WAITING");
-      state = State::WAITING;
+      endpointer->reset();
+      state.compare_exchange_strong(expect, State::WAITING);
       break;
     case State::WOKE:
       g_message("[AudioInput] -> State::WOKE");
-      state = State::WOKE;
+      state.compare_exchange_strong(expect, State::WOKE);
       break;
     case State::LISTENING:
       g_message("[AudioInput] -> State::LISTENING");
-      state = State::LISTENING;
+      state.compare_exchange_strong(expect, State::LISTENING);
       break;
     case State::CLOSED:
       g_critical(
@@ -176,45 +329,205 @@ void genie::AudioInput::transition(State to_state) {
   }
 }
 
-void genie::AudioInput::loop_waiting() {
-  AudioFrame new_frame = input->read_frame(pv_frame_length);
+/**
+ * @brief Drop what the input thread kept of a cancelled turn: the VAD and
+ * endpointer state, and the audio the next pre-roll would have reached back
+ * into.
+ */
+void genie::AudioInput::reset_turn() {
+  g_message("[AudioInput] turn cancelled");
+  state_woke_frame_count = 0;
+  state_vad_silent_count = 0;
+  state_vad_noise_count = 0;
+  endpointer->reset();
+  preroll_floor = cursor;
+}
 
-  if (new_frame.length == 0) {
+/**
+ * @brief Apply the configured scheduling policy and CPU affinity to the
+ * calling thread. Failures are not fatal, the thread just runs with the
+ * default scheduling.
+ */
+static void configure_capture_thread(size_t priority, int cpu) {
+  pthread_setname_np(pthread_self(), "genie-capture");
+
+  if (priority > 0) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = (int)priority;
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0) {
+      g_warning("Failed to set SCHED_FIFO priority %zu on the capture "
+                "thread: %s",
+                priority, strerror(error));
+    } else {
+      g_message("Capture thread running with SCHED_FIFO priority %zu",
+                priority);
+    }
+  }
+
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (error != 0) {
+      g_warning("Failed to pin the capture thread to CPU %d: %s", cpu,
+                strerror(error));
+    } else {
+      g_message("Capture thread pinned to CPU %d", cpu);
+    }
+  }
+}
+
+/**
+ * @brief Capture thread body.
+ *
+ * Does nothing but read fixed periods from the driver and append them to
+ * the capture ring, so slow wake-word or VAD processing never delays a read.
+ */
+void genie::AudioInput::capture_loop() {
+  configure_capture_thread(app->config->audio_capture_priority,
+                           app->config->audio_capture_cpu);
+
+  // from the newest sample of a period to the oldest
+  const gint64 period_us = (capture_period - 1) * G_USEC_PER_SEC / sample_rate;
+  while (state.load() != State::CLOSED) {
+    AudioFrame frame = input->read_frame(capture_period);
+    if (frame.length == 0) {
+      capture_underruns++;
+      continue;
+    }
+    if (frame.timestamp == 0)
+      frame.timestamp = g_get_monotonic_time();
+    if (!processing->empty())
+      processing->process(frame, input->reference());
+
+    capture_ring->write(frame.samples, frame.length,
+                        frame.timestamp - period_us);
+    latency::record(latency::Stage::CAPTURE, frame.timestamp);
+  }
+
+  capture_ring->close();
+}
+
+/**
+ * @brief Wait for the next `length` samples of the capture stream and return
+ * a view of them. The caller advances `cursor` once it is done with them.
+ *
+ * Returns `nullptr` if they did not arrive in a while, so the loop gets a
+ * chance to notice `State::CLOSED`.
+ */
+const int16_t *genie::AudioInput::next_samples(size_t length) {
+  const int16_t *samples = capture_ring->view(cursor, length);
+  if (!samples && capture_ring->wait(cursor + length, 100)) {
+    samples = capture_ring->view(cursor, length);
+  }
+  return samples;
+}
+
+/**
+ * @brief Take the next `length` samples of the capture stream as a frame.
+ *
+ * Returns an empty frame if they are not available yet.
+ */
+genie::AudioFrame genie::AudioInput::next_frame(size_t length) {
+  const int16_t *samples = next_samples(length);
+  if (!samples) {
+    return AudioFrame();
+  }
+
+  AudioFrame frame = frame_pool->acquire(length);
+  memcpy(frame.samples, samples, length * sizeof(int16_t));
+  frame.timestamp = capture_ring->timestamp(cursor + length - 1);
+  cursor += length;
+  return frame;
+}
+
+/**
+ * @brief Copy the audio that led up to the current position (the end of the
+ * wake word) out of the capture ring, as a single frame.
+ */
+genie::AudioFrame genie::AudioInput::preroll() {
+  CaptureRing::Position start =
+      cursor > preroll_samples ? cursor - preroll_samples : 0;
+  start = std::max({start, capture_ring->oldest(), preroll_floor});
+  if (start >= cursor) {
+    return AudioFrame();
+  }
+
+  size_t length = cursor - start;
+  const int16_t *samples = capture_ring->view(start, length);
+  if (!samples) {
+    return AudioFrame();
+  }
+
+  // too large for the pool, but this happens once per wake-up
+  AudioFrame frame(length);
+  memcpy(frame.samples, samples, length * sizeof(int16_t));
+  frame.timestamp = capture_ring->timestamp(cursor - 1);
+  return frame;
+}
+
+void genie::AudioInput::loop_waiting() {
+  // the wake-word engine looks at the capture ring directly, nothing is
+  // copied or queued until the wake-word is detected
+  const int16_t *samples = next_samples(wakeword_frame_length);
+  if (!samples) {
     return;
   }
 
-  // Drop from the queue if there are too many items
-  while (frame_buffer.size() > BUFFER_MAX_FRAMES) {
-    frame_buffer.pop();
+  if (energy_gate && cursor >= gate_bypass_until) {
+    bool was_open = energy_gate->is_open();
+    if (!energy_gate->update(samples, wakeword_frame_length)) {
+      // silence, the wake-word engine does not need to hear it
+      cursor += wakeword_frame_length;
+      return;
+    }
+    if (!was_open && gate_context_samples > 0) {
+      // the gate opens on the first loud frame, which may be well into the
+      // wake word: go back and let the engine hear what came before it
+      gate_bypass_until = cursor;
+      cursor = std::max(cursor > gate_context_samples
+                            ? cursor - gate_context_samples
+                            : 0,
+                        capture_ring->oldest());
+      return;
+    }
   }
 
   // Check the new frame for the wake-word
-  bool detected = wakeword->process(&new_frame);
+  int keyword = wakeword->process(samples, wakeword_frame_length);
+  cursor += wakeword_frame_length;
+  latency::record(latency::Stage::WAKEWORD,
+                  capture_ring->timestamp(cursor - 1));
 
-  // Add the new frame to the queue
-  frame_buffer.push(std::move(new_frame));
-
-  if (!detected) {
+  if (keyword < 0) {
     // wake-word not found
     return;
   }
 
-  g_message("Wakeword detected in waiting state");
-  app->dispatch(new state::events::Wake());
+  if (app->config->pv_keywords[keyword].action == WakeWordAction::STOP) {
+    // handled locally, there is nothing to listen to
+    g_message("Stop keyword %d detected in waiting state", keyword);
+    channel->push_event(new state::events::Panic());
+    return;
+  }
 
-  g_debug("Sending prior %zd frames\n", frame_buffer.size());
+  g_message("Wakeword %d detected in waiting state", keyword);
+  channel->push_event(new state::events::Wake(keyword));
 
-  while (!frame_buffer.empty()) {
-    app->dispatch(
-        new state::events::InputFrame(std::move(frame_buffer.front())));
-    frame_buffer.pop();
+  AudioFrame block = preroll();
+  g_debug("Sending %zu samples of pre-roll\n", block.length);
+  if (block.length > 0) {
+    channel->push_frame(std::move(block));
   }
 
   transition(State::WOKE);
 }
 
 void genie::AudioInput::loop_woke() {
-  AudioFrame new_frame = input->read_frame(AUDIO_INPUT_VAD_FRAME_LENGTH);
+  AudioFrame new_frame = next_frame(vad_frame_length);
 
   if (new_frame.length == 0) {
     return;
@@ -226,11 +539,12 @@ void genie::AudioInput::loop_woke() {
 
   // NOTE: this must run BEFORE we send the frame to the main thread
   // because the frame will become null when we send it
-  int vad_result =
-      WebRtcVad_Process(vad_instance, sample_rate, new_frame.samples,
-                        AUDIO_INPUT_VAD_FRAME_LENGTH);
+  int vad_result = process_vad(new_frame);
+  // learns the noise floor and the start of speech
+  endpointer->update(new_frame.samples, new_frame.length,
+                     vad_result == VAD_NOT_SILENT, new_frame.timestamp);
 
-  app->dispatch(new state::events::InputFrame(std::move(new_frame)));
+  channel->push_frame(std::move(new_frame), endpointer->speech_probability());
 
   if (vad_result == VAD_IS_SILENT) {
     g_debug("Frame %zu is silent in woke state (silent: %zu, noise: %zu)",
@@ -268,13 +582,13 @@ void genie::AudioInput::loop_woke() {
   if (state_woke_frame_count >= vad_start_frame_count) {
     g_debug("Not detected VAD input after %zu frames", vad_start_frame_count);
     // We have not detected speech over the start frame count, give up
-    app->dispatch(new state::events::InputDone(false));
+    channel->push_event(new state::events::InputDone(false));
     transition(State::WAITING);
   }
 }
 
 void genie::AudioInput::loop_listening() {
-  AudioFrame new_frame = input->read_frame(AUDIO_INPUT_VAD_FRAME_LENGTH);
+  AudioFrame new_frame = next_frame(vad_frame_length);
 
   if (new_frame.length == 0) {
     return;
@@ -286,10 +600,13 @@ void genie::AudioInput::loop_listening() {
 
   // NOTE: this must run BEFORE we send the frame to the main thread
   // because the frame will become null when we send it
-  int silence = WebRtcVad_Process(vad_instance, sample_rate, new_frame.samples,
-                                  AUDIO_INPUT_VAD_FRAME_LENGTH);
+  int silence = process_vad(new_frame);
+  gint64 timestamp = new_frame.timestamp;
+  bool endpoint =
+      endpointer->update(new_frame.samples, new_frame.length,
+                         silence == VAD_NOT_SILENT, new_frame.timestamp);
 
-  app->dispatch(new state::events::InputFrame(std::move(new_frame)));
+  channel->push_frame(std::move(new_frame), endpointer->speech_probability());
 
   if (silence == VAD_IS_SILENT) {
     g_debug("Frame %zu is silent in listening state (silent: %zu, noise: %zu)",
@@ -302,22 +619,33 @@ void genie::AudioInput::loop_listening() {
         state_woke_frame_count, state_vad_silent_count, state_vad_noise_count);
     state_vad_silent_count = 0;
   }
-  if (state_vad_silent_count >= vad_done_frame_count) {
+  bool adaptive = app->config->vad_adaptive_endpointing;
+  if (adaptive ? endpoint : state_vad_silent_count >= vad_done_frame_count) {
     g_debug("Detected %zu frames of silence, VAD done", state_vad_silent_count);
-    app->dispatch(new state::events::InputDone(true));
+    endpointer->record(timestamp, adaptive);
+    latency::record(latency::Stage::ENDPOINT, endpointer->speech_end());
+    channel->push_event(
+        new state::events::InputDone(true, endpointer->speech_end()));
     transition(State::WAITING);
   } else if (state_woke_frame_count >= vad_listen_timeout_frame_count) {
     g_message("LISTENING timed out after %zu frames (~%zu ms)",
               vad_listen_timeout_frame_count,
               app->config->vad_listen_timeout_ms);
-    app->dispatch(new state::events::InputDone(true));
+    channel->push_event(
+        new state::events::InputDone(true, endpointer->speech_end()));
     transition(State::WAITING);
   }
 }
 
 void genie::AudioInput::loop() {
+  pthread_setname_np(pthread_self(), "genie-detect");
+
   for (;;) {
-    switch (state) {
+    if (cancel_requested.exchange(false))
+      reset_turn();
+
+    loop_state = state.load();
+    switch (loop_state) {
       case State::CLOSED:
         return;
       case State::WAITING:
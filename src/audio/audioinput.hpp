@@ -21,22 +21,22 @@
 #include "app.hpp"
 #include "audiodriver.hpp"
 #include "audioplayer.hpp"
+#include "audioprocessor.hpp"
+#include "capturering.hpp"
+#include "endpointer.hpp"
+#include "energygate.hpp"
+#include "framechannel.hpp"
 #include "stt.hpp"
 #include "utils/webrtc_vad.h"
 #include "wakeword.hpp"
 #include <atomic>
 #include <glib.h>
-#include <queue>
 #include <thread>
 
-#define AUDIO_INPUT_VAD_FRAME_LENGTH 480
-
 namespace genie {
 
 class AudioInput {
 public:
-  static const int32_t BUFFER_MAX_FRAMES = 32;
-  // static const int32_t VAD_FRAME_LENGTH = 480;
   static const int VAD_IS_SILENT = 0;
   static const int VAD_NOT_SILENT = 1;
 
@@ -51,24 +51,52 @@ public:
   ~AudioInput();
   void close();
   void wake();
+  void cancel();
+  void print_stats();
 
 private:
   // initialized once and never overwritten
   App *const app;
   VadInst *const vad_instance;
   std::unique_ptr<WakeWord> wakeword;
+  std::unique_ptr<AudioFramePool> frame_pool;
   std::unique_ptr<AudioInputDriver> input;
+  std::unique_ptr<AudioProcessingChain> processing;
+  // nullptr unless [picovoice] energy_gate is enabled
+  std::unique_ptr<EnergyGate> energy_gate;
+  std::unique_ptr<Endpointer> endpointer;
 
-  // thread safe, accessed from both threads
+  // thread safe, accessed from all threads
+  std::unique_ptr<CaptureRing> capture_ring;
+  std::unique_ptr<FrameChannel> channel;
+  std::thread capture_thread;
   std::thread input_thread;
   std::atomic<State> state;
+  std::atomic<size_t> capture_underruns;
+  // set by cancel(), for the input thread to drop what it kept of the turn
+  std::atomic<bool> cancel_requested{false};
+
+  // only accessed from the capture thread
+  size_t capture_period;
 
-  // only accessed from the input thread
-  int32_t pv_frame_length;
+  // only accessed from the input (detection) thread
+  CaptureRing::Position cursor;
+  int32_t wakeword_frame_length;
   size_t sample_rate;
   int16_t channels;
-  std::queue<AudioFrame> frame_buffer;
+  size_t preroll_samples;
+  // audio replayed to the wake-word engine from before the frame that opens
+  // the gate, and the end of that replay, up to which the gate is not
+  // consulted
+  size_t gate_context_samples;
+  CaptureRing::Position gate_bypass_until;
+  // the pre-roll does not reach back before this, the end of the last
+  // cancelled turn
+  CaptureRing::Position preroll_floor = 0;
+  // the state the current loop iteration runs in
+  State loop_state = State::WAITING;
 
+  size_t vad_frame_length;
   size_t vad_start_frame_count;
   size_t vad_done_frame_count;
   size_t vad_input_detected_noise_frame_count;
@@ -80,11 +108,17 @@ private:
   size_t state_vad_noise_count;
 
   size_t ms_to_frames(size_t frame_length, size_t ms);
+  const int16_t *next_samples(size_t length);
+  AudioFrame next_frame(size_t length);
+  AudioFrame preroll();
+  int process_vad(const AudioFrame &frame);
+  void capture_loop();
   void loop();
   void loop_waiting();
   void loop_woke();
   void loop_listening();
   void transition(State to_state);
+  void reset_turn();
 };
 
 } // namespace genie
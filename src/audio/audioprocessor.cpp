@@ -0,0 +1,138 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "audioprocessor.hpp"
+#include "app.hpp"
+#include "speexprocessor.hpp"
+#include "webrtcprocessor.hpp"
+#include <math.h>
+#include <string.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::AudioProcessingChain"
+
+genie::GainProcessor::GainProcessor(double gain_db)
+    : factor((int32_t)lround(pow(10, gain_db / 20) * 4096)) {}
+
+bool genie::GainProcessor::process(int16_t *samples, const int16_t *reference,
+                                   size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    int64_t value = ((int64_t)samples[i] * factor + 2048) >> 12;
+    if (value > INT16_MAX)
+      value = INT16_MAX;
+    else if (value < INT16_MIN)
+      value = INT16_MIN;
+    samples[i] = (int16_t)value;
+  }
+  return true;
+}
+
+genie::AudioProcessingChain::AudioProcessingChain(size_t sample_rate,
+                                                  size_t period)
+    : sample_rate(sample_rate), period(period) {}
+
+bool genie::AudioProcessingChain::init(App *app, bool has_reference) {
+  gchar **names = g_strsplit(app->config->audio_processing, ",", -1);
+  SpeexEchoState *echo_state = nullptr;
+  bool ok = true;
+
+  for (gchar **it = names; *it && ok; it++) {
+    const gchar *name = g_strstrip(*it);
+    if (!*name)
+      continue;
+
+    if (strcmp(name, "speex_aec") == 0) {
+      if (!has_reference) {
+        g_warning("No playback reference is captured ([ec] loopback), "
+                  "skipping speex_aec");
+        continue;
+      }
+      auto aec = std::make_unique<SpeexEchoCanceller>(
+          sample_rate, period, app->config->audio_ec_tail_ms);
+      echo_state = aec->state();
+      add(std::move(aec));
+    } else if (strcmp(name, "speex_denoise") == 0) {
+      add(std::make_unique<SpeexPreprocessor>(sample_rate, period,
+                                              echo_state));
+    } else if (strcmp(name, "webrtc") == 0) {
+      if (period % (sample_rate / 100)) {
+        g_critical("WebRTC audio processing needs a capture period that is "
+                   "a multiple of 10 ms");
+        ok = false;
+        break;
+      }
+      auto webrtc = std::make_unique<WebRtcProcessor>();
+      ok = webrtc->init(sample_rate, has_reference,
+                        app->config->audio_ec_noise_suppression,
+                        app->config->audio_ec_gain_control);
+      add(std::move(webrtc));
+    } else if (strcmp(name, "gain") == 0) {
+      add(std::make_unique<GainProcessor>(app->config->audio_gain_db));
+    } else {
+      g_critical("Unknown capture processing stage '%s'", name);
+      ok = false;
+    }
+  }
+  g_strfreev(names);
+
+  if (ok && !stages.empty()) {
+    GString *list = g_string_new(nullptr);
+    for (const auto &stage : stages) {
+      g_string_append_printf(list, "%s%s", list->len ? " -> " : "",
+                             stage->processor->name());
+    }
+    g_message("Capture processing: %s", list->str);
+    g_string_free(list, TRUE);
+  }
+  return ok;
+}
+
+void genie::AudioProcessingChain::add(
+    std::unique_ptr<AudioProcessor> processor) {
+  auto stage = std::make_unique<Stage>();
+  stage->processor = std::move(processor);
+  stages.push_back(std::move(stage));
+}
+
+void genie::AudioProcessingChain::process(AudioFrame &frame,
+                                          const int16_t *reference) {
+  for (auto &stage : stages) {
+    gint64 start = g_get_monotonic_time();
+    if (!stage->processor->process(frame.samples, reference, frame.length))
+      stage->failures++;
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    stage->frames++;
+    stage->total_us += elapsed;
+    if (elapsed > stage->max_us.load(std::memory_order_relaxed))
+      stage->max_us.store(elapsed, std::memory_order_relaxed);
+  }
+}
+
+void genie::AudioProcessingChain::print_stats() {
+  // share of real time spent in each stage, i.e. of one core
+  double period_us = (double)period * G_USEC_PER_SEC / sample_rate;
+  for (const auto &stage : stages) {
+    size_t n = stage->frames.load();
+    double avg_us = n ? (double)stage->total_us.load() / n : 0.0;
+    g_print("%12s: %zu frames, %.0f us avg, %" G_GINT64_FORMAT
+            " us max, %.1f%% CPU, %zu failed\n",
+            stage->processor->name(), n, avg_us, stage->max_us.load(),
+            100 * avg_us / period_us, stage->failures.load());
+  }
+}
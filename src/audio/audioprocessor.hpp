@@ -0,0 +1,112 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "audio.hpp"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace genie {
+
+class App;
+
+/**
+ * @brief One stage of capture processing: echo cancellation, noise
+ * suppression, gain, ...
+ *
+ * Stages work in place on mono frames of the capture period, so they are
+ * created knowing the period and allocate whatever work buffers they need up
+ * front.
+ */
+class AudioProcessor {
+public:
+  virtual ~AudioProcessor() {}
+
+  virtual const char *name() const = 0;
+
+  /**
+   * @brief Process `length` samples in place.
+   *
+   * @param reference the playback signal recorded alongside the microphone,
+   * or `nullptr` if the driver does not capture one
+   * @return false if the samples could not be processed
+   */
+  virtual bool process(int16_t *samples, const int16_t *reference,
+                       size_t length) = 0;
+};
+
+/**
+ * @brief Fixed gain, with saturation.
+ */
+class GainProcessor : public AudioProcessor {
+public:
+  GainProcessor(double gain_db);
+  const char *name() const { return "gain"; }
+  bool process(int16_t *samples, const int16_t *reference, size_t length);
+
+private:
+  // Q12 fixed point
+  int32_t factor;
+};
+
+/**
+ * @brief The processing stages run on every captured period, between the
+ * `AudioInputDriver` and the capture ring, whichever the backend.
+ *
+ * Stages are listed in `[audio] processing`. Each one is timed separately;
+ * see `print_stats()`.
+ */
+class AudioProcessingChain {
+public:
+  AudioProcessingChain(size_t sample_rate, size_t period);
+
+  /**
+   * @brief Create the stages named in the configuration.
+   *
+   * @param has_reference whether the driver captures the playback signal
+   * for echo cancellation
+   */
+  bool init(App *app, bool has_reference);
+
+  void add(std::unique_ptr<AudioProcessor> processor);
+  bool empty() const { return stages.empty(); }
+
+  /**
+   * @brief Run all the stages on `frame`. Capture thread only.
+   */
+  void process(AudioFrame &frame, const int16_t *reference);
+
+  void print_stats();
+
+private:
+  struct Stage {
+    std::unique_ptr<AudioProcessor> processor;
+    std::atomic<size_t> frames{0};
+    std::atomic<size_t> failures{0};
+    std::atomic<gint64> total_us{0};
+    std::atomic<gint64> max_us{0};
+  };
+
+  const size_t sample_rate;
+  const size_t period;
+  std::vector<std::unique_ptr<Stage>> stages;
+};
+
+} // namespace genie
@@ -20,10 +20,13 @@
 
 #include "alsa/volume.hpp"
 #include "pulseaudio/volume.hpp"
+#include "replay/volume.hpp"
 
 genie::AudioVolumeController::AudioVolumeController(App *app) : app(app) {
   if (app->config->audio_backend == AudioDriverType::ALSA)
     driver = std::make_unique<AudioVolumeDriverAlsa>(app);
+  else if (app->config->audio_backend == AudioDriverType::REPLAY)
+    driver = std::make_unique<AudioVolumeDriverReplay>();
   else
     driver = std::make_unique<AudioVolumeDriverPulseAudio>(app);
 }
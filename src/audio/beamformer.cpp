@@ -0,0 +1,458 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "beamformer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <math.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__arm__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::Beamformer"
+
+namespace genie {
+namespace beamform {
+
+// Scalar
+// ===========================================================================
+
+static void sum_scalar(const int16_t *const *inputs, size_t count,
+                       int16_t *out, size_t frames) {
+  const float scale = 1.0f / count;
+  for (size_t i = 0; i < frames; i++) {
+    int32_t acc = 0;
+    for (size_t c = 0; c < count; c++) {
+      acc += inputs[c][i];
+    }
+    out[i] = (int16_t)(int32_t)((float)acc * scale);
+  }
+}
+
+static int64_t dot_scalar(const int16_t *a, const int16_t *b, size_t frames) {
+  int64_t acc = 0;
+  for (size_t i = 0; i < frames; i++) {
+    acc += (int32_t)a[i] * b[i];
+  }
+  return acc;
+}
+
+// x86-64
+// ===========================================================================
+//
+// Everything here is SSE2, which is part of the x86-64 baseline.
+//
+
+#if defined(__x86_64__)
+
+// sign-extend the low and high four int16 of `v` to int32
+static inline __m128i widen_lo_sse2(__m128i v) {
+  return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+}
+
+static inline __m128i widen_hi_sse2(__m128i v) {
+  return _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+}
+
+static void sum_sse2(const int16_t *const *inputs, size_t count, int16_t *out,
+                     size_t frames) {
+  const float scale = 1.0f / count;
+  const __m128 scale_v = _mm_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    for (size_t c = 0; c < count; c++) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(inputs[c] + i));
+      lo = _mm_add_epi32(lo, widen_lo_sse2(v));
+      hi = _mm_add_epi32(hi, widen_hi_sse2(v));
+    }
+    // the same float multiply and truncation as the scalar code
+    lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale_v));
+    hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale_v));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(lo, hi));
+  }
+  for (; i < frames; i++) {
+    int32_t acc = 0;
+    for (size_t c = 0; c < count; c++) {
+      acc += inputs[c][i];
+    }
+    out[i] = (int16_t)(int32_t)((float)acc * scale);
+  }
+}
+
+static int64_t dot_sse2(const int16_t *a, const int16_t *b, size_t frames) {
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    // four int32 sums of two products each, which only just fit; widen
+    // them to int64 before accumulating
+    __m128i products = _mm_madd_epi16(va, vb);
+    __m128i sign = _mm_srai_epi32(products, 31);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(products, sign));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(products, sign));
+  }
+  int64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return lanes[0] + lanes[1] + dot_scalar(a + i, b + i, frames - i);
+}
+
+#endif
+
+// Selection
+// ===========================================================================
+
+static const Kernels scalar_kernels = {"scalar", sum_scalar, dot_scalar};
+
+const Kernels &scalar() { return scalar_kernels; }
+
+static std::vector<Kernels> available_kernels() {
+  std::vector<Kernels> kernels;
+  kernels.push_back(scalar_kernels);
+
+#if defined(__x86_64__)
+  kernels.push_back({"sse2", sum_sse2, dot_sse2});
+#elif defined(__aarch64__)
+  kernels.push_back({"neon", sum_neon, dot_neon});
+#elif defined(__arm__)
+  if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+    kernels.push_back({"neon", sum_neon, dot_neon});
+  }
+#endif
+
+  return kernels;
+}
+
+const Kernels &best() {
+  static const Kernels selected = []() {
+    Kernels kernels = available_kernels().back();
+    g_message("Using %s beamformer kernels", kernels.name);
+    return kernels;
+  }();
+  return selected;
+}
+
+} // namespace beamform
+} // namespace genie
+
+// Beamformer
+// ===========================================================================
+
+static const double SPEED_OF_SOUND = 343.0;
+
+// only frames this far above the noise floor of the first microphone are
+// used to estimate the direction
+static const float ESTIMATE_ABOVE_FLOOR_DB = 6;
+static const float ESTIMATE_MIN_DBFS = -60;
+static const double FLOOR_FALL = 0.25;
+static const double FLOOR_RISE = 0.01;
+// weight of the past in the smoothed cross-correlation, per loud frame
+static const float CORRELATION_DECAY = 0.9f;
+// a new direction must score this much better than the current one
+static const float SWITCH_MARGIN = 0.1f;
+
+genie::Beamformer::Beamformer(size_t sample_rate,
+                              const std::vector<MicPosition> &mics,
+                              size_t stride, size_t max_frames,
+                              const beamform::Kernels &kernels)
+    : kernels(kernels), sample_rate(sample_rate), stride(stride),
+      num_mics(mics.size()), max_frames(max_frames), mics(mics),
+      inputs(mics.size()), energy(mics.size()),
+      floor(FLOOR_FALL, FLOOR_RISE) {
+  double aperture = 0;
+  for (size_t a = 0; a < num_mics; a++) {
+    for (size_t b = a + 1; b < num_mics; b++) {
+      aperture = std::max(aperture, hypot(mics[a].x - mics[b].x,
+                                          mics[a].y - mics[b].y));
+      pairs.push_back({a, b});
+    }
+  }
+  history =
+      (size_t)ceil(aperture / 1000 / SPEED_OF_SOUND * sample_rate) + 1;
+  buffer.reset(new int16_t[num_mics * (history + max_frames)]());
+}
+
+/**
+ * @brief Delay of each microphone, in samples, that lines up sound coming
+ * from `azimuth` degrees.
+ *
+ * A plane wave reaches the microphones furthest along the direction first,
+ * so they are delayed the most.
+ */
+void genie::Beamformer::compute_delays(double azimuth, size_t *out) const {
+  double angle = azimuth * M_PI / 180;
+  double ux = cos(angle), uy = sin(angle);
+  std::vector<double> projection(num_mics);
+  for (size_t c = 0; c < num_mics; c++) {
+    projection[c] = (mics[c].x * ux + mics[c].y * uy) / 1000;
+  }
+  double nearest = *std::min_element(projection.begin(), projection.end());
+  for (size_t c = 0; c < num_mics; c++) {
+    out[c] = (size_t)lround((projection[c] - nearest) / SPEED_OF_SOUND *
+                            sample_rate);
+  }
+}
+
+/**
+ * @brief Lag, in samples, at which the cross-correlation of microphones `a`
+ * and `b` peaks for sound from `azimuth` degrees.
+ */
+int genie::Beamformer::lag(double azimuth, size_t a, size_t b) const {
+  double angle = azimuth * M_PI / 180;
+  double ux = cos(angle), uy = sin(angle);
+  // `b` is closer to the source by this much, so `a` hears it later
+  double distance = ((mics[b].x - mics[a].x) * ux +
+                     (mics[b].y - mics[a].y) * uy) /
+                    1000;
+  return (int)lround(distance / SPEED_OF_SOUND * sample_rate);
+}
+
+void genie::Beamformer::init(bool auto_steer, double azimuth) {
+  this->auto_steer = auto_steer;
+  if (!auto_steer) {
+    delays.resize(num_mics);
+    compute_delays(azimuth, delays.data());
+    direction = 0;
+    m_azimuth = azimuth;
+  } else {
+    delays.resize(NUM_DIRECTIONS * num_mics);
+    lags.resize(NUM_DIRECTIONS * pairs.size());
+    for (size_t d = 0; d < NUM_DIRECTIONS; d++) {
+      double candidate = d * 360.0 / NUM_DIRECTIONS;
+      compute_delays(candidate, &delays[d * num_mics]);
+      for (size_t p = 0; p < pairs.size(); p++) {
+        lags[d * pairs.size() + p] =
+            lag(candidate, pairs[p].first, pairs[p].second);
+      }
+    }
+    correlation.assign(pairs.size() * (2 * history + 1), 0);
+    scores.resize(NUM_DIRECTIONS);
+    direction = 0;
+    m_azimuth = 0;
+  }
+
+  g_message("Beamforming %zu mics at %zu Hz, %zu samples of history, %s",
+            num_mics, sample_rate, history,
+            auto_steer ? "steering toward the talker" : "fixed steering");
+}
+
+/**
+ * @brief Update the direction estimate with the `frames` new samples.
+ */
+void genie::Beamformer::estimate(size_t frames) {
+  if (frames <= history)
+    return;
+  // every lag looks at the same stretch of the first microphone, and up to
+  // `history` samples before or after it on the second
+  size_t length = frames - history;
+
+  for (size_t c = 0; c < num_mics; c++) {
+    const int16_t *x = mic(c) + history;
+    energy[c] = (double)kernels.dot(x, x, length);
+  }
+
+  double level = energy_dbfs(energy[0], length);
+  if (!floor.above(level, ESTIMATE_ABOVE_FLOOR_DB) ||
+      level < ESTIMATE_MIN_DBFS) {
+    floor.update(level);
+    return;
+  }
+
+  size_t num_lags = 2 * history + 1;
+  for (size_t p = 0; p < pairs.size(); p++) {
+    size_t a = pairs[p].first, b = pairs[p].second;
+    double norm = sqrt(energy[a] * energy[b]);
+    if (norm <= 0)
+      continue;
+    const int16_t *x = mic(a) + history;
+    const int16_t *y = mic(b) + history;
+    float *row = &correlation[p * num_lags];
+    for (size_t k = 0; k < num_lags; k++) {
+      // lag k - history: x[n] against y[n - lag]
+      int64_t dot = kernels.dot(x, y + history - k, length);
+      row[k] = row[k] * CORRELATION_DECAY + (float)(dot / norm);
+    }
+  }
+  estimates++;
+
+  size_t best = direction;
+  for (size_t d = 0; d < NUM_DIRECTIONS; d++) {
+    float score = 0;
+    const int *direction_lags = &lags[d * pairs.size()];
+    for (size_t p = 0; p < pairs.size(); p++) {
+      score += correlation[p * num_lags + direction_lags[p] + history];
+    }
+    scores[d] = score;
+    if (score > scores[best])
+      best = d;
+  }
+  if (best != direction &&
+      scores[best] - scores[direction] >
+          SWITCH_MARGIN * fabsf(scores[direction])) {
+    direction = best;
+    m_azimuth = best * 360.0 / NUM_DIRECTIONS;
+    switches++;
+  }
+}
+
+void genie::Beamformer::process_chunk(const int16_t *in, int16_t *out,
+                                      size_t frames) {
+  for (size_t c = 0; c < num_mics; c++) {
+    int16_t *dest = mic(c) + history;
+    for (size_t i = 0; i < frames; i++) {
+      dest[i] = in[i * stride + c];
+    }
+  }
+
+  if (auto_steer)
+    estimate(frames);
+
+  const size_t *mic_delays = &delays[direction * num_mics];
+  for (size_t c = 0; c < num_mics; c++) {
+    inputs[c] = mic(c) + history - mic_delays[c];
+  }
+  kernels.sum(inputs.data(), num_mics, out, frames);
+
+  // keep the newest samples for the next call
+  for (size_t c = 0; c < num_mics; c++) {
+    int16_t *samples = mic(c);
+    memmove(samples, samples + frames, history * sizeof(int16_t));
+  }
+}
+
+void genie::Beamformer::process(const int16_t *in, int16_t *out,
+                                size_t frames) {
+  gint64 start = g_get_monotonic_time();
+  size_t done = 0;
+  while (done < frames) {
+    size_t count = std::min(frames - done, max_frames);
+    process_chunk(in + done * stride, out + done, count);
+    done += count;
+  }
+  total_us += g_get_monotonic_time() - start;
+  calls++;
+  samples += frames;
+}
+
+void genie::Beamformer::print_stats() {
+  size_t n = calls.load();
+  double avg_us = n ? (double)total_us.load() / n : 0.0;
+  double audio_us = (double)samples.load() * G_USEC_PER_SEC / sample_rate;
+  g_print("%12s: %zu mics, %s kernels, steering %s at %.0f deg\n",
+          "Beamformer", num_mics, kernels.name, auto_steer ? "auto" : "fixed",
+          azimuth());
+  g_print("%12s: %zu calls, %.1f us avg, %.2f%% CPU\n", "", n, avg_us,
+          audio_us > 0 ? 100 * total_us.load() / audio_us : 0.0);
+  if (auto_steer) {
+    g_print("%12s: %zu estimates, %zu direction changes\n", "",
+            estimates.load(), switches.load());
+  }
+}
+
+// Benchmark
+// ===========================================================================
+
+bool genie::Beamformer::benchmark() {
+  static const size_t RATES[] = {16000, 48000};
+  static const size_t FRAME_MS = 10;
+  static const size_t ITERATIONS = 2000;
+  static const double SOURCE_AZIMUTH = 60;
+  // a 6-mic circular array, 46 mm radius
+  std::vector<MicPosition> mics;
+  for (int i = 0; i < 6; i++) {
+    mics.push_back({46 * cos(i * M_PI / 3), 46 * sin(i * M_PI / 3)});
+  }
+  const size_t channels = mics.size();
+
+  auto kernels = beamform::available_kernels();
+  bool ok = true;
+
+  g_print("################ Beamformer Benchmark ################\n");
+  for (size_t rate : RATES) {
+    size_t frame = rate * FRAME_MS / 1000;
+
+    // a quiet start, so the noise floor is known, then noise from
+    // SOURCE_AZIMUTH; plus a little uncorrelated noise on every mic
+    Beamformer reference(rate, mics, channels, frame, beamform::scalar());
+    std::vector<size_t> source_delays(channels);
+    reference.compute_delays(SOURCE_AZIMUTH, source_delays.data());
+    size_t max_delay =
+        *std::max_element(source_delays.begin(), source_delays.end());
+    size_t total = frame * ITERATIONS / 10;
+    size_t quiet = total / 10;
+    std::vector<int16_t> source(total + max_delay);
+    for (size_t i = 0; i < source.size(); i++) {
+      int amplitude = i < quiet ? 100 : 8000;
+      source[i] = (int16_t)g_random_int_range(-amplitude, amplitude);
+    }
+    std::vector<int16_t> in(total * channels);
+    for (size_t i = 0; i < total; i++) {
+      for (size_t c = 0; c < channels; c++) {
+        // the mic with the largest delay hears the source first
+        in[i * channels + c] =
+            (int16_t)(source[i + source_delays[c]] +
+                      g_random_int_range(-50, 50));
+      }
+    }
+
+    std::vector<int16_t> expected(total), out(total);
+    double baseline = 0;
+    for (const auto &k : kernels) {
+      Beamformer beamformer(rate, mics, channels, frame, k);
+      beamformer.init(true, 0);
+      // steer first, on the whole signal, and check the output
+      for (size_t pos = 0; pos + frame <= total; pos += frame) {
+        beamformer.process(&in[pos * channels], &out[pos], frame);
+      }
+      if (baseline == 0)
+        expected = out;
+      bool match = out == expected;
+      ok = ok && match;
+
+      // time the loud part, where the direction is estimated
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < ITERATIONS; i++) {
+        size_t pos = quiet + (i * frame) % (total - quiet - frame + 1);
+        beamformer.process(&in[pos * channels], &out[pos], frame);
+      }
+      auto end = std::chrono::steady_clock::now();
+      double us =
+          std::chrono::duration<double, std::micro>(end - start).count() /
+          ITERATIONS;
+      if (baseline == 0)
+        baseline = us;
+      g_print("%zu mics %5zu Hz %8s: %8.1f us/frame (%5.2fx), %5.2f%% CPU, "
+              "%.0f deg%s\n",
+              channels, rate, k.name, us, baseline / us,
+              100 * us / (FRAME_MS * 1000), beamformer.azimuth(),
+              match ? "" : " MISMATCH");
+    }
+  }
+  g_print("source at %.0f deg\n", SOURCE_AZIMUTH);
+  g_print("######################################################\n");
+  return ok;
+}
@@ -0,0 +1,133 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "beamformkernels.hpp"
+#include "config.hpp"
+#include "noisefloor.hpp"
+
+#include <atomic>
+#include <glib.h>
+#include <memory>
+#include <vector>
+
+namespace genie {
+
+/**
+ * @brief Delay-and-sum beamformer for a planar microphone array.
+ *
+ * Every microphone is delayed so that sound from the steering direction
+ * lines up across the array, then all are averaged: sound from that
+ * direction adds up, noise and sound from elsewhere partly cancel out.
+ * Delays are whole samples, so the array works better captured at 48 kHz
+ * than at 16 kHz.
+ *
+ * With automatic steering, the direction is estimated from the
+ * cross-correlation of every pair of microphones on loud frames, and the
+ * beam moves to the candidate direction (every 10 degrees) whose expected
+ * pair lags correlate best.
+ */
+class Beamformer {
+public:
+  static const size_t NUM_DIRECTIONS = 36;
+
+  /**
+   * @param stride number of interleaved channels in the input, the first
+   * `mics.size()` of which are the microphones
+   * @param max_frames the most frames passed to `process()` at once
+   */
+  Beamformer(size_t sample_rate, const std::vector<MicPosition> &mics,
+             size_t stride, size_t max_frames,
+             const beamform::Kernels &kernels = beamform::best());
+
+  /**
+   * @brief Steer toward `azimuth` degrees, or toward the talker if
+   * `auto_steer`.
+   */
+  void init(bool auto_steer, double azimuth);
+
+  /**
+   * @brief Combine `frames` interleaved frames at `in` into the beam at
+   * `out`.
+   */
+  void process(const int16_t *in, int16_t *out, size_t frames);
+
+  /**
+   * @brief Current steering direction, in degrees.
+   */
+  double azimuth() const { return m_azimuth.load(); }
+
+  void print_stats();
+
+  /**
+   * @brief Time the beamformer on a 6-mic array with every available
+   * implementation, see `--benchmark=beamformer`.
+   *
+   * @return false if an implementation did not match the scalar output
+   */
+  static bool benchmark();
+
+private:
+  const beamform::Kernels &kernels;
+  const size_t sample_rate;
+  const size_t stride;
+  const size_t num_mics;
+  const size_t max_frames;
+  std::vector<MicPosition> mics;
+
+  // samples kept from the previous call, enough for the largest delay or
+  // lag between two microphones
+  size_t history;
+  // per microphone: `history` old samples followed by up to `max_frames`
+  // new ones
+  std::unique_ptr<int16_t[]> buffer;
+  std::vector<const int16_t *> inputs;
+
+  bool auto_steer = false;
+  // per microphone delays, for the fixed direction or for each candidate
+  std::vector<size_t> delays;
+  size_t direction = 0;
+  std::atomic<double> m_azimuth{0};
+
+  // direction estimation
+  std::vector<std::pair<size_t, size_t>> pairs;
+  // expected lag of each pair for each candidate direction
+  std::vector<int> lags;
+  // smoothed normalized cross-correlation of each pair at each lag
+  std::vector<float> correlation;
+  std::vector<float> scores;
+  std::vector<double> energy;
+  NoiseFloor floor;
+
+  std::atomic<size_t> calls{0};
+  std::atomic<size_t> samples{0};
+  std::atomic<gint64> total_us{0};
+  std::atomic<size_t> estimates{0};
+  std::atomic<size_t> switches{0};
+
+  int16_t *mic(size_t index) {
+    return buffer.get() + index * (history + max_frames);
+  }
+  void compute_delays(double azimuth, size_t *out) const;
+  int lag(double azimuth, size_t a, size_t b) const;
+  void estimate(size_t frames);
+  void process_chunk(const int16_t *in, int16_t *out, size_t frames);
+};
+
+} // namespace genie
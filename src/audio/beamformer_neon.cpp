@@ -0,0 +1,79 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// NEON kernels for beamformer.cpp
+//
+// On armhf this file is compiled with -mfpu=neon, so nothing in here may be
+// called unless the CPU was checked for NEON support first.
+
+#include "beamformkernels.hpp"
+
+#if defined(__arm__) || defined(__aarch64__)
+
+#include <arm_neon.h>
+
+namespace genie {
+namespace beamform {
+
+void sum_neon(const int16_t *const *inputs, size_t count, int16_t *out,
+              size_t frames) {
+  const float scale = 1.0f / count;
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    int32x4_t lo = vdupq_n_s32(0);
+    int32x4_t hi = vdupq_n_s32(0);
+    for (size_t c = 0; c < count; c++) {
+      int16x8_t v = vld1q_s16(inputs[c] + i);
+      lo = vaddw_s16(lo, vget_low_s16(v));
+      hi = vaddw_s16(hi, vget_high_s16(v));
+    }
+    // the same float multiply and truncation as the scalar code
+    lo = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(lo), scale));
+    hi = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(hi), scale));
+    vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+  }
+  for (; i < frames; i++) {
+    int32_t acc = 0;
+    for (size_t c = 0; c < count; c++) {
+      acc += inputs[c][i];
+    }
+    out[i] = (int16_t)(int32_t)((float)acc * scale);
+  }
+}
+
+int64_t dot_neon(const int16_t *a, const int16_t *b, size_t frames) {
+  int64x2_t acc = vdupq_n_s64(0);
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    int16x8_t va = vld1q_s16(a + i);
+    int16x8_t vb = vld1q_s16(b + i);
+    // products fit in int32, sums of them may not
+    acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(va), vget_low_s16(vb)));
+    acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(va), vget_high_s16(vb)));
+  }
+  int64_t sum = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+  for (; i < frames; i++) {
+    sum += (int32_t)a[i] * b[i];
+  }
+  return sum;
+}
+
+} // namespace beamform
+} // namespace genie
+
+#endif
@@ -0,0 +1,67 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace genie {
+namespace beamform {
+
+/**
+ * @brief Average `count` signals of `frames` samples into `out`.
+ *
+ * Each output sample is the sum of the inputs times `1.0f / count`,
+ * truncated toward zero.
+ */
+typedef void (*SumFunc)(const int16_t *const *inputs, size_t count,
+                        int16_t *out, size_t frames);
+
+/**
+ * @brief Dot product of two signals of `frames` samples.
+ */
+typedef int64_t (*DotFunc)(const int16_t *a, const int16_t *b, size_t frames);
+
+struct Kernels {
+  const char *name;
+  SumFunc sum;
+  DotFunc dot;
+};
+
+/**
+ * @brief The portable implementation, used as the reference.
+ */
+const Kernels &scalar();
+
+/**
+ * @brief The fastest implementation supported by the CPU we are running on.
+ *
+ * Every implementation produces output that is bit-identical to `scalar()`.
+ */
+const Kernels &best();
+
+// Implemented in beamformer_neon.cpp, which is built with NEON enabled
+#if defined(__arm__) || defined(__aarch64__)
+void sum_neon(const int16_t *const *inputs, size_t count, int16_t *out,
+              size_t frames);
+int64_t dot_neon(const int16_t *a, const int16_t *b, size_t frames);
+#endif
+
+} // namespace beamform
+} // namespace genie
@@ -0,0 +1,166 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "capturering.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::CaptureRing"
+
+// round the capacity up to whole periods, so a period never wraps
+static size_t round_to_periods(size_t capacity, size_t period) {
+  size_t periods = std::max<size_t>(2, (capacity + period - 1) / period);
+  return periods * period;
+}
+
+genie::CaptureRing::CaptureRing(size_t capacity, size_t period,
+                                size_t sample_rate)
+    : m_period(period), m_capacity(round_to_periods(capacity, period)),
+      sample_rate(sample_rate), buffer(new int16_t[2 * m_capacity]()),
+      timestamps(new std::atomic<gint64>[m_capacity / m_period]), m_head(0),
+      event_fd(-1), waiting(false), closed(false), overruns(0),
+      lost_samples(0), waits(0), views(0), total_lag(0), max_lag(0) {
+  for (size_t i = 0; i < m_capacity / m_period; i++) {
+    timestamps[i].store(0, std::memory_order_relaxed);
+  }
+
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) {
+    g_error("failed to create eventfd for the capture ring, errno = %d",
+            errno);
+  }
+}
+
+genie::CaptureRing::~CaptureRing() {
+  if (event_fd >= 0) {
+    ::close(event_fd);
+  }
+}
+
+void genie::CaptureRing::write(const int16_t *samples, size_t length,
+                               gint64 timestamp) {
+  if (length != m_period) {
+    g_critical("Capture ring expects periods of %zu samples, got %zu",
+               m_period, length);
+    return;
+  }
+
+  Position h = m_head.load(std::memory_order_relaxed);
+  size_t offset = h % m_capacity;
+  memcpy(&buffer[offset], samples, length * sizeof(int16_t));
+  memcpy(&buffer[offset + m_capacity], samples, length * sizeof(int16_t));
+  timestamps[offset / m_period].store(timestamp, std::memory_order_relaxed);
+  m_head.store(h + length, std::memory_order_release);
+
+  // pairs with the fence in wait(): either the reader sees the new head, or
+  // we see that it went to sleep and wake it up
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting.exchange(false))
+    signal();
+}
+
+void genie::CaptureRing::signal() {
+  uint64_t one = 1;
+  if (::write(event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    g_warning("failed to signal the capture ring, errno = %d", errno);
+  }
+}
+
+void genie::CaptureRing::close() {
+  closed.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  signal();
+}
+
+const int16_t *genie::CaptureRing::view(Position &position, size_t length) {
+  g_assert(length <= m_capacity - m_period);
+
+  Position h = head();
+  size_t limit = m_capacity - m_period;
+  if (h > position + limit) {
+    overruns++;
+    lost_samples += h - limit - position;
+    position = h - limit;
+  }
+  if (h < position + length) {
+    return nullptr;
+  }
+
+  size_t lag = h - (position + length);
+  views++;
+  total_lag.fetch_add(lag, std::memory_order_relaxed);
+  if (lag > max_lag.load(std::memory_order_relaxed))
+    max_lag.store(lag, std::memory_order_relaxed);
+
+  return &buffer[position % m_capacity];
+}
+
+bool genie::CaptureRing::wait(Position position, int timeout_ms) {
+  if (head() >= position)
+    return true;
+  waits++;
+
+  gint64 deadline = g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+  for (;;) {
+    waiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // re-check after announcing we are about to sleep, the writer may have
+    // moved in between
+    if (head() >= position || closed.load())
+      break;
+
+    int remaining_ms = (int)((deadline - g_get_monotonic_time()) / 1000);
+    if (remaining_ms <= 0)
+      break;
+
+    struct pollfd pfd = {event_fd, POLLIN, 0};
+    if (poll(&pfd, 1, remaining_ms) < 0 && errno != EINTR) {
+      g_warning("failed to wait on the capture ring, errno = %d", errno);
+    }
+    uint64_t count;
+    if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+      g_warning("failed to read the capture ring eventfd, errno = %d", errno);
+    }
+  }
+  waiting.store(false);
+
+  return head() >= position;
+}
+
+gint64 genie::CaptureRing::timestamp(Position position) const {
+  size_t offset = position % m_capacity;
+  gint64 start = timestamps[offset / m_period].load(std::memory_order_relaxed);
+  return start + (gint64)(offset % m_period) * G_USEC_PER_SEC / sample_rate;
+}
+
+void genie::CaptureRing::print_stats() {
+  size_t n = views.load();
+  double samples_per_ms = sample_rate / 1000.0;
+  g_print("%12s: %zu samples (%.0f ms) in periods of %zu\n", "Capture",
+          m_capacity, m_capacity / samples_per_ms, m_period);
+  g_print("%12s: %zu overruns (%zu samples lost), %zu idle waits\n", "",
+          overruns.load(), lost_samples.load(), waits.load());
+  g_print("%12s: %.2f ms average, %.2f ms max reader lag\n", "",
+          n ? total_lag.load() / samples_per_ms / n : 0.0,
+          max_lag.load() / samples_per_ms);
+}
@@ -0,0 +1,135 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <glib.h>
+#include <memory>
+
+namespace genie {
+
+/**
+ * @brief Continuous capture stream shared between the capture thread and the
+ * detection thread.
+ *
+ * The capture thread appends fixed-size periods of samples. Readers keep
+ * their own `Position` (an absolute sample index) and ask for a view of any
+ * number of samples from there, so the wake-word engine and the VAD can
+ * consume the same stream in chunks of different sizes without gaps and
+ * without reconfiguring the driver.
+ *
+ * Every sample is stored twice, at `i` and `i + capacity`, so any window of
+ * up to `capacity` samples is contiguous in memory and views never need to be
+ * copied out.
+ *
+ * The writer never blocks: if a reader falls more than `capacity - period`
+ * samples behind, the samples it has not read are overwritten and its
+ * position jumps forward (counted as an overrun). A view stays valid until
+ * the writer has appended another `capacity - period` samples, which is
+ * plenty unless the reader is already overrunning.
+ *
+ * One writer thread; any number of positions, all used from one reader
+ * thread.
+ */
+class CaptureRing {
+public:
+  typedef uint64_t Position;
+
+  CaptureRing(size_t capacity, size_t period, size_t sample_rate);
+  ~CaptureRing();
+
+  /**
+   * @brief Append one period of samples, the first of which was captured at
+   * monotonic time `timestamp`. Writer only.
+   */
+  void write(const int16_t *samples, size_t length, gint64 timestamp);
+
+  /**
+   * @brief Wake up the reader for good. Called by the writer when it exits.
+   */
+  void close();
+
+  /**
+   * @brief Position one past the newest sample.
+   */
+  Position head() const { return m_head.load(std::memory_order_acquire); }
+
+  /**
+   * @brief Position of the oldest sample a view can still start at.
+   */
+  Position oldest() const {
+    Position h = head();
+    size_t limit = m_capacity - m_period;
+    return h > limit ? h - limit : 0;
+  }
+
+  /**
+   * @brief A view of `length` samples starting at `position`, or `nullptr`
+   * if they have not all been captured yet. Reader only.
+   *
+   * If `position` has already been overwritten it is moved forward to the
+   * oldest sample still available.
+   */
+  const int16_t *view(Position &position, size_t length);
+
+  /**
+   * @brief Sleep until the writer has reached `position`, for at most
+   * `timeout_ms`. Reader only.
+   *
+   * @return false on timeout or once the ring is closed
+   */
+  bool wait(Position position, int timeout_ms);
+
+  /**
+   * @brief Monotonic capture time of the sample at `position`.
+   */
+  gint64 timestamp(Position position) const;
+
+  size_t capacity() const { return m_capacity; }
+  size_t period() const { return m_period; }
+
+  void print_stats();
+
+private:
+  void signal();
+
+  const size_t m_period;
+  const size_t m_capacity;
+  const size_t sample_rate;
+  std::unique_ptr<int16_t[]> buffer;
+  // capture time of the first sample of each period slot
+  std::unique_ptr<std::atomic<gint64>[]> timestamps;
+  std::atomic<Position> m_head;
+
+  int event_fd;
+  std::atomic<bool> waiting;
+  std::atomic<bool> closed;
+
+  // updated on the reader thread
+  std::atomic<size_t> overruns;
+  std::atomic<size_t> lost_samples;
+  std::atomic<size_t> waits;
+  std::atomic<size_t> views;
+  std::atomic<size_t> total_lag;
+  std::atomic<size_t> max_lag;
+};
+
+} // namespace genie
@@ -0,0 +1,257 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "downmix.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <glib.h>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#elif defined(__arm__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::downmix"
+
+namespace genie {
+namespace downmix {
+
+// Scalar
+// ===========================================================================
+
+static inline int16_t average(int16_t left, int16_t right) {
+  return (int16_t)((int32_t(left) + right) / 2);
+}
+
+static void stereo_scalar(const int16_t *in, int16_t *mono, size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    mono[i] = average(in[2 * i], in[2 * i + 1]);
+  }
+}
+
+static void split3_scalar(const int16_t *in, int16_t *mono, int16_t *ref,
+                          size_t frames) {
+  for (size_t i = 0; i < frames; i++) {
+    mono[i] = average(in[3 * i], in[3 * i + 1]);
+    ref[i] = in[3 * i + 2];
+  }
+}
+
+// x86-64
+// ===========================================================================
+//
+// SSE2 is part of the x86-64 baseline. The 3-channel split needs a byte
+// shuffle, which only comes with SSSE3, so that kernel is compiled for SSSE3
+// and only selected when the CPU has it.
+//
+
+#if defined(__x86_64__)
+
+// (l + r) / 2 for the adjacent (l, r) int16 pairs in `pairs`, as int32
+static inline __m128i average_pairs_sse2(__m128i pairs) {
+  __m128i sum = _mm_madd_epi16(pairs, _mm_set1_epi16(1));
+  // add 1 to negative sums so the shift rounds toward zero like `/ 2`
+  sum = _mm_add_epi32(sum, _mm_srli_epi32(sum, 31));
+  return _mm_srai_epi32(sum, 1);
+}
+
+static void stereo_sse2(const int16_t *in, int16_t *mono, size_t frames) {
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(in + 2 * i + 8));
+    __m128i out =
+        _mm_packs_epi32(average_pairs_sse2(lo), average_pairs_sse2(hi));
+    _mm_storeu_si128((__m128i *)(mono + i), out);
+  }
+  stereo_scalar(in + 2 * i, mono + i, frames - i);
+}
+
+__attribute__((target("ssse3"))) static void
+split3_ssse3(const int16_t *in, int16_t *mono, int16_t *ref, size_t frames) {
+  // Eight frames span three vectors. The masks gather the (l, r) pairs of
+  // frames 0-3 and 4-7, and the reference samples of frames 0-7.
+  const __m128i pairs0_a =
+      _mm_setr_epi8(0, 1, 2, 3, 6, 7, 8, 9, 12, 13, 14, 15, -1, -1, -1, -1);
+  const __m128i pairs0_b =
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 3, 4, 5);
+  const __m128i pairs1_b = _mm_setr_epi8(8, 9, 10, 11, 14, 15, -1, -1, -1, -1,
+                                         -1, -1, -1, -1, -1, -1);
+  const __m128i pairs1_c =
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 0, 1, 4, 5, 6, 7, 10, 11, 12, 13);
+  const __m128i ref_a = _mm_setr_epi8(4, 5, 10, 11, -1, -1, -1, -1, -1, -1,
+                                      -1, -1, -1, -1, -1, -1);
+  const __m128i ref_b = _mm_setr_epi8(-1, -1, -1, -1, 0, 1, 6, 7, 12, 13, -1,
+                                      -1, -1, -1, -1, -1);
+  const __m128i ref_c = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                      2, 3, 8, 9, 14, 15);
+
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    const int16_t *src = in + 3 * i;
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 8));
+    __m128i c = _mm_loadu_si128((const __m128i *)(src + 16));
+
+    __m128i pairs0 = _mm_or_si128(_mm_shuffle_epi8(a, pairs0_a),
+                                  _mm_shuffle_epi8(b, pairs0_b));
+    __m128i pairs1 = _mm_or_si128(_mm_shuffle_epi8(b, pairs1_b),
+                                  _mm_shuffle_epi8(c, pairs1_c));
+    __m128i out =
+        _mm_packs_epi32(average_pairs_sse2(pairs0), average_pairs_sse2(pairs1));
+    _mm_storeu_si128((__m128i *)(mono + i), out);
+
+    __m128i r = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a, ref_a), _mm_shuffle_epi8(b, ref_b)),
+        _mm_shuffle_epi8(c, ref_c));
+    _mm_storeu_si128((__m128i *)(ref + i), r);
+  }
+  split3_scalar(in + 3 * i, mono + i, ref + i, frames - i);
+}
+
+#endif
+
+// Selection
+// ===========================================================================
+
+static const Kernels scalar_kernels = {"scalar", stereo_scalar, split3_scalar};
+
+const Kernels &scalar() { return scalar_kernels; }
+
+static std::vector<Kernels> available_kernels() {
+  std::vector<Kernels> kernels;
+  kernels.push_back(scalar_kernels);
+
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("ssse3")) {
+    kernels.push_back({"sse2/ssse3", stereo_sse2, split3_ssse3});
+  } else {
+    kernels.push_back({"sse2", stereo_sse2, split3_scalar});
+  }
+#elif defined(__aarch64__)
+  kernels.push_back({"neon", stereo_neon, split3_neon});
+#elif defined(__arm__)
+  if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+    kernels.push_back({"neon", stereo_neon, split3_neon});
+  }
+#endif
+
+  return kernels;
+}
+
+const Kernels &best() {
+  static const Kernels selected = []() {
+    Kernels kernels = available_kernels().back();
+    g_message("Using %s downmix kernels", kernels.name);
+    return kernels;
+  }();
+  return selected;
+}
+
+// Benchmark
+// ===========================================================================
+
+static double time_ns_per_frame(const Kernels &kernels, int channels,
+                                const int16_t *in, int16_t *mono, int16_t *ref,
+                                size_t frames, size_t iterations) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    if (channels == 2)
+      kernels.stereo(in, mono, frames);
+    else
+      kernels.split3(in, mono, ref, frames);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         iterations;
+}
+
+bool benchmark() {
+  static const size_t FRAME_LENGTHS[] = {480, 512};
+  static const size_t ITERATIONS = 20000;
+  // a couple of samples past the frame so the tail handling is exercised
+  static const size_t MAX_FRAMES = 512 + 7;
+
+  std::unique_ptr<int16_t[]> in(new int16_t[MAX_FRAMES * 3]);
+  std::unique_ptr<int16_t[]> mono(new int16_t[MAX_FRAMES]);
+  std::unique_ptr<int16_t[]> ref(new int16_t[MAX_FRAMES]);
+  std::unique_ptr<int16_t[]> expected_mono(new int16_t[MAX_FRAMES]);
+  std::unique_ptr<int16_t[]> expected_ref(new int16_t[MAX_FRAMES]);
+
+  // full-scale noise, including the extremes, to catch rounding and
+  // overflow differences
+  for (size_t i = 0; i < MAX_FRAMES * 3; i++) {
+    in[i] = (int16_t)g_random_int_range(INT16_MIN, INT16_MAX + 1);
+  }
+  in[0] = INT16_MIN;
+  in[1] = INT16_MIN;
+  in[3] = INT16_MAX;
+  in[4] = INT16_MAX;
+  in[6] = -1;
+  in[7] = 0;
+
+  auto kernels = available_kernels();
+  bool ok = true;
+
+  g_print("################# Downmix Benchmark ##################\n");
+  for (int channels = 2; channels <= 3; channels++) {
+    for (size_t frames : FRAME_LENGTHS) {
+      double baseline = 0;
+      for (const auto &k : kernels) {
+        // check the output first, on a length that is not a multiple of
+        // the vector width
+        size_t check_frames = MAX_FRAMES;
+        if (channels == 2) {
+          scalar_kernels.stereo(in.get(), expected_mono.get(), check_frames);
+          k.stereo(in.get(), mono.get(), check_frames);
+        } else {
+          scalar_kernels.split3(in.get(), expected_mono.get(),
+                                expected_ref.get(), check_frames);
+          k.split3(in.get(), mono.get(), ref.get(), check_frames);
+        }
+        bool match = memcmp(mono.get(), expected_mono.get(),
+                            check_frames * sizeof(int16_t)) == 0;
+        if (channels == 3)
+          match = match && memcmp(ref.get(), expected_ref.get(),
+                                  check_frames * sizeof(int16_t)) == 0;
+        ok = ok && match;
+
+        double ns = time_ns_per_frame(k, channels, in.get(), mono.get(),
+                                      ref.get(), frames, ITERATIONS);
+        if (baseline == 0)
+          baseline = ns;
+        g_print("%d ch %4zu samples %12s: %9.1f ns/frame (%5.2fx)%s\n",
+                channels, frames, k.name, ns, baseline / ns,
+                match ? "" : " MISMATCH");
+      }
+    }
+  }
+  g_print("######################################################\n");
+
+  return ok;
+}
+
+} // namespace downmix
+} // namespace genie
@@ -0,0 +1,75 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace genie {
+namespace downmix {
+
+/**
+ * @brief Average the two channels of an interleaved stereo stream into mono.
+ *
+ * Each output sample is `(left + right) / 2`, rounded toward zero.
+ */
+typedef void (*StereoFunc)(const int16_t *in, int16_t *mono, size_t frames);
+
+/**
+ * @brief Split an interleaved 3-channel stream (left mic, right mic,
+ * playback reference) into the averaged mic signal and the reference.
+ */
+typedef void (*Split3Func)(const int16_t *in, int16_t *mono, int16_t *ref,
+                           size_t frames);
+
+struct Kernels {
+  const char *name;
+  StereoFunc stereo;
+  Split3Func split3;
+};
+
+/**
+ * @brief The portable implementation, used as the reference.
+ */
+const Kernels &scalar();
+
+/**
+ * @brief The fastest implementation supported by the CPU we are running on.
+ *
+ * Every implementation produces output that is bit-identical to `scalar()`.
+ */
+const Kernels &best();
+
+/**
+ * @brief Time every available implementation on typical frame sizes and
+ * print the results.
+ *
+ * @return false if an implementation did not match the scalar output
+ */
+bool benchmark();
+
+// Implemented in downmix_neon.cpp, which is built with NEON enabled
+#if defined(__arm__) || defined(__aarch64__)
+void stereo_neon(const int16_t *in, int16_t *mono, size_t frames);
+void split3_neon(const int16_t *in, int16_t *mono, int16_t *ref,
+                 size_t frames);
+#endif
+
+} // namespace downmix
+} // namespace genie
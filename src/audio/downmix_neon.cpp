@@ -0,0 +1,72 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// NEON kernels for downmix.cpp
+//
+// On armhf this file is compiled with -mfpu=neon, so nothing in here may be
+// called unless the CPU was checked for NEON support first.
+
+#include "downmix.hpp"
+
+#if defined(__arm__) || defined(__aarch64__)
+
+#include <arm_neon.h>
+
+namespace genie {
+namespace downmix {
+
+// (l + r) / 2 rounded toward zero, like the scalar code.
+//
+// vhaddq_s16 computes (l + r) >> 1 without overflowing, which rounds toward
+// negative infinity; add back 1 when the sum is odd and negative.
+static inline int16x8_t average_neon(int16x8_t left, int16x8_t right) {
+  int16x8_t half = vhaddq_s16(left, right);
+  uint16x8_t negative = vshrq_n_u16(vreinterpretq_u16_s16(half), 15);
+  int16x8_t odd = veorq_s16(left, right);
+  return vaddq_s16(half, vandq_s16(odd, vreinterpretq_s16_u16(negative)));
+}
+
+void stereo_neon(const int16_t *in, int16_t *mono, size_t frames) {
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    int16x8x2_t lr = vld2q_s16(in + 2 * i);
+    vst1q_s16(mono + i, average_neon(lr.val[0], lr.val[1]));
+  }
+  for (; i < frames; i++) {
+    mono[i] = (int16_t)((int32_t(in[2 * i]) + in[2 * i + 1]) / 2);
+  }
+}
+
+void split3_neon(const int16_t *in, int16_t *mono, int16_t *ref,
+                 size_t frames) {
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    int16x8x3_t lrf = vld3q_s16(in + 3 * i);
+    vst1q_s16(mono + i, average_neon(lrf.val[0], lrf.val[1]));
+    vst1q_s16(ref + i, lrf.val[2]);
+  }
+  for (; i < frames; i++) {
+    mono[i] = (int16_t)((int32_t(in[3 * i]) + in[3 * i + 1]) / 2);
+    ref[i] = in[3 * i + 2];
+  }
+}
+
+} // namespace downmix
+} // namespace genie
+
+#endif
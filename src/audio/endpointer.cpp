@@ -0,0 +1,130 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "endpointer.hpp"
+#include <algorithm>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::Endpointer"
+
+// speech must be this far above the noise floor to count
+static const double SPEECH_ABOVE_FLOOR_DB = 3;
+static const double FLOOR_FALL = 0.25;
+static const double FLOOR_RISE = 0.02;
+// weight of a new frame in the smoothed VAD decision, and how high it must
+// be for a frame to count as speech
+static const float PROBABILITY_WEIGHT = 0.3f;
+static const float SPEECH_PROBABILITY = 0.5f;
+// speech after which the tail is at its longest
+static const size_t LONG_SPEECH_MS = 3000;
+// below this signal to noise ratio the tail starts growing, and at the
+// lower one it is at its longest
+static const double CLEAN_SNR_DB = 20;
+static const double NOISY_SNR_DB = 10;
+
+genie::Endpointer::Endpointer(size_t frame_ms, size_t min_tail_ms,
+                              size_t max_tail_ms)
+    : frame_ms(frame_ms), min_tail_ms(std::min(min_tail_ms, max_tail_ms)),
+      max_tail_ms(max_tail_ms), floor(FLOOR_FALL, FLOOR_RISE) {
+  reset();
+}
+
+void genie::Endpointer::reset() {
+  speech_dbfs = 0;
+  probability.store(0);
+  speech_frames = 0;
+  silent_frames = 0;
+  last_speech = 0;
+}
+
+size_t genie::Endpointer::tail_ms() const {
+  size_t speech_ms = speech_frames * frame_ms;
+  double tail = min_tail_ms + (double)(max_tail_ms - min_tail_ms) *
+                                  std::min(speech_ms, LONG_SPEECH_MS) /
+                                  LONG_SPEECH_MS;
+
+  double snr = speech_dbfs - floor.dbfs();
+  if (speech_frames > 0 && snr < CLEAN_SNR_DB) {
+    double noisy = std::min(1.0, (CLEAN_SNR_DB - snr) /
+                                     (CLEAN_SNR_DB - NOISY_SNR_DB));
+    tail += (max_tail_ms - tail) * noisy;
+  }
+  return (size_t)tail;
+}
+
+bool genie::Endpointer::update(const int16_t *samples, size_t length,
+                               bool vad_speech, gint64 timestamp) {
+  double level = level_dbfs(samples, length);
+  bool loud = floor.above(level, SPEECH_ABOVE_FLOOR_DB);
+  float speech = vad_speech && loud ? 1.0f : 0.0f;
+  float p = probability.load(std::memory_order_relaxed);
+  p += (speech - p) * PROBABILITY_WEIGHT;
+  probability.store(p, std::memory_order_relaxed);
+
+  if (speech > 0 && p >= SPEECH_PROBABILITY) {
+    speech_frames++;
+    silent_frames = 0;
+    last_speech = timestamp;
+    // running average of the speech level
+    speech_dbfs += (level - speech_dbfs) / std::min<size_t>(speech_frames, 50);
+    return false;
+  }
+
+  if (!vad_speech || !loud)
+    floor.update(level);
+  if (speech_frames == 0)
+    return false;
+
+  silent_frames++;
+  return silent_frames * frame_ms >= tail_ms();
+}
+
+void genie::Endpointer::record(gint64 decided, bool adaptive) {
+  size_t speech_ms = speech_frames * frame_ms;
+  size_t tail = adaptive ? tail_ms() : max_tail_ms;
+  gint64 latency_us = last_speech ? decided - last_speech : 0;
+
+  endpoints++;
+  total_latency_us += latency_us;
+  gint64 max = max_latency_us.load();
+  while (latency_us > max &&
+         !max_latency_us.compare_exchange_weak(max, latency_us)) {
+  }
+  total_tail_ms += tail;
+  total_speech_ms += speech_ms;
+
+  g_message("End of speech after %zu ms of speech, %zu ms tail, decided %"
+            G_GINT64_FORMAT " ms after the last speech frame",
+            speech_ms, tail, latency_us / 1000);
+}
+
+void genie::Endpointer::print_stats() {
+  size_t n = endpoints.load();
+  if (n == 0) {
+    g_print("%12s: no endpoints, floor %.1f dBFS\n", "Endpointing",
+            floor.dbfs());
+    return;
+  }
+  g_print("%12s: %zu endpoints, %.0f ms avg speech, %.0f ms avg tail\n",
+          "Endpointing", n, (double)total_speech_ms.load() / n,
+          (double)total_tail_ms.load() / n);
+  g_print("%12s: %.0f ms avg, %.0f ms max from the end of speech, floor %.1f "
+          "dBFS\n",
+          "", (double)total_latency_us.load() / n / 1000,
+          max_latency_us.load() / 1000.0, floor.dbfs());
+}
@@ -0,0 +1,107 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "noisefloor.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <glib.h>
+
+namespace genie {
+
+/**
+ * @brief Decides when the user has stopped talking, from the VAD decision
+ * and the level of each frame.
+ *
+ * A frame counts as speech when the VAD says so, it is louder than the
+ * noise floor, and enough of the recent frames were speech too, so short
+ * VAD blips in the silence after a command do not hold the turn open.
+ *
+ * The turn ends after a tail of silence that adapts to the turn: it grows
+ * from `min_tail_ms` toward `max_tail_ms` with the amount of speech heard
+ * (a short command rarely pauses, a long sentence might), and goes to
+ * `max_tail_ms` when speech is barely above the noise, where the VAD is
+ * unreliable.
+ */
+class Endpointer {
+public:
+  Endpointer(size_t frame_ms, size_t min_tail_ms, size_t max_tail_ms);
+
+  /**
+   * @brief Start a new turn; the noise floor is kept.
+   */
+  void reset();
+
+  /**
+   * @brief Feed the next frame, captured at `timestamp`, with the raw VAD
+   * decision for it.
+   *
+   * @return true once the tail of silence after speech is long enough
+   */
+  bool update(const int16_t *samples, size_t length, bool vad_speech,
+              gint64 timestamp);
+
+  /**
+   * @brief Capture time of the end of the last speech frame, or 0 if there
+   * was no speech in this turn.
+   */
+  gint64 speech_end() const { return last_speech; }
+
+  /**
+   * @brief Smoothed probability that the user is speaking, from 0 to 1,
+   * the one the speech and end-of-speech decisions are made on. Reset to 0
+   * with the turn. Any thread.
+   */
+  float speech_probability() const { return probability.load(); }
+
+  /**
+   * @brief Silence needed to end the turn as it stands, in milliseconds.
+   */
+  size_t tail_ms() const;
+
+  /**
+   * @brief Count an endpoint decided at `decided` (a capture timestamp),
+   * for the stats, and log it.
+   */
+  void record(gint64 decided, bool adaptive);
+
+  void print_stats();
+
+private:
+  const size_t frame_ms;
+  const size_t min_tail_ms;
+  const size_t max_tail_ms;
+
+  // only touched by the detection thread
+  double speech_dbfs;
+  size_t speech_frames;
+  size_t silent_frames;
+  gint64 last_speech;
+
+  NoiseFloor floor;
+  std::atomic<float> probability{0};
+  std::atomic<size_t> endpoints{0};
+  std::atomic<gint64> total_latency_us{0};
+  std::atomic<gint64> max_latency_us{0};
+  std::atomic<size_t> total_tail_ms{0};
+  std::atomic<size_t> total_speech_ms{0};
+};
+
+} // namespace genie
@@ -0,0 +1,70 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "energygate.hpp"
+#include <glib.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::EnergyGate"
+
+// how much of the difference the noise floor catches up every frame, when
+// the level drops below it and when it rises above it; while the gate is
+// open it rises much more slowly, enough to skip over speech but still adapt
+// to a new steady noise (a fan, the TV) within half a minute or so
+static const double FLOOR_FALL = 0.25;
+static const double FLOOR_RISE = 0.02;
+static const double FLOOR_RISE_OPEN = 0.002;
+
+genie::EnergyGate::EnergyGate(double open_db, double min_dbfs,
+                              size_t hangover)
+    : open_db(open_db), min_dbfs(min_dbfs), hangover(hangover), open(false),
+      quiet_frames(0), floor(FLOOR_FALL, FLOOR_RISE, min_dbfs), passed(0),
+      skipped(0), opened(0) {}
+
+bool genie::EnergyGate::update(const int16_t *samples, size_t length) {
+  double level = level_dbfs(samples, length);
+
+  if (!open) {
+    if (level >= min_dbfs && floor.above(level, open_db)) {
+      open = true;
+      quiet_frames = 0;
+      opened++;
+    } else {
+      floor.update(level);
+    }
+  } else {
+    floor.update(level, 0, FLOOR_RISE_OPEN);
+    if (floor.above(level, open_db / 2))
+      quiet_frames = 0;
+    else if (++quiet_frames >= hangover)
+      open = false;
+  }
+
+  if (open)
+    passed++;
+  else
+    skipped++;
+  return open;
+}
+
+void genie::EnergyGate::print_stats() {
+  g_print("%12s: %zu passed, %zu skipped (%.1f%%), opened %zu times, "
+          "floor %.1f dBFS\n",
+          "Energy gate", passed.load(), skipped.load(),
+          100 * skipped_ratio(), opened.load(), floor.dbfs());
+}
@@ -0,0 +1,76 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "noisefloor.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace genie {
+
+/**
+ * @brief Cheap energy detector that decides whether a frame is worth running
+ * the wake-word engine on.
+ *
+ * The gate tracks the background noise level: it follows quieter frames
+ * quickly and louder ones slowly, and much more slowly while it is open, so
+ * speech barely raises it. It opens when a frame is `open_db` above that
+ * floor (and louder than `min_dbfs`), and closes again once no frame has been
+ * more than `open_db / 2` above the floor for `hangover` frames.
+ */
+class EnergyGate {
+public:
+  EnergyGate(double open_db, double min_dbfs, size_t hangover);
+
+  /**
+   * @brief Feed the next frame.
+   *
+   * @return whether the gate is open for this frame
+   */
+  bool update(const int16_t *samples, size_t length);
+
+  bool is_open() const { return open; }
+
+  /**
+   * @brief Fraction of the frames the gate kept from the wake-word engine.
+   */
+  double skipped_ratio() const {
+    size_t p = passed.load(), s = skipped.load();
+    return p + s ? (double)s / (p + s) : 0.0;
+  }
+
+  void print_stats();
+
+private:
+  const double open_db;
+  const double min_dbfs;
+  const size_t hangover;
+
+  // only touched by the detection thread
+  bool open;
+  size_t quiet_frames;
+
+  NoiseFloor floor;
+  std::atomic<size_t> passed;
+  std::atomic<size_t> skipped;
+  std::atomic<size_t> opened;
+};
+
+} // namespace genie
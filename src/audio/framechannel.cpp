@@ -0,0 +1,139 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "framechannel.hpp"
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::FrameChannel"
+
+genie::FrameChannel::FrameChannel(App *app, size_t capacity)
+    : app(app), ring(capacity), event_fd(-1), source(nullptr), armed(true),
+      pushed(0), dropped(0), overflowed(0), high_water(0), wakeups(0),
+      delivered(0), largest_batch(0) {
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) {
+    g_error("failed to create eventfd for the frame channel, errno = %d",
+            errno);
+    return;
+  }
+
+  static GSourceFuncs source_funcs = {
+      nullptr, // prepare
+      nullptr, // check
+      dispatch_source,
+      nullptr, // finalize
+      nullptr,
+      nullptr,
+  };
+
+  source = g_source_new(&source_funcs, sizeof(Source));
+  reinterpret_cast<Source *>(source)->channel = this;
+  g_source_set_name(source, "genie::FrameChannel");
+  g_source_add_unix_fd(source, event_fd, G_IO_IN);
+  g_source_attach(source, nullptr);
+}
+
+genie::FrameChannel::~FrameChannel() {
+  if (source) {
+    g_source_destroy(source);
+    g_source_unref(source);
+  }
+  if (event_fd >= 0) {
+    ::close(event_fd);
+  }
+
+  // free whatever the main loop did not get to
+  Item item;
+  while (ring.pop(item)) {
+    delete item.event;
+  }
+}
+
+void genie::FrameChannel::push_frame(AudioFrame frame,
+                                     float speech_probability) {
+  auto event =
+      new state::events::InputFrame(std::move(frame), speech_probability);
+  if (!push(Item{event, handle<state::events::InputFrame>})) {
+    dropped++;
+    delete event;
+  }
+}
+
+bool genie::FrameChannel::push(Item item) {
+  if (!ring.push(std::move(item))) {
+    overflowed++;
+    return false;
+  }
+  pushed++;
+
+  size_t occupancy = ring.size();
+  if (occupancy > high_water.load(std::memory_order_relaxed))
+    high_water.store(occupancy, std::memory_order_relaxed);
+
+  // pairs with the fence in drain(): either the main loop sees the item
+  // we just pushed, or we see that it re-armed and signal it
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (armed.exchange(false)) {
+    uint64_t one = 1;
+    if (write(event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+      g_warning("failed to signal the frame channel, errno = %d", errno);
+    }
+  }
+  return true;
+}
+
+void genie::FrameChannel::drain() {
+  uint64_t count;
+  if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    g_warning("failed to read the frame channel eventfd, errno = %d", errno);
+  }
+
+  armed.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  size_t batch = 0;
+  Item item;
+  while (ring.pop(item)) {
+    item.handler(app, item.event);
+    batch++;
+  }
+
+  wakeups++;
+  delivered += batch;
+  if (batch > largest_batch)
+    largest_batch = batch;
+}
+
+gboolean genie::FrameChannel::dispatch_source(GSource *source,
+                                              GSourceFunc callback,
+                                              gpointer data) {
+  reinterpret_cast<Source *>(source)->channel->drain();
+  return G_SOURCE_CONTINUE;
+}
+
+void genie::FrameChannel::print_stats() {
+  g_print("%12s: %zu/%zu queued, high water %zu\n", "Channel", ring.size(),
+          ring.capacity(), high_water.load());
+  g_print("%12s: %zu pushed, %zu frames dropped, %zu full\n", "", pushed.load(),
+          dropped.load(), overflowed.load());
+  g_print("%12s: %zu wakeups, %.1f items/wakeup, largest batch %zu\n", "",
+          wakeups, wakeups ? (double)delivered / wakeups : 0.0, largest_batch);
+}
@@ -0,0 +1,113 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "app.hpp"
+#include "utils/spsc-ring.hpp"
+#include <atomic>
+#include <glib.h>
+
+namespace genie {
+
+/**
+ * @brief Carries events from the audio input thread to the main loop.
+ *
+ * Frames (and the few control events the input thread emits, so they stay
+ * ordered with respect to the frames) are pushed onto a lock-free SPSC ring.
+ * A single custom `GSource`, woken through an `eventfd`, drains the ring on
+ * the main thread. The eventfd is only signalled when the main loop is not
+ * already due to drain, so the main loop wakes up once per batch of frames
+ * rather than once per frame, and nothing takes the `GMainContext` lock on
+ * the input thread.
+ */
+class FrameChannel {
+public:
+  FrameChannel(App *app, size_t capacity);
+  ~FrameChannel();
+
+  /**
+   * @brief Queue a captured frame. Input thread only.
+   *
+   * If the ring is full the frame is dropped. `speech_probability` is the
+   * endpointer's speech probability after the frame, if it has seen it.
+   */
+  void push_frame(AudioFrame frame, float speech_probability = 0);
+
+  /**
+   * @brief Queue a state `event` after the frames pushed so far.
+   * Input thread only.
+   *
+   * Control events are never dropped: if the ring is full the event is
+   * dispatched through `App::dispatch()` instead.
+   */
+  template <typename E> void push_event(E *event) {
+    if (!push(Item{event, handle<E>})) {
+      g_warning("Frame channel full, dispatching %s out of order",
+                typeid(E).name());
+      app->dispatch(event);
+    }
+  }
+
+  void print_stats();
+
+private:
+  typedef void (*Handler)(App *app, state::events::Event *event);
+
+  struct Item {
+    state::events::Event *event;
+    Handler handler;
+  };
+
+  struct Source {
+    GSource source;
+    FrameChannel *channel;
+  };
+
+  template <typename E>
+  static void handle(App *app, state::events::Event *event) {
+    app->handle_event(static_cast<E *>(event));
+  }
+
+  bool push(Item item);
+  void drain();
+  static gboolean dispatch_source(GSource *source, GSourceFunc callback,
+                                  gpointer data);
+
+  App *const app;
+  SPSCRing<Item> ring;
+  int event_fd;
+  GSource *source;
+
+  // true when the main loop has drained the ring and must be signalled
+  // before it looks at it again
+  std::atomic<bool> armed;
+
+  // updated on the input thread
+  std::atomic<size_t> pushed;
+  std::atomic<size_t> dropped;
+  std::atomic<size_t> overflowed;
+  std::atomic<size_t> high_water;
+
+  // updated on the main thread
+  size_t wakeups;
+  size_t delivered;
+  size_t largest_batch;
+};
+
+} // namespace genie
@@ -0,0 +1,111 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "framepool.hpp"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::AudioFramePool"
+
+// round block sizes up so every block is suitably aligned for any type
+static size_t align_block_size(size_t size) {
+  const size_t align = alignof(std::max_align_t);
+  return (size + align - 1) / align * align;
+}
+
+genie::BlockPool::BlockPool(size_t block_size, size_t num_blocks)
+    : m_block_size(align_block_size(block_size)),
+      storage_size(m_block_size * num_blocks),
+      storage(new char[storage_size]), m_stats() {
+  m_stats.capacity = num_blocks;
+
+  free_blocks.reserve(num_blocks);
+  // push in reverse so the first acquire() returns the first block
+  for (size_t i = num_blocks; i > 0; i--) {
+    free_blocks.push_back(storage.get() + (i - 1) * m_block_size);
+  }
+}
+
+genie::BlockPool::~BlockPool() {
+  if (free_blocks.size() != m_stats.capacity) {
+    g_warning("Destroying block pool with %zu blocks still in use",
+              m_stats.capacity - free_blocks.size());
+  }
+}
+
+void *genie::BlockPool::acquire() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (free_blocks.empty()) {
+    m_stats.exhausted++;
+    return nullptr;
+  }
+
+  void *block = free_blocks.back();
+  free_blocks.pop_back();
+
+  m_stats.acquired++;
+  m_stats.in_use++;
+  if (m_stats.in_use > m_stats.high_water)
+    m_stats.high_water = m_stats.in_use;
+  return block;
+}
+
+bool genie::BlockPool::release(void *block) {
+  if (!owns(block))
+    return false;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  // capacity was reserved in the constructor, so this never allocates
+  free_blocks.push_back(block);
+  m_stats.in_use--;
+  return true;
+}
+
+genie::BlockPool::Stats genie::BlockPool::stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return m_stats;
+}
+
+genie::AudioFramePool::AudioFramePool(size_t max_frame_length,
+                                      size_t num_frames)
+    : m_max_frame_length(max_frame_length),
+      blocks(max_frame_length * sizeof(int16_t), num_frames), m_oversized(0) {
+}
+
+genie::AudioFrame genie::AudioFramePool::acquire(size_t length) {
+  if (length > m_max_frame_length) {
+    m_oversized++;
+    return AudioFrame(length);
+  }
+
+  void *block = blocks.acquire();
+  if (!block) {
+    // the pool is sized for the worst case we expect, so this indicates
+    // the main loop is falling behind
+    return AudioFrame(length);
+  }
+  return AudioFrame(static_cast<int16_t *>(block), length, this);
+}
+
+void genie::AudioFramePool::release(int16_t *samples) {
+  if (!blocks.release(samples)) {
+    g_critical("Releasing an audio frame that does not belong to the pool");
+  }
+}
+
+void genie::AudioFrame::release_to_pool() { pool->release(samples); }
@@ -0,0 +1,108 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "audio.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace genie {
+
+/**
+ * @brief Fixed-capacity pool of equally sized memory blocks.
+ *
+ * All the memory is allocated up front, so acquiring and releasing blocks
+ * never touches the allocator. Blocks can be acquired on one thread and
+ * released on another.
+ */
+class BlockPool {
+public:
+  struct Stats {
+    size_t capacity;
+    size_t in_use;
+    size_t high_water;
+    size_t acquired;
+    size_t exhausted;
+  };
+
+  BlockPool(size_t block_size, size_t num_blocks);
+  ~BlockPool();
+
+  BlockPool(const BlockPool &) = delete;
+  BlockPool &operator=(const BlockPool &) = delete;
+
+  /**
+   * @brief Borrow a block, or return `nullptr` if the pool is exhausted.
+   */
+  void *acquire();
+
+  /**
+   * @brief Give back a block obtained from `acquire()`.
+   *
+   * Returns `false` (and does nothing) if the block does not belong to
+   * this pool.
+   */
+  bool release(void *block);
+
+  bool owns(const void *block) const {
+    auto ptr = static_cast<const char *>(block);
+    return ptr >= storage.get() && ptr < storage.get() + storage_size;
+  }
+
+  size_t block_size() const { return m_block_size; }
+  Stats stats();
+
+private:
+  const size_t m_block_size;
+  const size_t storage_size;
+  std::unique_ptr<char[]> storage;
+
+  std::mutex mutex;
+  std::vector<void *> free_blocks;
+  Stats m_stats;
+};
+
+/**
+ * @brief Pool of sample buffers for `AudioFrame`s.
+ *
+ * Frames acquired from the pool return their buffer when they are destroyed.
+ * When the pool is exhausted (or the requested frame is larger than a pool
+ * block) the frame falls back to a heap allocation, which is counted so
+ * the pool can be sized appropriately.
+ */
+class AudioFramePool {
+public:
+  AudioFramePool(size_t max_frame_length, size_t num_frames);
+
+  AudioFrame acquire(size_t length);
+  void release(int16_t *samples);
+
+  size_t max_frame_length() const { return m_max_frame_length; }
+  BlockPool::Stats stats() { return blocks.stats(); }
+  size_t oversized() const { return m_oversized; }
+
+private:
+  const size_t m_max_frame_length;
+  BlockPool blocks;
+  std::atomic<size_t> m_oversized;
+};
+
+} // namespace genie
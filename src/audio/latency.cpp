@@ -0,0 +1,137 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "latency.hpp"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::latency"
+
+namespace genie {
+namespace latency {
+
+// bucket i holds latencies below 250 << i microseconds, the last one
+// everything above
+static const gint64 FIRST_BUCKET_US = 250;
+
+Histogram::Histogram() : count(0), total_us(0), max_us(0) {
+  for (size_t i = 0; i < NUM_BUCKETS; i++) {
+    buckets[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::record(gint64 us) {
+  if (us < 0)
+    us = 0;
+
+  size_t bucket = 0;
+  while (bucket < NUM_BUCKETS - 1 && us >= (FIRST_BUCKET_US << bucket))
+    bucket++;
+
+  buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  total_us.fetch_add(us, std::memory_order_relaxed);
+  gint64 max = max_us.load(std::memory_order_relaxed);
+  while (us > max &&
+         !max_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+  }
+}
+
+// upper bound of the bucket containing the p-th percentile
+gint64 Histogram::percentile(double p) const {
+  size_t n = count.load(std::memory_order_relaxed);
+  size_t target = (size_t)(n * p);
+  size_t seen = 0;
+  for (size_t i = 0; i < NUM_BUCKETS - 1; i++) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen > target)
+      return FIRST_BUCKET_US << i;
+  }
+  return max_us.load(std::memory_order_relaxed);
+}
+
+void Histogram::print(const char *name) const {
+  size_t n = count.load();
+  if (n == 0) {
+    g_print("%12s: no frames\n", name);
+    return;
+  }
+
+  g_print("%12s: %zu frames, %.1f ms avg, p50 < %.1f ms, p99 < %.1f ms, "
+          "max %.1f ms\n",
+          name, n, (double)total_us.load() / n / 1000.0,
+          percentile(0.5) / 1000.0, percentile(0.99) / 1000.0,
+          max_us.load() / 1000.0);
+
+  // only print the buckets that have something in them
+  GString *line = g_string_new(NULL);
+  for (size_t i = 0; i < NUM_BUCKETS; i++) {
+    size_t c = buckets[i].load();
+    if (c == 0)
+      continue;
+    if (i < NUM_BUCKETS - 1)
+      g_string_append_printf(line, " <%g:%zu", (FIRST_BUCKET_US << i) / 1000.0,
+                             c);
+    else
+      g_string_append_printf(line, " >=%g:%zu",
+                             (FIRST_BUCKET_US << (i - 1)) / 1000.0, c);
+  }
+  g_print("%12s:%s (ms:frames)\n", "", line->str);
+  g_string_free(line, TRUE);
+}
+
+static Histogram histograms[NUM_STAGES];
+
+static const char *stage_name(Stage stage) {
+  switch (stage) {
+    case Stage::CAPTURE:
+      return "Capture";
+    case Stage::WAKEWORD:
+      return "Wakeword";
+    case Stage::VAD:
+      return "VAD";
+    case Stage::LISTENING:
+      return "Listening";
+    case Stage::STT_SEND:
+      return "STT send";
+    case Stage::ENDPOINT:
+      return "Endpoint";
+    case Stage::STT_DONE:
+      return "STT done";
+    case Stage::STT_RESULT:
+      return "STT result";
+    default:
+      g_assert_not_reached();
+      return "";
+  }
+}
+
+void record(Stage stage, gint64 timestamp) {
+  if (timestamp == 0)
+    return;
+  histograms[(size_t)stage].record(g_get_monotonic_time() - timestamp);
+}
+
+void print_stats() {
+  g_print("################### Frame Latency ####################\n");
+  for (size_t i = 0; i < NUM_STAGES; i++) {
+    histograms[i].print(stage_name((Stage)i));
+  }
+  g_print("######################################################\n");
+}
+
+} // namespace latency
+} // namespace genie
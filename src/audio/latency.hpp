@@ -0,0 +1,91 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <glib.h>
+
+namespace genie {
+namespace latency {
+
+/**
+ * @brief Points along the audio path where a frame's age is measured.
+ *
+ * The age of a frame is the time since its newest sample was captured
+ * (`AudioFrame::timestamp`).
+ */
+enum class Stage {
+  // the capture thread appended the frame to the capture ring
+  CAPTURE,
+  // the wake-word engine finished looking at the frame
+  WAKEWORD,
+  // the VAD finished looking at the frame
+  VAD,
+  // the main loop handed the frame to STT (`Listening::react`)
+  LISTENING,
+  // the frame was written to the STT websocket
+  STT_SEND,
+  // the VAD decided the user stopped talking, measured from the end of the
+  // last speech frame rather than from a frame
+  ENDPOINT,
+  // STT was told the input is done (`Listening::react(InputDone *)`), also
+  // measured from the end of speech
+  STT_DONE,
+  // the STT result came back, also measured from the end of speech
+  STT_RESULT,
+};
+
+static const size_t NUM_STAGES = (size_t)Stage::STT_RESULT + 1;
+
+/**
+ * @brief Histogram of latencies with power-of-two buckets, from under 250 us
+ * up to over 4 s.
+ *
+ * Lock-free; can be updated from any thread and printed from another.
+ */
+class Histogram {
+public:
+  static const size_t NUM_BUCKETS = 16;
+
+  Histogram();
+  void record(gint64 us);
+  void print(const char *name) const;
+
+private:
+  std::atomic<size_t> buckets[NUM_BUCKETS];
+  std::atomic<size_t> count;
+  std::atomic<gint64> total_us;
+  std::atomic<gint64> max_us;
+
+  gint64 percentile(double p) const;
+};
+
+/**
+ * @brief Record that a frame captured at `timestamp` (monotonic, in
+ * microseconds) reached `stage` now. Frames without a timestamp are ignored.
+ */
+void record(Stage stage, gint64 timestamp);
+
+/**
+ * @brief Print the histogram of every stage.
+ */
+void print_stats();
+
+} // namespace latency
+} // namespace genie
@@ -0,0 +1,172 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mfcc.hpp"
+#include "noisefloor.hpp"
+#include <algorithm>
+#include <math.h>
+
+static const float PRE_EMPHASIS = 0.97f;
+static const float MIN_FREQUENCY = 60.0f;
+
+static float hz_to_mel(float hz) { return 2595.0f * log10f(1 + hz / 700.0f); }
+
+static float mel_to_hz(float mel) {
+  return 700.0f * (powf(10, mel / 2595.0f) - 1);
+}
+
+genie::Mfcc::Mfcc(size_t sample_rate)
+    : m_hop(sample_rate / 100), m_window(sample_rate / 40), fft_size(1) {
+  while (fft_size < m_window)
+    fft_size <<= 1;
+  size_t bits = 0;
+  while ((1u << bits) < fft_size)
+    bits++;
+
+  hamming.resize(m_window);
+  for (size_t i = 0; i < m_window; i++) {
+    hamming[i] = 0.54f - 0.46f * cosf(2 * (float)M_PI * i / (m_window - 1));
+  }
+
+  bit_reverse.resize(fft_size);
+  for (size_t i = 0; i < fft_size; i++) {
+    size_t reversed = 0;
+    for (size_t b = 0; b < bits; b++) {
+      if (i & (1u << b))
+        reversed |= 1u << (bits - 1 - b);
+    }
+    bit_reverse[i] = (uint16_t)reversed;
+  }
+
+  twiddle_re.resize(fft_size / 2);
+  twiddle_im.resize(fft_size / 2);
+  for (size_t i = 0; i < fft_size / 2; i++) {
+    twiddle_re[i] = cosf(2 * (float)M_PI * i / fft_size);
+    twiddle_im[i] = -sinf(2 * (float)M_PI * i / fft_size);
+  }
+
+  // filter edges equally spaced on the mel scale
+  size_t bins = fft_size / 2 + 1;
+  float low = hz_to_mel(MIN_FREQUENCY);
+  float high = hz_to_mel(sample_rate / 2.0f);
+  std::vector<float> edges(NUM_FILTERS + 2);
+  for (size_t i = 0; i < edges.size(); i++) {
+    float hz = mel_to_hz(low + (high - low) * i / (NUM_FILTERS + 1));
+    edges[i] = hz * fft_size / sample_rate;
+  }
+  filter_start.resize(NUM_FILTERS);
+  filter_weights.resize(NUM_FILTERS);
+  for (size_t f = 0; f < NUM_FILTERS; f++) {
+    size_t start = (size_t)ceilf(edges[f]);
+    size_t end = std::min(bins, (size_t)floorf(edges[f + 2]) + 1);
+    filter_start[f] = start;
+    for (size_t bin = start; bin < end; bin++) {
+      float weight = bin < edges[f + 1]
+                         ? (bin - edges[f]) / (edges[f + 1] - edges[f])
+                         : (edges[f + 2] - bin) / (edges[f + 2] - edges[f + 1]);
+      filter_weights[f].push_back(std::max(0.0f, weight));
+    }
+  }
+
+  // DCT-II rows 1..NUM_COEFFICIENTS
+  dct.resize(NUM_COEFFICIENTS * NUM_FILTERS);
+  float scale = sqrtf(2.0f / NUM_FILTERS);
+  for (size_t c = 0; c < NUM_COEFFICIENTS; c++) {
+    for (size_t f = 0; f < NUM_FILTERS; f++) {
+      dct[c * NUM_FILTERS + f] =
+          scale * cosf((float)M_PI * (c + 1) * (f + 0.5f) / NUM_FILTERS);
+    }
+  }
+
+  re.resize(fft_size);
+  im.resize(fft_size);
+  energies.resize(NUM_FILTERS);
+}
+
+void genie::Mfcc::fft() {
+  for (size_t i = 0; i < fft_size; i++) {
+    size_t j = bit_reverse[i];
+    if (i < j) {
+      std::swap(re[i], re[j]);
+      std::swap(im[i], im[j]);
+    }
+  }
+
+  for (size_t size = 2; size <= fft_size; size <<= 1) {
+    size_t half = size / 2;
+    size_t step = fft_size / size;
+    for (size_t start = 0; start < fft_size; start += size) {
+      for (size_t k = 0; k < half; k++) {
+        float wr = twiddle_re[k * step], wi = twiddle_im[k * step];
+        size_t a = start + k, b = a + half;
+        float tr = re[b] * wr - im[b] * wi;
+        float ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+void genie::Mfcc::compute(const int16_t *samples, float *features) {
+  float previous = samples[0];
+  for (size_t i = 0; i < m_window; i++) {
+    float sample = samples[i];
+    re[i] = (sample - PRE_EMPHASIS * previous) * hamming[i];
+    im[i] = 0;
+    previous = sample;
+  }
+  for (size_t i = m_window; i < fft_size; i++) {
+    re[i] = im[i] = 0;
+  }
+  fft();
+
+  for (size_t f = 0; f < NUM_FILTERS; f++) {
+    float energy = 0;
+    size_t bin = filter_start[f];
+    for (float weight : filter_weights[f]) {
+      energy += weight * (re[bin] * re[bin] + im[bin] * im[bin]);
+      bin++;
+    }
+    // the floor keeps digital silence finite
+    energies[f] = logf(energy + 1.0f);
+  }
+
+  for (size_t c = 0; c < NUM_COEFFICIENTS; c++) {
+    const float *row = &dct[c * NUM_FILTERS];
+    float sum = 0;
+    for (size_t f = 0; f < NUM_FILTERS; f++) {
+      sum += row[f] * energies[f];
+    }
+    features[c] = sum;
+  }
+}
+
+void genie::Mfcc::compute_all(const std::vector<int16_t> &samples,
+                              std::vector<float> &features,
+                              std::vector<float> &levels) {
+  features.clear();
+  levels.clear();
+  for (size_t start = 0; start + m_window <= samples.size(); start += m_hop) {
+    features.resize(features.size() + NUM_COEFFICIENTS);
+    compute(&samples[start], &features[features.size() - NUM_COEFFICIENTS]);
+    levels.push_back(level_dbfs(&samples[start], m_window));
+  }
+}
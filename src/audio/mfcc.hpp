@@ -0,0 +1,78 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace genie {
+
+/**
+ * @brief Mel-frequency cepstral coefficients of 25 ms windows, computed
+ * every 10 ms.
+ *
+ * The 0th coefficient, which only carries the overall level, is left out,
+ * so the features do not depend on the input gain.
+ */
+class Mfcc {
+public:
+  static const size_t NUM_COEFFICIENTS = 12;
+
+  Mfcc(size_t sample_rate);
+
+  size_t hop() const { return m_hop; }
+  size_t window() const { return m_window; }
+
+  /**
+   * @brief Features of the `window()` samples at `samples`.
+   */
+  void compute(const int16_t *samples, float *features);
+
+  /**
+   * @brief Features and levels of every hop of a recording.
+   */
+  void compute_all(const std::vector<int16_t> &samples,
+                   std::vector<float> &features, std::vector<float> &levels);
+
+private:
+  static const size_t NUM_FILTERS = 26;
+
+  const size_t m_hop;
+  const size_t m_window;
+  size_t fft_size;
+
+  std::vector<float> hamming;
+  std::vector<uint16_t> bit_reverse;
+  std::vector<float> twiddle_re;
+  std::vector<float> twiddle_im;
+  // triangular filters over the power spectrum bins
+  std::vector<size_t> filter_start;
+  std::vector<std::vector<float>> filter_weights;
+  std::vector<float> dct;
+
+  // work buffers
+  std::vector<float> re;
+  std::vector<float> im;
+  std::vector<float> energies;
+
+  void fft();
+};
+
+} // namespace genie
@@ -0,0 +1,49 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "noisefloor.hpp"
+#include <math.h>
+
+double genie::level_dbfs(const int16_t *samples, size_t length) {
+  int64_t energy = 0;
+  for (size_t i = 0; i < length; i++) {
+    energy += (int32_t)samples[i] * samples[i];
+  }
+  return energy_dbfs((double)energy, length);
+}
+
+double genie::energy_dbfs(double energy, size_t length) {
+  // +1 keeps digital silence finite, at about -96 dBFS
+  double mean = energy / length + 1;
+  return 10 * log10(mean / (32768.0 * 32768.0));
+}
+
+genie::NoiseFloor::NoiseFloor(double fall, double rise, double initial_dbfs)
+    : fall(fall), rise(rise), initialized(false), floor_dbfs(initial_dbfs) {}
+
+void genie::NoiseFloor::update(double level, double fall, double rise) {
+  double floor = dbfs();
+  if (!initialized) {
+    floor = level;
+    initialized = true;
+  } else {
+    floor += (level - floor) * (level < floor ? fall : rise);
+  }
+  floor_dbfs.store(floor, std::memory_order_relaxed);
+}
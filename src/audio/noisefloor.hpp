@@ -0,0 +1,82 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace genie {
+
+/**
+ * @brief Level of a frame, in dB relative to full scale.
+ *
+ * Digital silence comes out at about -96 dBFS rather than minus infinity.
+ */
+double level_dbfs(const int16_t *samples, size_t length);
+
+/**
+ * @brief Same as level_dbfs(), from the sum of the squared samples.
+ */
+double energy_dbfs(double energy, size_t length);
+
+/**
+ * @brief Background noise level, tracked as an asymmetric moving average.
+ *
+ * Every update moves the floor by a fraction of the difference to the new
+ * level: `fall` when the level is below the floor, `rise` when above, so it
+ * follows quiet stretches quickly and only creeps up under speech. The first
+ * level seen sets the floor. Callers decide which frames are noise and only
+ * update with those.
+ *
+ * The floor is only updated by one thread but can be read from any.
+ */
+class NoiseFloor {
+public:
+  NoiseFloor(double fall, double rise, double initial_dbfs = 0);
+
+  /**
+   * @brief Follow a frame at `level` dBFS.
+   */
+  void update(double level) { update(level, fall, rise); }
+
+  /**
+   * @brief Follow a frame with other rates than the usual ones.
+   */
+  void update(double level, double fall, double rise);
+
+  /**
+   * @brief Whether `level` is more than `margin_db` above the floor; never
+   * true before the first update.
+   */
+  bool above(double level, double margin_db) const {
+    return initialized && level > dbfs() + margin_db;
+  }
+
+  double dbfs() const { return floor_dbfs.load(std::memory_order_relaxed); }
+
+private:
+  const double fall;
+  const double rise;
+  bool initialized;
+  std::atomic<double> floor_dbfs;
+};
+
+} // namespace genie
@@ -0,0 +1,154 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "porcupine.hpp"
+#include <dlfcn.h>
+#include <glib.h>
+#include <vector>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::PorcupineEngine"
+
+genie::PorcupineEngine::PorcupineEngine()
+    : m_sample_rate(0), m_frame_length(0), porcupine_library(nullptr),
+      porcupine(nullptr), pv_porcupine_delete_func(nullptr),
+      pv_porcupine_process_func(nullptr), pv_status_to_string_func(nullptr) {}
+
+genie::PorcupineEngine::~PorcupineEngine() {
+  if (porcupine) {
+    pv_porcupine_delete_func(porcupine);
+  }
+  if (porcupine_library) {
+    dlclose(porcupine_library);
+  }
+}
+
+// resolve `path` against the asset directory unless it is absolute
+static char *asset_path(genie::App *app, const char *path) {
+  if (path[0] == '/')
+    return g_strdup(path);
+  return g_build_filename(app->config->asset_dir, path, nullptr);
+}
+
+bool genie::PorcupineEngine::init(
+    App *app, const std::vector<WakeWordKeyword> &keywords) {
+  char *library_path =
+      g_build_filename(app->config->asset_dir, "libpv_porcupine.so", nullptr);
+  porcupine_library = dlopen(library_path, RTLD_NOW);
+  if (!porcupine_library) {
+    g_critical("failed to open library %s: %s", library_path, dlerror());
+    g_free(library_path);
+    return false;
+  }
+  g_free(library_path);
+
+  char *error = NULL;
+
+  pv_status_to_string_func = (const char *(*)(pv_status_t))dlsym(
+      porcupine_library, "pv_status_to_string");
+  if ((error = dlerror()) != NULL) {
+    g_critical("failed to load 'pv_status_to_string' with '%s'.\n", error);
+    return false;
+  }
+
+  auto pv_sample_rate_func =
+      (decltype(pv_sample_rate) *)dlsym(porcupine_library, "pv_sample_rate");
+  if ((error = dlerror()) != NULL) {
+    g_critical("failed to load 'pv_sample_rate' with '%s'.\n", error);
+    return false;
+  }
+
+  int32_t sample_rate_signed = pv_sample_rate_func();
+  g_assert(sample_rate_signed > 0);
+  m_sample_rate = (size_t)sample_rate_signed;
+
+  auto pv_porcupine_init_func = (decltype(pv_porcupine_init) *)dlsym(
+      porcupine_library, "pv_porcupine_init");
+  if ((error = dlerror()) != NULL) {
+    g_critical("failed to load 'pv_porcupine_init' with '%s'.\n", error);
+    return false;
+  }
+
+  pv_porcupine_delete_func = (decltype(pv_porcupine_delete) *)dlsym(
+      porcupine_library, "pv_porcupine_delete");
+  if ((error = dlerror()) != NULL) {
+    g_critical("failed to load 'pv_porcupine_delete' with '%s'.\n", error);
+    return false;
+  }
+
+  pv_porcupine_process_func = (decltype(pv_porcupine_process) *)dlsym(
+      porcupine_library, "pv_porcupine_process");
+  if ((error = dlerror()) != NULL) {
+    g_critical("failed to load 'pv_porcupine_process' with '%s'.\n", error);
+    return false;
+  }
+
+  auto pv_porcupine_frame_length_func =
+      (decltype(pv_porcupine_frame_length) *)dlsym(porcupine_library,
+                                                   "pv_porcupine_frame_length");
+  if ((error = dlerror()) != NULL) {
+    g_critical("failed to load 'pv_porcupine_frame_length' with '%s'.\n",
+               error);
+    return false;
+  }
+
+  m_frame_length = (size_t)pv_porcupine_frame_length_func();
+
+  char *model_path = asset_path(app, app->config->pv_model_path);
+  g_message("Loading picovoice model from %s", model_path);
+
+  // all keywords are evaluated by the same Porcupine instance
+  std::vector<char *> keyword_paths;
+  std::vector<float> sensitivities;
+  for (const auto &keyword : keywords) {
+    char *keyword_path = asset_path(app, keyword.path);
+    g_message("Loading wakeword from %s, sensitivity %.2f%s", keyword_path,
+              keyword.sensitivity,
+              keyword.action == WakeWordAction::STOP ? ", stop" : "");
+    keyword_paths.push_back(keyword_path);
+    sensitivities.push_back(keyword.sensitivity);
+  }
+
+  pv_status_t status = pv_porcupine_init_func(
+      model_path, (int32_t)keywords.size(), keyword_paths.data(),
+      sensitivities.data(), &porcupine);
+  g_free(model_path);
+  for (char *keyword_path : keyword_paths)
+    g_free(keyword_path);
+  if (status != PV_STATUS_SUCCESS) {
+    g_critical("'pv_porcupine_init' failed with '%s'\n",
+               pv_status_to_string_func(status));
+    porcupine = nullptr;
+    return false;
+  }
+
+  return true;
+}
+
+int genie::PorcupineEngine::process(const int16_t *samples) {
+  int32_t keyword_index = -1;
+  pv_status_t status =
+      pv_porcupine_process_func(porcupine, samples, &keyword_index);
+  if (status != PV_STATUS_SUCCESS) {
+    // Picovoice error!
+    g_critical("'pv_porcupine_process' failed with '%s'\n",
+               pv_status_to_string_func(status));
+    return -1;
+  }
+  return keyword_index;
+}
@@ -0,0 +1,52 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "wakeword.hpp"
+#include <pv_porcupine.h>
+
+namespace genie {
+
+/**
+ * @brief Picovoice Porcupine, loaded at runtime from
+ * `assets_dir/libpv_porcupine.so`.
+ */
+class PorcupineEngine : public WakeWordEngine {
+public:
+  PorcupineEngine();
+  ~PorcupineEngine();
+  bool init(App *app, const std::vector<WakeWordKeyword> &keywords);
+
+  const char *name() const { return "porcupine"; }
+  size_t sample_rate() const { return m_sample_rate; }
+  size_t frame_length() const { return m_frame_length; }
+  int process(const int16_t *samples);
+
+private:
+  size_t m_sample_rate;
+  size_t m_frame_length;
+
+  void *porcupine_library;
+  pv_porcupine_t *porcupine;
+  decltype(pv_porcupine_delete) *pv_porcupine_delete_func;
+  decltype(pv_porcupine_process) *pv_porcupine_process_func;
+  decltype(pv_status_to_string) *pv_status_to_string_func;
+};
+
+} // namespace genie
@@ -19,7 +19,9 @@
 #include "input.hpp"
 #include <string.h>
 
-genie::AudioInputPulseSimple::AudioInputPulseSimple(App *app) : app(app) {}
+genie::AudioInputPulseSimple::AudioInputPulseSimple(App *app,
+                                                    AudioFramePool *frame_pool)
+    : AudioInputDriver(frame_pool), app(app) {}
 
 genie::AudioInputPulseSimple::~AudioInputPulseSimple() {
   free(pcm);
@@ -47,6 +49,7 @@ bool genie::AudioInputPulseSimple::init(gchar *audio_input_device,
     g_error("failed to allocate memory for audio buffer\n");
     return false;
   }
+  this->max_frame_length = max_frame_length;
 
   return true;
 }
@@ -56,6 +59,12 @@ genie::AudioInputPulseSimple::read_frame(int32_t frame_length) {
   int read_frames = 0;
   int error;
 
+  if (frame_length > max_frame_length) {
+    g_error("cannot read %d frames into a buffer of %d", frame_length,
+            max_frame_length);
+    return AudioFrame(0);
+  }
+
   read_frames = frame_length * sizeof(int16_t);
   if (pa_simple_read(pulse_handle, pcm, read_frames, &error) < 0) {
     g_critical("pa_simple_read() failed with '%s'", pa_strerror(error));
@@ -68,7 +77,8 @@ genie::AudioInputPulseSimple::read_frame(int32_t frame_length) {
     return AudioFrame(0);
   }
 
-  AudioFrame frame(frame_length);
+  AudioFrame frame = frame_pool->acquire(frame_length);
   memcpy(frame.samples, pcm, frame_length * sizeof(int16_t));
+  frame.timestamp = g_get_monotonic_time();
   return frame;
 }
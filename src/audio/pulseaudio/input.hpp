@@ -29,7 +29,7 @@ namespace genie {
 class AudioInputPulseSimple : public AudioInputDriver {
 
 public:
-  AudioInputPulseSimple(App *app);
+  AudioInputPulseSimple(App *app, AudioFramePool *frame_pool);
   ~AudioInputPulseSimple();
   bool init(gchar *audio_input_device, int sample_rate, int channels,
             int max_frame_length);
@@ -41,6 +41,7 @@ private:
   pa_simple *pulse_handle = NULL;
 
   int16_t *pcm;
+  int32_t max_frame_length = 0;
 };
 
 } // namespace genie
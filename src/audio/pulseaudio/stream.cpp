@@ -0,0 +1,251 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stream.hpp"
+#include <algorithm>
+#include <string.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::AudioInputPulseStream"
+
+genie::AudioInputPulseStream::AudioInputPulseStream(App *app,
+                                                    AudioFramePool *frame_pool)
+    : AudioInputDriver(frame_pool), app(app) {}
+
+genie::AudioInputPulseStream::~AudioInputPulseStream() {
+  if (mainloop) {
+    pa_threaded_mainloop_lock(mainloop);
+    if (stream) {
+      pa_stream_disconnect(stream);
+      pa_stream_unref(stream);
+    }
+    if (context) {
+      pa_context_disconnect(context);
+      pa_context_unref(context);
+    }
+    pa_threaded_mainloop_unlock(mainloop);
+    pa_threaded_mainloop_stop(mainloop);
+    pa_threaded_mainloop_free(mainloop);
+  }
+}
+
+void genie::AudioInputPulseStream::on_context_state(pa_context *context,
+                                                    void *data) {
+  AudioInputPulseStream *self = static_cast<AudioInputPulseStream *>(data);
+  pa_threaded_mainloop_signal(self->mainloop, 0);
+}
+
+void genie::AudioInputPulseStream::on_stream_state(pa_stream *stream,
+                                                   void *data) {
+  AudioInputPulseStream *self = static_cast<AudioInputPulseStream *>(data);
+  pa_threaded_mainloop_signal(self->mainloop, 0);
+}
+
+void genie::AudioInputPulseStream::on_stream_read(pa_stream *stream,
+                                                  size_t nbytes, void *data) {
+  AudioInputPulseStream *self = static_cast<AudioInputPulseStream *>(data);
+  pa_threaded_mainloop_signal(self->mainloop, 0);
+}
+
+void genie::AudioInputPulseStream::on_stream_overflow(pa_stream *stream,
+                                                      void *data) {
+  AudioInputPulseStream *self = static_cast<AudioInputPulseStream *>(data);
+  self->overflows++;
+}
+
+// called with the mainloop lock held
+bool genie::AudioInputPulseStream::wait_context_ready() {
+  for (;;) {
+    pa_context_state_t state = pa_context_get_state(context);
+    if (state == PA_CONTEXT_READY)
+      return true;
+    if (state == PA_CONTEXT_FAILED || state == PA_CONTEXT_TERMINATED) {
+      g_critical("PulseAudio context failed: %s",
+                 pa_strerror(pa_context_errno(context)));
+      return false;
+    }
+    pa_threaded_mainloop_wait(mainloop);
+  }
+}
+
+// called with the mainloop lock held
+bool genie::AudioInputPulseStream::wait_stream_ready() {
+  for (;;) {
+    pa_stream_state_t state = pa_stream_get_state(stream);
+    if (state == PA_STREAM_READY)
+      return true;
+    if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED) {
+      g_critical("PulseAudio record stream failed: %s",
+                 pa_strerror(pa_context_errno(context)));
+      return false;
+    }
+    pa_threaded_mainloop_wait(mainloop);
+  }
+}
+
+bool genie::AudioInputPulseStream::init(gchar *audio_input_device,
+                                        int sample_rate, int channels,
+                                        int max_frame_length) {
+  sample_spec = pa_sample_spec{/* format */ PA_SAMPLE_S16LE,
+                               /* rate */ (uint32_t)sample_rate,
+                               /* channels */ (uint8_t)channels};
+
+  mainloop = pa_threaded_mainloop_new();
+  if (!mainloop) {
+    g_error("pa_threaded_mainloop_new() failed");
+    return false;
+  }
+
+  context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "Genie");
+  pa_context_set_state_callback(context, on_context_state, this);
+  if (pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+    g_error("pa_context_connect() failed: %s",
+            pa_strerror(pa_context_errno(context)));
+    return false;
+  }
+
+  pa_threaded_mainloop_lock(mainloop);
+  if (pa_threaded_mainloop_start(mainloop) < 0) {
+    pa_threaded_mainloop_unlock(mainloop);
+    g_error("pa_threaded_mainloop_start() failed");
+    return false;
+  }
+
+  if (!wait_context_ready()) {
+    pa_threaded_mainloop_unlock(mainloop);
+    g_error("failed to connect to PulseAudio");
+    return false;
+  }
+
+  stream = pa_stream_new(context, "record", &sample_spec, NULL);
+  pa_stream_set_state_callback(stream, on_stream_state, this);
+  pa_stream_set_read_callback(stream, on_stream_read, this);
+  pa_stream_set_overflow_callback(stream, on_stream_overflow, this);
+
+  pa_buffer_attr attr;
+  attr.maxlength = (uint32_t)-1;
+  attr.tlength = (uint32_t)-1;
+  attr.prebuf = (uint32_t)-1;
+  attr.minreq = (uint32_t)-1;
+  attr.fragsize = (uint32_t)pa_usec_to_bytes(
+      app->config->audio_pulse_fragsize_ms * PA_USEC_PER_MSEC, &sample_spec);
+
+  pa_stream_flags_t flags = (pa_stream_flags_t)(
+      PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE |
+      PA_STREAM_INTERPOLATE_TIMING);
+  if (pa_stream_connect_record(stream, audio_input_device, &attr, flags) < 0 ||
+      !wait_stream_ready()) {
+    pa_threaded_mainloop_unlock(mainloop);
+    g_error("pa_stream_connect_record() failed: %s",
+            pa_strerror(pa_context_errno(context)));
+    return false;
+  }
+
+  const pa_buffer_attr *actual = pa_stream_get_buffer_attr(stream);
+  g_message("PulseAudio capture: fragsize %u bytes (asked %u), maxlength %u",
+            actual->fragsize, attr.fragsize, actual->maxlength);
+  pa_threaded_mainloop_unlock(mainloop);
+
+  return true;
+}
+
+// called with the mainloop lock held
+void genie::AudioInputPulseStream::update_latency() {
+  pa_usec_t latency;
+  int negative;
+  if (pa_stream_get_latency(stream, &latency, &negative) < 0)
+    return;
+  if (negative)
+    latency = 0;
+
+  latency_last.store(latency, std::memory_order_relaxed);
+  latency_total.fetch_add(latency, std::memory_order_relaxed);
+  latency_samples++;
+  if (latency > latency_max.load(std::memory_order_relaxed))
+    latency_max.store(latency, std::memory_order_relaxed);
+}
+
+genie::AudioFrame
+genie::AudioInputPulseStream::read_frame(int32_t frame_length) {
+  AudioFrame frame = frame_pool->acquire(frame_length);
+  uint8_t *out = (uint8_t *)frame.samples;
+  size_t wanted = frame_length * sizeof(int16_t);
+  size_t filled = 0;
+
+  pa_threaded_mainloop_lock(mainloop);
+  while (filled < wanted) {
+    pa_stream_state_t state = pa_stream_get_state(stream);
+    if (state != PA_STREAM_READY) {
+      pa_threaded_mainloop_unlock(mainloop);
+      g_critical("PulseAudio record stream is not ready (state %d)",
+                 (int)state);
+      return AudioFrame(0);
+    }
+
+    const void *data;
+    size_t nbytes;
+    if (pa_stream_peek(stream, &data, &nbytes) < 0) {
+      pa_threaded_mainloop_unlock(mainloop);
+      g_critical("pa_stream_peek() failed: %s",
+                 pa_strerror(pa_context_errno(context)));
+      return AudioFrame(0);
+    }
+
+    if (nbytes == 0) {
+      // nothing buffered, wait for the read callback
+      pa_threaded_mainloop_wait(mainloop);
+      continue;
+    }
+
+    if (data == NULL) {
+      // a hole in the stream, there is nothing to copy
+      holes++;
+      pa_stream_drop(stream);
+      fragment_offset = 0;
+      continue;
+    }
+
+    // the rest of a fragment stays in the stream until it is dropped, so
+    // a frame can end in the middle of a fragment
+    size_t n = std::min(nbytes - fragment_offset, wanted - filled);
+    memcpy(out + filled, (const uint8_t *)data + fragment_offset, n);
+    filled += n;
+    fragment_offset += n;
+    if (fragment_offset == nbytes) {
+      pa_stream_drop(stream);
+      fragment_offset = 0;
+    }
+  }
+  update_latency();
+  pa_threaded_mainloop_unlock(mainloop);
+
+  // the source latency is how long the newest sample took to reach us
+  frame.timestamp = g_get_monotonic_time() -
+                    (gint64)latency_last.load(std::memory_order_relaxed);
+  return frame;
+}
+
+void genie::AudioInputPulseStream::print_stats() {
+  size_t n = latency_samples.load();
+  g_print("%12s: %.1f ms now, %.1f ms average, %.1f ms max source latency\n",
+          "Pulse", latency_last.load() / 1000.0,
+          n ? (double)latency_total.load() / n / 1000.0 : 0.0,
+          latency_max.load() / 1000.0);
+  g_print("%12s: %zu overflows, %zu holes\n", "", overflows.load(),
+          holes.load());
+}
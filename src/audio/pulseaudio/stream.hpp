@@ -0,0 +1,79 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../../app.hpp"
+#include "../audiodriver.hpp"
+
+#include <atomic>
+#include <pulse/pulseaudio.h>
+
+namespace genie {
+
+/**
+ * @brief PulseAudio capture driver built on the asynchronous `pa_stream` API.
+ *
+ * Unlike `AudioInputPulseSimple`, which leaves the buffer attributes to the
+ * server, this asks for a small `fragsize` with `PA_STREAM_ADJUST_LATENCY`,
+ * so the server configures the source for that latency and hands us data in
+ * fragments of about that size. The stream runs on a
+ * `pa_threaded_mainloop`; `read_frame()` waits on it for data and copies it
+ * out of the fragments in place.
+ */
+class AudioInputPulseStream : public AudioInputDriver {
+public:
+  AudioInputPulseStream(App *app, AudioFramePool *frame_pool);
+  ~AudioInputPulseStream();
+  bool init(gchar *audio_input_device, int sample_rate, int channels,
+            int max_frame_length);
+  AudioFrame read_frame(int32_t frame_length);
+  size_t xruns() { return overflows.load(); }
+  void print_stats();
+
+private:
+  // initialized once and never overwritten
+  App *const app;
+  pa_sample_spec sample_spec;
+
+  pa_threaded_mainloop *mainloop = nullptr;
+  pa_context *context = nullptr;
+  pa_stream *stream = nullptr;
+
+  // bytes of the current fragment already consumed; only accessed with the
+  // mainloop lock held
+  size_t fragment_offset = 0;
+
+  std::atomic<size_t> overflows{0};
+  std::atomic<size_t> holes{0};
+  std::atomic<pa_usec_t> latency_last{0};
+  std::atomic<pa_usec_t> latency_max{0};
+  std::atomic<pa_usec_t> latency_total{0};
+  std::atomic<size_t> latency_samples{0};
+
+  bool wait_context_ready();
+  bool wait_stream_ready();
+  void update_latency();
+
+  static void on_context_state(pa_context *context, void *data);
+  static void on_stream_state(pa_stream *stream, void *data);
+  static void on_stream_read(pa_stream *stream, size_t nbytes, void *data);
+  static void on_stream_overflow(pa_stream *stream, void *data);
+};
+
+} // namespace genie
@@ -0,0 +1,137 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "input.hpp"
+#include "../audiofile.hpp"
+#include <algorithm>
+#include <string.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::AudioInputReplay"
+
+genie::AudioInputReplay::AudioInputReplay(App *app,
+                                          AudioFramePool *frame_pool)
+    : AudioInputDriver(frame_pool), app(app), sample_rate(0) {}
+
+genie::AudioInputReplay::~AudioInputReplay() {}
+
+bool genie::AudioInputReplay::init(gchar *audio_input_device,
+                                   int sample_rate, int channels,
+                                   int max_frame_length) {
+  this->sample_rate = sample_rate;
+  if (channels != 1) {
+    g_critical("Replay input only produces mono audio, %d channels requested",
+               channels);
+    return false;
+  }
+
+  std::string path(audio_input_device);
+  std::vector<std::string> files;
+  if (!audiofile::list(path, files))
+    return false;
+  for (const auto &file : files) {
+    if (!audiofile::load(file, sample_rate, samples))
+      return false;
+  }
+  num_files = files.size();
+
+  if (samples.empty()) {
+    g_critical("Nothing to replay in %s", path.c_str());
+    return false;
+  }
+
+  g_message("Replaying %zu files from %s, %.1f s of audio, %s%s", num_files,
+            path.c_str(), (double)samples.size() / sample_rate,
+            app->config->audio_replay_realtime ? "in real time"
+                                               : "as fast as possible",
+            app->config->audio_replay_loop ? ", looping" : "");
+  return true;
+}
+
+genie::AudioFrame genie::AudioInputReplay::read_frame(int32_t frame_length) {
+  gint64 now = g_get_monotonic_time();
+  if (start_time.load() == 0)
+    start_time.store(now);
+
+  AudioFrame frame = frame_pool->acquire(frame_length);
+  size_t copied = 0;
+  while (copied < (size_t)frame_length && !finished.load()) {
+    if (position == samples.size()) {
+      if (app->config->audio_replay_loop) {
+        position = 0;
+        loops++;
+        continue;
+      }
+
+      gint64 elapsed = now - start_time.load();
+      end_time.store(now);
+      finished.store(true);
+      g_message("Replay finished: %.1f s of audio in %.1f s, %.1fx real time",
+                (double)samples.size() / sample_rate,
+                (double)elapsed / G_USEC_PER_SEC,
+                elapsed ? (double)samples.size() * G_USEC_PER_SEC /
+                              sample_rate / elapsed
+                        : 0.0);
+      break;
+    }
+
+    size_t n = std::min(frame_length - copied, samples.size() - position);
+    memcpy(frame.samples + copied, &samples[position], n * sizeof(int16_t));
+    position += n;
+    copied += n;
+  }
+  replayed += copied;
+  if (copied < (size_t)frame_length) {
+    memset(frame.samples + copied, 0,
+           (frame_length - copied) * sizeof(int16_t));
+  }
+
+  if (!app->config->audio_replay_realtime && !finished.load()) {
+    frame.timestamp = g_get_monotonic_time();
+    return frame;
+  }
+
+  // pace on an absolute schedule so that the time spent in the rest of the
+  // capture loop does not accumulate as drift
+  if (paced_since == 0)
+    paced_since = now;
+  paced_samples += frame_length;
+  gint64 due = paced_since + (gint64)(paced_samples * G_USEC_PER_SEC /
+                                      (size_t)sample_rate);
+  now = g_get_monotonic_time();
+  if (due > now)
+    g_usleep(due - now);
+
+  // the newest sample of the frame would have been captured at `due`
+  frame.timestamp = due;
+  return frame;
+}
+
+void genie::AudioInputReplay::print_stats() {
+  gint64 start = start_time.load();
+  gint64 end = finished.load() ? end_time.load() : g_get_monotonic_time();
+  size_t n = replayed.load();
+  double elapsed = start ? (double)(end - start) / G_USEC_PER_SEC : 0.0;
+  double audio = (double)n / sample_rate;
+
+  g_print("%12s: %zu files, %.1f s of audio, %zu loops%s\n", "Replay",
+          num_files, (double)samples.size() / sample_rate, loops.load(),
+          finished.load() ? ", finished" : "");
+  g_print("%12s: %.1f s replayed in %.1f s, %.1fx real time\n", "", audio,
+          elapsed, elapsed > 0 ? audio / elapsed : 0.0);
+}
@@ -0,0 +1,74 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../../app.hpp"
+#include "../audiodriver.hpp"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace genie {
+
+/**
+ * @brief Capture driver that plays back recordings instead of reading a sound
+ * card, for benchmarking the input pipeline and reproducing field recordings.
+ *
+ * `[audio] input` names a WAV file, a raw file (signed 16-bit little-endian
+ * mono samples) or a directory, in which case every `.wav`, `.raw` and `.pcm`
+ * file in it is played in name order. WAV files must be 16-bit PCM at the
+ * pipeline sample rate; stereo ones are downmixed.
+ *
+ * Everything is loaded up front so disk reads never show up in the
+ * measurements. Audio is either paced at the sample rate, with each frame
+ * stamped with the time it would have been captured, or handed out as fast
+ * as the capture thread asks for it. When the recordings run out the driver
+ * either starts over or keeps going with silence, paced in real time, so the
+ * rest of the pipeline can wind down.
+ */
+class AudioInputReplay : public AudioInputDriver {
+public:
+  AudioInputReplay(App *app, AudioFramePool *frame_pool);
+  ~AudioInputReplay();
+  bool init(gchar *audio_input_device, int sample_rate, int channels,
+            int max_frame_length);
+  AudioFrame read_frame(int32_t frame_length);
+  void print_stats();
+
+private:
+  // initialized once and never overwritten
+  App *const app;
+  int sample_rate;
+  std::vector<int16_t> samples;
+  size_t num_files = 0;
+
+  // only touched by the capture thread
+  size_t position = 0;
+  gint64 paced_since = 0;
+  size_t paced_samples = 0;
+
+  std::atomic<bool> finished{false};
+  std::atomic<gint64> start_time{0};
+  std::atomic<gint64> end_time{0};
+  std::atomic<size_t> replayed{0};
+  std::atomic<size_t> loops{0};
+};
+
+} // namespace genie
@@ -0,0 +1,42 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../audiodriver.hpp"
+
+namespace genie {
+
+/**
+ * @brief Volume "control" for the replay backend, which has no output: it
+ * only remembers the volume it was set to.
+ */
+class AudioVolumeDriverReplay : public AudioVolumeDriver {
+public:
+  AudioVolumeDriverReplay() : volume(100){};
+  virtual ~AudioVolumeDriverReplay(){};
+  virtual void set_volume(int volume) { this->volume = volume; }
+  virtual int get_volume() { return volume; }
+  virtual void duck() {}
+  virtual void unduck() {}
+
+private:
+  int volume;
+};
+
+} // namespace genie
@@ -0,0 +1,119 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "resampler.hpp"
+#include <memory>
+#include <vector>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::Resampler"
+
+genie::Resampler::Resampler(size_t in_rate, size_t out_rate, size_t channels)
+    : state(nullptr), in_rate(in_rate), out_rate(out_rate),
+      channels(channels), quality(0) {}
+
+genie::Resampler::~Resampler() {
+  if (state)
+    speex_resampler_destroy(state);
+}
+
+bool genie::Resampler::init(int quality) {
+  this->quality = quality;
+  int error = RESAMPLER_ERR_SUCCESS;
+  state = speex_resampler_init(channels, in_rate, out_rate, quality, &error);
+  if (!state || error != RESAMPLER_ERR_SUCCESS) {
+    g_critical("failed to create a resampler from %zu to %zu Hz: %s",
+               in_rate, out_rate, speex_resampler_strerror(error));
+    state = nullptr;
+    return false;
+  }
+  // start with real samples instead of the zeros the filter is primed with
+  speex_resampler_skip_zeros(state);
+  return true;
+}
+
+size_t genie::Resampler::process(size_t channel, const int16_t *in,
+                                 size_t length, int16_t *out,
+                                 size_t capacity) {
+  spx_uint32_t in_len = length;
+  spx_uint32_t out_len = capacity;
+
+  gint64 start = g_get_monotonic_time();
+  speex_resampler_process_int(state, channel, (const spx_int16_t *)in,
+                              &in_len, (spx_int16_t *)out, &out_len);
+  total_us += g_get_monotonic_time() - start;
+  calls++;
+  samples += out_len;
+
+  if (in_len != length) {
+    g_warning("resampler output full, dropped %zu samples",
+              length - (size_t)in_len);
+  }
+  return out_len;
+}
+
+size_t genie::Resampler::latency() const {
+  return speex_resampler_get_output_latency(state);
+}
+
+void genie::Resampler::print_stats() {
+  size_t n = calls.load();
+  double avg_us = n ? (double)total_us.load() / n : 0.0;
+  double audio_us = (double)samples.load() * G_USEC_PER_SEC / out_rate;
+  g_print("%12s: %zu -> %zu Hz, quality %d, %zu ms latency\n", "Resampler",
+          in_rate, out_rate, quality, latency() * 1000 / out_rate);
+  g_print("%12s: %zu calls, %.1f us avg, %.2f%% CPU\n", "", n, avg_us,
+          audio_us > 0 ? 100 * total_us.load() / audio_us : 0.0);
+}
+
+bool genie::Resampler::benchmark() {
+  static const size_t IN_RATES[] = {48000, 44100, 32000};
+  static const size_t OUT_RATE = 16000;
+  // one 10 ms capture period of output
+  static const size_t FRAME_MS = 10;
+  static const size_t ITERATIONS = 2000;
+
+  g_print("################ Resampler Benchmark #################\n");
+  for (size_t in_rate : IN_RATES) {
+    size_t frame = in_rate * FRAME_MS / 1000;
+    std::vector<int16_t> in(frame);
+    for (size_t i = 0; i < frame; i++) {
+      in[i] = (int16_t)g_random_int_range(-8192, 8192);
+    }
+
+    for (int quality = 0; quality <= MAX_QUALITY; quality++) {
+      Resampler resampler(in_rate, OUT_RATE, 1);
+      if (!resampler.init(quality))
+        return false;
+      std::vector<int16_t> out(resampler.max_output(frame));
+
+      gint64 start = g_get_monotonic_time();
+      for (size_t i = 0; i < ITERATIONS; i++) {
+        resampler.process(0, in.data(), frame, out.data(), out.size());
+      }
+      double us = (double)(g_get_monotonic_time() - start) / ITERATIONS;
+
+      g_print("%6zu -> %zu Hz, quality %2d: %7.2f us/frame, %5.2f%% CPU, "
+              "%2zu ms latency\n",
+              in_rate, OUT_RATE, quality, us, 100 * us / (FRAME_MS * 1000),
+              resampler.latency() * 1000 / OUT_RATE);
+    }
+  }
+  g_print("######################################################\n");
+  return true;
+}
@@ -0,0 +1,87 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <glib.h>
+#include <speex/speex_resampler.h>
+
+namespace genie {
+
+/**
+ * @brief SpeexDSP resampler for one or more independent channels of 16-bit
+ * audio, timed so its cost shows up in the stats.
+ */
+class Resampler {
+public:
+  static const int MAX_QUALITY = 10;
+
+  Resampler(size_t in_rate, size_t out_rate, size_t channels);
+  ~Resampler();
+  /**
+   * @param quality 0 (fastest) to `MAX_QUALITY` (best)
+   */
+  bool init(int quality);
+
+  /**
+   * @brief Resample all `length` samples at `in` on `channel`.
+   *
+   * `capacity` must leave room for `max_output(length)` samples, or the
+   * tail of the input is dropped.
+   *
+   * @return the number of samples written to `out`
+   */
+  size_t process(size_t channel, const int16_t *in, size_t length,
+                 int16_t *out, size_t capacity);
+
+  /**
+   * @brief The most samples `length` input samples can produce.
+   */
+  size_t max_output(size_t length) const {
+    return (length * out_rate + in_rate - 1) / in_rate + 1;
+  }
+
+  /**
+   * @brief Delay the filter adds, in output samples.
+   */
+  size_t latency() const;
+
+  void print_stats();
+
+  /**
+   * @brief Time the resampler at every quality on typical capture rates,
+   * see `--benchmark=resampler`.
+   */
+  static bool benchmark();
+
+private:
+  SpeexResamplerState *state;
+  const size_t in_rate;
+  const size_t out_rate;
+  const size_t channels;
+  int quality;
+
+  std::atomic<size_t> calls{0};
+  std::atomic<size_t> samples{0};
+  std::atomic<gint64> total_us{0};
+};
+
+} // namespace genie
@@ -0,0 +1,159 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "speexencoder.hpp"
+#include <algorithm>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::SpeexEncoder"
+
+static const SpeexMode *mode_for_rate(size_t sample_rate) {
+  switch (sample_rate) {
+    case 8000:
+      return speex_lib_get_mode(SPEEX_MODEID_NB);
+    case 16000:
+      return speex_lib_get_mode(SPEEX_MODEID_WB);
+    case 32000:
+      return speex_lib_get_mode(SPEEX_MODEID_UWB);
+    default:
+      g_critical("Speex cannot code audio at %zu Hz", sample_rate);
+      return nullptr;
+  }
+}
+
+genie::SpeexEncoder::SpeexEncoder(size_t sample_rate)
+    : state(nullptr), sample_rate(sample_rate), frame_length(0), frames(0) {
+  speex_bits_init(&bits);
+}
+
+genie::SpeexEncoder::~SpeexEncoder() {
+  if (state)
+    speex_encoder_destroy(state);
+  speex_bits_destroy(&bits);
+}
+
+bool genie::SpeexEncoder::init(int quality) {
+  const SpeexMode *mode = mode_for_rate(sample_rate);
+  if (!mode)
+    return false;
+
+  state = speex_encoder_init(mode);
+  if (!state) {
+    g_critical("failed to create the Speex encoder");
+    return false;
+  }
+  speex_encoder_ctl(state, SPEEX_SET_QUALITY, &quality);
+  spx_int32_t frame_size = 0;
+  speex_encoder_ctl(state, SPEEX_GET_FRAME_SIZE, &frame_size);
+  frame_length = frame_size;
+  pending.reserve(frame_length);
+  return true;
+}
+
+int genie::SpeexEncoder::bitrate() const {
+  spx_int32_t rate = 0;
+  speex_encoder_ctl(state, SPEEX_GET_BITRATE, &rate);
+  return rate;
+}
+
+void genie::SpeexEncoder::encode_pending() {
+  speex_encode_int(state, pending.data(), &bits);
+  pending.clear();
+  frames++;
+}
+
+void genie::SpeexEncoder::encode(const int16_t *samples, size_t length) {
+  while (length > 0) {
+    size_t n = std::min(frame_length - pending.size(), length);
+    pending.insert(pending.end(), samples, samples + n);
+    samples += n;
+    length -= n;
+    if (pending.size() == frame_length)
+      encode_pending();
+  }
+}
+
+std::vector<int16_t> genie::SpeexEncoder::take_pending() {
+  std::vector<int16_t> samples;
+  samples.swap(pending);
+  pending.reserve(frame_length);
+  return samples;
+}
+
+void genie::SpeexEncoder::finish() {
+  if (pending.empty())
+    return;
+  pending.resize(frame_length, 0);
+  encode_pending();
+}
+
+const std::vector<char> &genie::SpeexEncoder::take() {
+  out.clear();
+  if (frames == 0)
+    return out;
+  speex_bits_insert_terminator(&bits);
+  out.resize(speex_bits_nbytes(&bits));
+  speex_bits_write(&bits, out.data(), (int)out.size());
+  speex_bits_reset(&bits);
+  frames = 0;
+  return out;
+}
+
+genie::SpeexDecoder::SpeexDecoder(size_t sample_rate)
+    : state(nullptr), sample_rate(sample_rate), frame_length(0) {
+  speex_bits_init(&bits);
+}
+
+genie::SpeexDecoder::~SpeexDecoder() {
+  if (state)
+    speex_decoder_destroy(state);
+  speex_bits_destroy(&bits);
+}
+
+bool genie::SpeexDecoder::init() {
+  const SpeexMode *mode = mode_for_rate(sample_rate);
+  if (!mode)
+    return false;
+
+  state = speex_decoder_init(mode);
+  if (!state) {
+    g_critical("failed to create the Speex decoder");
+    return false;
+  }
+  spx_int32_t frame_size = 0;
+  speex_decoder_ctl(state, SPEEX_GET_FRAME_SIZE, &frame_size);
+  frame_length = frame_size;
+  return true;
+}
+
+size_t genie::SpeexDecoder::decode(const std::vector<char> &data,
+                                   std::vector<int16_t> &out) {
+  speex_bits_read_from(&bits, data.data(), (int)data.size());
+  size_t decoded = 0;
+  for (;;) {
+    size_t end = out.size();
+    out.resize(end + frame_length);
+    // -1 at the terminator, -2 if the stream is corrupt
+    if (speex_decode_int(state, &bits, out.data() + end) != 0) {
+      out.resize(end);
+      break;
+    }
+    decoded += frame_length;
+  }
+  return decoded;
+}
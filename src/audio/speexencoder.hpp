@@ -0,0 +1,120 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glib.h>
+#include <speex/speex.h>
+#include <vector>
+
+namespace genie {
+
+/**
+ * @brief Speex encoder for the audio streamed to the STT service.
+ *
+ * Audio comes in frames of any length and is encoded in the codec's own
+ * frames (20 ms); samples that do not fill a whole frame wait for the next
+ * call. Encoded frames accumulate in one Speex bitstream until `take()`
+ * ends it with a terminator, so any number of them can be sent as a single
+ * message.
+ */
+class SpeexEncoder {
+public:
+  SpeexEncoder(size_t sample_rate);
+  ~SpeexEncoder();
+  /**
+   * @param quality 0 (smallest) to 10 (best)
+   */
+  bool init(int quality);
+
+  /**
+   * @brief Encode `length` more samples into the current bitstream.
+   */
+  void encode(const int16_t *samples, size_t length);
+
+  /**
+   * @brief Encode the samples still waiting, padded with silence to a whole
+   * frame, at the end of the stream.
+   */
+  void finish();
+
+  /**
+   * @brief Take the samples still waiting for a whole frame, instead of
+   * padding them with `finish()`.
+   */
+  std::vector<int16_t> take_pending();
+
+  /**
+   * @brief Size of the current bitstream, in bytes.
+   */
+  size_t size() { return speex_bits_nbytes(&bits); }
+
+  /**
+   * @brief End the current bitstream and start a new one.
+   *
+   * @return the encoded frames, empty if none were completed since the last
+   * call; valid until the next call
+   */
+  const std::vector<char> &take();
+
+  size_t frame_size() const { return frame_length; }
+  /**
+   * @brief Bits per second the encoder produces at its quality.
+   */
+  int bitrate() const;
+
+private:
+  void encode_pending();
+
+  void *state;
+  SpeexBits bits;
+  const size_t sample_rate;
+  size_t frame_length;
+
+  std::vector<int16_t> pending;
+  size_t frames;
+  std::vector<char> out;
+};
+
+/**
+ * @brief Decoder for the bitstreams of a `SpeexEncoder` at the same rate.
+ */
+class SpeexDecoder {
+public:
+  SpeexDecoder(size_t sample_rate);
+  ~SpeexDecoder();
+  bool init();
+
+  /**
+   * @brief Decode every frame of the bitstream `data` and append the samples
+   * to `out`.
+   *
+   * @return the number of samples appended
+   */
+  size_t decode(const std::vector<char> &data, std::vector<int16_t> &out);
+
+private:
+  void *state;
+  SpeexBits bits;
+  const size_t sample_rate;
+  size_t frame_length;
+};
+
+} // namespace genie
@@ -0,0 +1,91 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "speexprocessor.hpp"
+#include <string.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::SpeexProcessor"
+
+genie::SpeexEchoCanceller::SpeexEchoCanceller(int sample_rate, size_t period,
+                                              size_t tail_ms)
+    : period(period), output(new int16_t[period]) {
+  echo_state = speex_echo_state_init_mc(period, sample_rate * tail_ms / 1000,
+                                        1, 1);
+  speex_echo_ctl(echo_state, SPEEX_ECHO_SET_SAMPLING_RATE, &sample_rate);
+
+  g_print("Initialized speex echo-cancellation\n");
+}
+
+genie::SpeexEchoCanceller::~SpeexEchoCanceller() {
+  speex_echo_state_destroy(echo_state);
+}
+
+bool genie::SpeexEchoCanceller::process(int16_t *samples,
+                                        const int16_t *reference,
+                                        size_t length) {
+  if (length != period)
+    return false;
+  if (!reference)
+    return true;
+
+  speex_echo_cancellation(echo_state, (const spx_int16_t *)samples,
+                          (const spx_int16_t *)reference,
+                          (spx_int16_t *)output.get());
+  memcpy(samples, output.get(), length * sizeof(int16_t));
+  return true;
+}
+
+genie::SpeexPreprocessor::SpeexPreprocessor(int sample_rate, size_t period,
+                                            SpeexEchoState *echo_state)
+    : period(period) {
+  spx_int32_t tmp;
+
+  pp_state = speex_preprocess_state_init(period, sample_rate);
+
+  // Not supported with the prebuilt speex
+  // tmp = true;
+  // speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_AGC, &tmp);
+
+  tmp = true;
+  speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_DENOISE, &tmp);
+
+  tmp = true;
+  speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_DEREVERB, &tmp);
+
+  if (echo_state) {
+    tmp = -1;
+    speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_ECHO_SUPPRESS, &tmp);
+    speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_ECHO_STATE,
+                         echo_state);
+  }
+}
+
+genie::SpeexPreprocessor::~SpeexPreprocessor() {
+  speex_preprocess_state_destroy(pp_state);
+}
+
+bool genie::SpeexPreprocessor::process(int16_t *samples,
+                                       const int16_t *reference,
+                                       size_t length) {
+  if (length != period)
+    return false;
+
+  speex_preprocess_run(pp_state, (spx_int16_t *)samples);
+  return true;
+}
@@ -0,0 +1,65 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "audioprocessor.hpp"
+
+#include <speex/speex_echo.h>
+#include <speex/speex_preprocess.h>
+
+namespace genie {
+
+/**
+ * @brief Speex acoustic echo canceller, removes the playback reference from
+ * the microphone signal.
+ */
+class SpeexEchoCanceller : public AudioProcessor {
+public:
+  SpeexEchoCanceller(int sample_rate, size_t period, size_t tail_ms);
+  ~SpeexEchoCanceller();
+  const char *name() const { return "speex_aec"; }
+  bool process(int16_t *samples, const int16_t *reference, size_t length);
+
+  SpeexEchoState *state() const { return echo_state; }
+
+private:
+  SpeexEchoState *echo_state;
+  const size_t period;
+  // the canceller cannot work in place
+  std::unique_ptr<int16_t[]> output;
+};
+
+/**
+ * @brief Speex preprocessor: noise suppression and dereverberation, plus
+ * residual echo suppression when it runs after a `SpeexEchoCanceller`.
+ */
+class SpeexPreprocessor : public AudioProcessor {
+public:
+  SpeexPreprocessor(int sample_rate, size_t period,
+                    SpeexEchoState *echo_state);
+  ~SpeexPreprocessor();
+  const char *name() const { return "speex_denoise"; }
+  bool process(int16_t *samples, const int16_t *reference, size_t length);
+
+private:
+  SpeexPreprocessState *pp_state;
+  const size_t period;
+};
+
+} // namespace genie
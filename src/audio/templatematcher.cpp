@@ -0,0 +1,283 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "templatematcher.hpp"
+#include "audiofile.hpp"
+#include <algorithm>
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::TemplateMatcher"
+
+static const float INFINITE_COST = 1e30f;
+
+// frames this far below the loudest frame of a recording are trimmed from
+// its ends
+static const float TRIM_DB = 30;
+// templates shorter than this many frames are rejected
+static const size_t MIN_TEMPLATE_FRAMES = 10;
+
+// matching only runs while the level is this far above the noise floor
+static const float ACTIVE_DB = 6;
+static const float MIN_ACTIVE_DBFS = -70;
+static const double FLOOR_FALL = 0.25;
+static const double FLOOR_RISE = 0.01;
+
+// typical distance between two recordings of the same keyword, used when
+// there is only one template to calibrate against
+static const float DEFAULT_DISTANCE = 4.5f;
+
+// after a detection, nothing else is detected for this many frames
+static const size_t REFRACTORY_FRAMES = 50;
+
+genie::TemplateMatcher::TemplateMatcher(size_t sample_rate)
+    : m_sample_rate(sample_rate), mfcc(sample_rate),
+      history(mfcc.window(), 0), features(Mfcc::NUM_COEFFICIENTS),
+      floor(FLOOR_FALL, FLOOR_RISE), active_frames(0),
+      hangover(0), refractory(0) {}
+
+static float distance(const float *a, const float *b) {
+  float sum = 0;
+  for (size_t i = 0; i < genie::Mfcc::NUM_COEFFICIENTS; i++) {
+    float d = a[i] - b[i];
+    sum += d * d;
+  }
+  return sqrtf(sum);
+}
+
+bool genie::TemplateMatcher::load_template(const std::string &path,
+                                           int keyword) {
+  std::vector<int16_t> samples;
+  if (!audiofile::load(path, m_sample_rate, samples))
+    return false;
+
+  std::vector<float> all_features, levels;
+  mfcc.compute_all(samples, all_features, levels);
+  if (levels.empty()) {
+    g_critical("%s: too short for a wake-word template", path.c_str());
+    return false;
+  }
+
+  // trim the silence around the keyword
+  float loudest = *std::max_element(levels.begin(), levels.end());
+  size_t first = 0, last = levels.size() - 1;
+  while (first < last && levels[first] < loudest - TRIM_DB)
+    first++;
+  while (last > first && levels[last] < loudest - TRIM_DB)
+    last--;
+  size_t frames = last - first + 1;
+  if (frames < MIN_TEMPLATE_FRAMES) {
+    g_critical("%s: only %zu frames of audio, too short for a wake-word "
+               "template",
+               path.c_str(), frames);
+    return false;
+  }
+
+  Template t;
+  t.keyword = keyword;
+  t.frames = frames;
+  t.features.assign(all_features.begin() + first * Mfcc::NUM_COEFFICIENTS,
+                    all_features.begin() +
+                        (last + 1) * Mfcc::NUM_COEFFICIENTS);
+  t.threshold = 0;
+  t.cost.assign(frames, INFINITE_COST);
+  t.span.assign(frames, 0);
+  t.next_cost = t.cost;
+  t.next_span = t.span;
+  templates.push_back(std::move(t));
+
+  g_debug("Loaded wake-word template %s, %zu frames", path.c_str(), frames);
+  return true;
+}
+
+bool genie::TemplateMatcher::init(
+    App *app, const std::vector<WakeWordKeyword> &keywords) {
+  for (size_t k = 0; k < keywords.size(); k++) {
+    char *path = keywords[k].path[0] == '/'
+                     ? g_strdup(keywords[k].path)
+                     : g_build_filename(app->config->asset_dir,
+                                        keywords[k].path, nullptr);
+    std::vector<std::string> files;
+    bool ok = audiofile::list(path, files);
+    for (size_t i = 0; ok && i < files.size(); i++) {
+      ok = load_template(files[i], (int)k);
+    }
+    if (ok && files.empty()) {
+      g_critical("No wake-word templates in %s", path);
+      ok = false;
+    }
+    g_free(path);
+    if (!ok)
+      return false;
+  }
+
+  // calibrate each template against the other recordings of its keyword
+  for (auto &t : templates) {
+    float total = 0;
+    size_t count = 0;
+    for (const auto &other : templates) {
+      if (&other != &t && other.keyword == t.keyword) {
+        float d = align(t, other);
+        if (d < INFINITE_COST) {
+          total += d;
+          count++;
+        }
+      }
+    }
+    float sensitivity = keywords[t.keyword].sensitivity;
+    float typical = count ? total / count : DEFAULT_DISTANCE;
+    t.threshold = typical * (0.8f + 0.8f * sensitivity);
+    hangover = std::max(hangover, t.frames);
+  }
+
+  g_message("Loaded %zu wake-word templates for %zu keywords",
+            templates.size(), keywords.size());
+  return true;
+}
+
+/**
+ * @brief Average distance along the best alignment of two whole templates,
+ * with the same steps as `match()`.
+ */
+float genie::TemplateMatcher::align(const Template &a, const Template &b) {
+  std::vector<float> cost(b.frames, INFINITE_COST), next(b.frames);
+
+  for (size_t i = 0; i < a.frames; i++) {
+    const float *x = &a.features[i * Mfcc::NUM_COEFFICIENTS];
+    for (size_t j = 0; j < b.frames; j++) {
+      float d = distance(x, &b.features[j * Mfcc::NUM_COEFFICIENTS]);
+      if (i == 0) {
+        next[j] = j == 0 ? d : INFINITE_COST;
+        continue;
+      }
+      float best = cost[j];
+      if (j >= 1)
+        best = std::min(best, cost[j - 1]);
+      if (j >= 2)
+        best = std::min(best, cost[j - 2]);
+      next[j] = best < INFINITE_COST ? best + d : INFINITE_COST;
+    }
+    std::swap(cost, next);
+  }
+
+  return cost[b.frames - 1] < INFINITE_COST
+             ? cost[b.frames - 1] / a.frames
+             : INFINITE_COST;
+}
+
+void genie::TemplateMatcher::reset() {
+  for (auto &t : templates) {
+    std::fill(t.cost.begin(), t.cost.end(), INFINITE_COST);
+    std::fill(t.span.begin(), t.span.end(), 0);
+  }
+}
+
+/**
+ * @brief Advance the alignment of `t` by the current input frame.
+ *
+ * Paths can start at any input frame (subsequence matching). Every input
+ * frame moves a path by zero, one or two template frames, so the input may
+ * be between half and twice as long as the template, and no part of the
+ * template can be skipped over.
+ *
+ * @return the average distance of the best path that has reached the end of
+ * the template, or `INFINITE_COST`
+ */
+float genie::TemplateMatcher::match(Template &t) {
+  for (size_t j = 0; j < t.frames; j++) {
+    float d = distance(features.data(),
+                       &t.features[j * Mfcc::NUM_COEFFICIENTS]);
+
+    // a path can start on the first frame at any time
+    float best = j == 0 ? d : INFINITE_COST;
+    uint16_t best_span = 1;
+    auto consider = [&](size_t from) {
+      float c = t.cost[from];
+      uint16_t span = t.span[from] + 1;
+      if (c < INFINITE_COST && (c + d) / span < best / best_span) {
+        best = c + d;
+        best_span = span;
+      }
+    };
+    consider(j);
+    if (j >= 1)
+      consider(j - 1);
+    if (j >= 2)
+      consider(j - 2);
+
+    if (best_span > 2 * t.frames) {
+      // stretched too far, give up on this path
+      best = INFINITE_COST;
+      best_span = 0;
+    }
+    t.next_cost[j] = best;
+    t.next_span[j] = best_span;
+  }
+  std::swap(t.cost, t.next_cost);
+  std::swap(t.span, t.next_span);
+
+  size_t end = t.frames - 1;
+  if (t.cost[end] >= INFINITE_COST)
+    return INFINITE_COST;
+  return t.cost[end] / t.span[end];
+}
+
+int genie::TemplateMatcher::process(const int16_t *samples) {
+  size_t hop = mfcc.hop();
+  memmove(history.data(), history.data() + hop,
+          (history.size() - hop) * sizeof(int16_t));
+  memcpy(history.data() + history.size() - hop, samples,
+         hop * sizeof(int16_t));
+
+  double level = level_dbfs(history.data(), history.size());
+  if (floor.above(level, ACTIVE_DB) && level > MIN_ACTIVE_DBFS) {
+    active_frames = hangover;
+  } else {
+    floor.update(level);
+    if (active_frames > 0 && --active_frames == 0) {
+      // back to silence, start matching afresh next time
+      reset();
+    }
+  }
+  if (active_frames == 0)
+    return -1;
+
+  mfcc.compute(history.data(), features.data());
+
+  int detected = -1;
+  float best_ratio = 1;
+  for (auto &t : templates) {
+    float score = match(t);
+    if (score < t.threshold && score / t.threshold < best_ratio) {
+      best_ratio = score / t.threshold;
+      detected = t.keyword;
+    }
+  }
+
+  if (refractory > 0) {
+    refractory--;
+    return -1;
+  }
+  if (detected >= 0) {
+    reset();
+    refractory = REFRACTORY_FRAMES;
+  }
+  return detected;
+}
@@ -0,0 +1,87 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "mfcc.hpp"
+#include "noisefloor.hpp"
+#include "wakeword.hpp"
+#include <vector>
+
+namespace genie {
+
+/**
+ * @brief Built-in wake-word engine that matches the input against recorded
+ * examples of each keyword, with dynamic time warping over MFCC features.
+ *
+ * The path of each keyword is a recording, or a directory of recordings, of
+ * the keyword alone (see `audiofile::load()`); every recording is one
+ * template. With several templates per keyword the detection threshold is
+ * calibrated from how far apart they are, so 3 to 5 recordings by different
+ * speakers work much better than one.
+ *
+ * Features are only computed, and templates only matched, while the level is
+ * above the tracked noise floor, which keeps it nearly free on silence. It
+ * needs no model files and little CPU, but it is speaker and
+ * microphone dependent in a way Porcupine is not.
+ */
+class TemplateMatcher : public WakeWordEngine {
+public:
+  TemplateMatcher(size_t sample_rate);
+  bool init(App *app, const std::vector<WakeWordKeyword> &keywords);
+
+  const char *name() const { return "template"; }
+  size_t sample_rate() const { return m_sample_rate; }
+  size_t frame_length() const { return mfcc.hop(); }
+  int process(const int16_t *samples);
+
+private:
+  struct Template {
+    int keyword;
+    size_t frames;
+    std::vector<float> features;
+    float threshold;
+
+    // subsequence DTW state for the path ending at each template frame:
+    // accumulated distance and number of input frames
+    std::vector<float> cost;
+    std::vector<uint16_t> span;
+    std::vector<float> next_cost;
+    std::vector<uint16_t> next_span;
+  };
+
+  const size_t m_sample_rate;
+  Mfcc mfcc;
+  std::vector<Template> templates;
+
+  // the last `mfcc.window()` samples
+  std::vector<int16_t> history;
+  std::vector<float> features;
+
+  NoiseFloor floor;
+  size_t active_frames;
+  size_t hangover;
+  size_t refractory;
+
+  bool load_template(const std::string &path, int keyword);
+  void reset();
+  float match(Template &t);
+  static float align(const Template &a, const Template &b);
+};
+
+} // namespace genie
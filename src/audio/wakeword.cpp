@@ -16,145 +16,217 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <dlfcn.h>
+#include <algorithm>
 #include <glib.h>
 #include <signal.h>
 #include <stdio.h>
+#include <vector>
 
+#include "audiofile.hpp"
+#include "porcupine.hpp"
+#include "templatematcher.hpp"
 #include "wakeword.hpp"
 
-genie::WakeWord::WakeWord(App *app) : app(app) {
-  porcupine = nullptr;
-  porcupine_library = nullptr;
-  pv_porcupine_delete_func = nullptr;
-  pv_porcupine_process_func = nullptr;
-  pv_status_to_string_func = nullptr;
-
-  char *library_path =
-      g_build_filename(app->config->asset_dir, "libpv_porcupine.so", nullptr);
-
-  char *model_path;
-  if (app->config->pv_model_path[0] == '/')
-    model_path = g_strdup(app->config->pv_model_path);
-  else
-    model_path = g_build_filename(app->config->asset_dir,
-                                  app->config->pv_model_path, nullptr);
-  g_message("Loading picovoice model from %s", model_path);
-
-  char *keyword_path;
-  if (app->config->pv_keyword_path[0] == '/')
-    keyword_path = g_strdup(app->config->pv_keyword_path);
-  else
-    keyword_path = g_build_filename(app->config->asset_dir,
-                                    app->config->pv_keyword_path, nullptr);
-  g_message("Loading wakeword from %s", keyword_path);
-
-  const float sensitivity = app->config->pv_sensitivity;
-
-  porcupine_library = dlopen(library_path, RTLD_NOW);
-  if (!porcupine_library) {
-    g_error("failed to open library %s: %s", library_path, dlerror());
-    return;
-  }
-  g_free(library_path);
-
-  char *error = NULL;
+// the built-in engine runs at the same rate as Porcupine, so switching
+// engines does not change the rest of the capture pipeline
+static const size_t TEMPLATE_SAMPLE_RATE = 16000;
 
-  pv_status_to_string_func = (const char *(*)(pv_status_t))dlsym(
-      porcupine_library, "pv_status_to_string");
-  if ((error = dlerror()) != NULL) {
-    g_error("failed to load 'pv_status_to_string' with '%s'.\n", error);
+genie::WakeWord::WakeWord(App *app) : app(app) {
+  engine = create_engine(app, app->config->pv_engine, app->config->pv_keywords);
+  if (!engine) {
+    g_error("failed to initialize the wakeword engine");
     return;
   }
+  sample_rate = engine->sample_rate();
+  frame_length = engine->frame_length();
 
-  auto pv_sample_rate_func =
-      (decltype(pv_sample_rate) *)dlsym(porcupine_library, "pv_sample_rate");
-  if ((error = dlerror()) != NULL) {
-    g_error("failed to load 'pv_sample_rate' with '%s'.\n", error);
-    return;
+  size_t num_keywords = app->config->pv_keywords.size();
+  detections.reset(new std::atomic<size_t>[num_keywords]);
+  for (size_t i = 0; i < num_keywords; i++) {
+    detections[i].store(0);
   }
 
-  int32_t sample_rate_signed = pv_sample_rate_func();
-  g_assert(sample_rate_signed > 0);
-  sample_rate = (size_t)sample_rate_signed;
+  g_print("Initialized %s wakeword engine, frame length %zd, sample rate "
+          "%zd\n",
+          engine->name(), frame_length, sample_rate);
+}
 
-  auto pv_porcupine_init_func = (decltype(pv_porcupine_init) *)dlsym(
-      porcupine_library, "pv_porcupine_init");
-  if ((error = dlerror()) != NULL) {
-    g_error("failed to load 'pv_porcupine_init' with '%s'.\n", error);
-    return;
+std::unique_ptr<genie::WakeWordEngine>
+genie::WakeWord::create_engine(App *app, WakeWordEngineType type,
+                               const std::vector<WakeWordKeyword> &keywords) {
+  std::unique_ptr<WakeWordEngine> engine;
+  switch (type) {
+    case WakeWordEngineType::PORCUPINE:
+      engine = std::make_unique<PorcupineEngine>();
+      break;
+    case WakeWordEngineType::TEMPLATE:
+      engine = std::make_unique<TemplateMatcher>(TEMPLATE_SAMPLE_RATE);
+      break;
   }
+  if (!engine->init(app, keywords))
+    return nullptr;
+  return engine;
+}
 
-  pv_porcupine_delete_func = (decltype(pv_porcupine_delete) *)dlsym(
-      porcupine_library, "pv_porcupine_delete");
-  if ((error = dlerror()) != NULL) {
-    g_error("failed to load 'pv_porcupine_delete' with '%s'.\n", error);
-    return;
+int genie::WakeWord::process(const int16_t *samples, size_t length) {
+  if (length == 0 || length != frame_length) {
+    return -1;
   }
 
-  pv_porcupine_process_func = (decltype(pv_porcupine_process) *)dlsym(
-      porcupine_library, "pv_porcupine_process");
-  if ((error = dlerror()) != NULL) {
-    g_error("failed to load 'pv_porcupine_process' with '%s'.\n", error);
-    return;
-  }
+  // Check the frame for the wake-word
+  gint64 start = g_get_monotonic_time();
+  int keyword_index = engine->process(samples);
+  total_us += g_get_monotonic_time() - start;
+  frames++;
 
-  auto pv_porcupine_frame_length_func =
-      (decltype(pv_porcupine_frame_length) *)dlsym(porcupine_library,
-                                                   "pv_porcupine_frame_length");
-  if ((error = dlerror()) != NULL) {
-    g_error("failed to load 'pv_porcupine_frame_length' with '%s'.\n", error);
-    return;
+  if (keyword_index < 0) {
+    // wake-word not found
+    return -1;
   }
 
-  pv_frame_length = pv_porcupine_frame_length_func();
+  g_message("Detected keyword %d!\n", keyword_index);
+  detections[keyword_index]++;
+  return keyword_index;
+}
 
-  porcupine = NULL;
-  pv_status_t status = pv_porcupine_init_func(model_path, 1, &keyword_path,
-                                              &sensitivity, &porcupine);
-  if (status != PV_STATUS_SUCCESS) {
-    g_error("'pv_porcupine_init' failed with '%s'\n",
-            pv_status_to_string_func(status));
-    return;
+void genie::WakeWord::print_stats() {
+  // share of one core the engine needs to keep up with the audio
+  double frame_us = (double)frame_length * G_USEC_PER_SEC / sample_rate;
+  g_print("%12s: %s, %zu frames, %.0f us avg, %.1f%% CPU while running\n",
+          "Wakeword", engine->name(), frames.load(), average_us(),
+          100 * average_us() / frame_us);
+  for (size_t i = 0; i < app->config->pv_keywords.size(); i++) {
+    g_print("%12s: %s, %zu detections\n", i == 0 ? "Keywords" : "",
+            app->config->pv_keywords[i].path, detections[i].load());
   }
-  g_free(model_path);
-  g_free(keyword_path);
+}
 
-  g_print("Initialized wakeword engine, frame length %d, sample rate %zd\n",
-          pv_frame_length, sample_rate);
+// low-level noise rather than digital silence, like a real microphone
+static void append_silence(std::vector<int16_t> &stream, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    stream.push_back((int16_t)g_random_int_range(-16, 17));
+  }
 }
 
-genie::WakeWord::~WakeWord() {
-  if (porcupine) {
-    pv_porcupine_delete_func(porcupine);
+/**
+ * @brief Run one engine over the recordings and print its numbers.
+ *
+ * Each recording is surrounded by a second of silence. A detection counts
+ * for a recording if it comes before the end of the silence that follows
+ * it; its latency is measured from the end of the recording. Any other
+ * detection is a false positive.
+ */
+static bool benchmark_engine(genie::WakeWordEngine *engine,
+                             const std::vector<std::string> &files) {
+  size_t rate = engine->sample_rate();
+  size_t frame_length = engine->frame_length();
+
+  std::vector<int16_t> stream;
+  std::vector<size_t> starts, ends;
+  for (const auto &file : files) {
+    append_silence(stream, rate);
+    starts.push_back(stream.size());
+    if (!genie::audiofile::load(file, (int)rate, stream))
+      return false;
+    ends.push_back(stream.size());
   }
-  if (porcupine_library) {
-    dlclose(porcupine_library);
+  append_silence(stream, rate);
+
+  std::vector<bool> detected(files.size(), false);
+  size_t frames = 0, false_positives = 0, hits = 0;
+  gint64 total_us = 0, max_us = 0;
+  double total_latency_ms = 0, max_latency_ms = 0;
+  for (size_t pos = 0; pos + frame_length <= stream.size();
+       pos += frame_length) {
+    gint64 start = g_get_monotonic_time();
+    int keyword = engine->process(&stream[pos]);
+    gint64 elapsed = g_get_monotonic_time() - start;
+    total_us += elapsed;
+    max_us = std::max(max_us, elapsed);
+    frames++;
+    if (keyword < 0)
+      continue;
+
+    // the detection is known once the frame has been processed
+    size_t at = pos + frame_length;
+    size_t i = 0;
+    while (i < files.size() && !(at >= starts[i] && at < ends[i] + rate))
+      i++;
+    if (i == files.size() || detected[i]) {
+      false_positives++;
+      continue;
+    }
+    detected[i] = true;
+    hits++;
+    double latency_ms = ((double)at - (double)ends[i]) * 1000 / rate;
+    total_latency_ms += latency_ms;
+    max_latency_ms =
+        hits == 1 ? latency_ms : std::max(max_latency_ms, latency_ms);
   }
-}
 
-int genie::WakeWord::process(AudioFrame *frame) {
-  if (frame->length == 0 || frame->length != (uint32_t)pv_frame_length) {
-    return false;
+  double avg_us = frames ? (double)total_us / frames : 0;
+  double frame_us = (double)frame_length * G_USEC_PER_SEC / rate;
+  g_print("%12s: %zu frames, %.1f us avg, %" G_GINT64_FORMAT
+          " us max, %.2f%% CPU\n",
+          engine->name(), frames, avg_us, max_us, 100 * avg_us / frame_us);
+  g_print("%12s: %zu/%zu detected, %zu false positives\n", "", hits,
+          files.size(), false_positives);
+  if (hits > 0) {
+    g_print("%12s: %.0f ms avg, %.0f ms max after the end of the keyword\n",
+            "Latency", total_latency_ms / hits, max_latency_ms);
   }
+  return true;
+}
 
-  // Check the frame for the wake-word
-  int32_t keyword_index = -1;
-  pv_status_t status =
-      pv_porcupine_process_func(porcupine, frame->samples, &keyword_index);
-
-  if (status != PV_STATUS_SUCCESS) {
-    // Picovoice error!
-    g_critical("'pv_porcupine_process' failed with '%s'\n",
-               pv_status_to_string_func(status));
+/**
+ * @brief Compare the wake-word engines on recordings of the keyword.
+ *
+ * The configured engine runs with the configured keywords. Porcupine also
+ * runs with the single `keyword` when it is not the configured engine; the
+ * template engine needs its own recordings, so it only runs when selected.
+ */
+bool genie::WakeWord::benchmark(App *app, const char *input) {
+  if (!input) {
+    g_printerr("The wakeword benchmark needs --benchmark-input, a recording "
+               "or a directory of recordings of the keyword\n");
     return false;
   }
-
-  if (keyword_index == -1) {
-    // wake-word not found
+  std::vector<std::string> files;
+  if (!audiofile::list(input, files))
+    return false;
+  if (files.empty()) {
+    g_printerr("No recordings in %s\n", input);
     return false;
   }
 
-  g_message("Detected keyword!\n");
-  return true;
+  static const WakeWordEngineType TYPES[] = {WakeWordEngineType::PORCUPINE,
+                                             WakeWordEngineType::TEMPLATE};
+  static const char *const NAMES[] = {"porcupine", "template"};
+
+  bool ok = true;
+  size_t ran = 0;
+  g_print("################ Wakeword Benchmark ##################\n");
+  for (size_t t = 0; t < G_N_ELEMENTS(TYPES); t++) {
+    std::vector<WakeWordKeyword> keywords = app->config->pv_keywords;
+    if (TYPES[t] != app->config->pv_engine) {
+      if (TYPES[t] == WakeWordEngineType::TEMPLATE) {
+        g_print("%12s: skipped, needs [picovoice] engine=template\n",
+                NAMES[t]);
+        continue;
+      }
+      keywords = {WakeWordKeyword{app->config->pv_keyword_path,
+                                  app->config->pv_sensitivity,
+                                  WakeWordAction::WAKE}};
+    }
+
+    auto engine = create_engine(app, TYPES[t], keywords);
+    if (!engine) {
+      g_print("%12s: skipped, failed to initialize\n", NAMES[t]);
+      continue;
+    }
+    ok = benchmark_engine(engine.get(), files) && ok;
+    ran++;
+  }
+  g_print("######################################################\n");
+  return ok && ran > 0;
 }
@@ -19,28 +19,85 @@
 #pragma once
 
 #include "app.hpp"
-#include <pv_porcupine.h>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace genie {
 
+/**
+ * @brief A wake-word detector.
+ *
+ * Engines consume fixed-size frames of mono audio at their own sample rate,
+ * which the capture side adopts, and detect any of the configured keywords.
+ */
+class WakeWordEngine {
+public:
+  virtual ~WakeWordEngine() {}
+  /**
+   * @brief Prepare to detect `keywords`, which keep their index.
+   *
+   * @return false, after logging why, if the engine cannot run
+   */
+  virtual bool init(App *app, const std::vector<WakeWordKeyword> &keywords) = 0;
+
+  virtual const char *name() const = 0;
+  virtual size_t sample_rate() const = 0;
+  virtual size_t frame_length() const = 0;
+  /**
+   * @brief Process the next `frame_length()` samples.
+   *
+   * @return the index of the detected keyword, or -1
+   */
+  virtual int process(const int16_t *samples) = 0;
+};
+
 class WakeWord {
 public:
   WakeWord(App *app);
-  ~WakeWord();
-  int process(AudioFrame *frame);
+  /**
+   * @brief Run the wake-word engine on one frame.
+   *
+   * @return the index of the detected keyword in `Config::pv_keywords`, or
+   * -1 if none was detected
+   */
+  int process(const int16_t *samples, size_t length);
+
+  /**
+   * @brief Average time spent in the engine per frame, in microseconds.
+   */
+  double average_us() const {
+    size_t n = frames.load();
+    return n ? (double)total_us.load() / n : 0.0;
+  }
+  void print_stats();
+
+  /**
+   * @brief Create and initialize an engine for `keywords`.
+   *
+   * @return the engine, or nullptr if it failed to initialize
+   */
+  static std::unique_ptr<WakeWordEngine>
+  create_engine(App *app, WakeWordEngineType type,
+                const std::vector<WakeWordKeyword> &keywords);
+
+  /**
+   * @brief Measure CPU time and detection latency of every available engine
+   * on the recordings at `input`, see `--benchmark=wakeword`.
+   */
+  static bool benchmark(App *app, const char *input);
 
-  int32_t pv_frame_length;
+  size_t frame_length;
   size_t sample_rate;
 
 private:
   // initialized once and never overwritten
   App *const app;
+  std::unique_ptr<WakeWordEngine> engine;
 
-  void *porcupine_library;
-  pv_porcupine_t *porcupine;
-  decltype(pv_porcupine_delete) *pv_porcupine_delete_func;
-  decltype(pv_porcupine_process) *pv_porcupine_process_func;
-  decltype(pv_status_to_string) *pv_status_to_string_func;
+  std::atomic<size_t> frames{0};
+  std::atomic<gint64> total_us{0};
+  std::unique_ptr<std::atomic<size_t>[]> detections;
 };
 
 } // namespace genie
@@ -0,0 +1,111 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "webrtcprocessor.hpp"
+#include <glib.h>
+#include <string.h>
+
+#include <webrtc/modules/audio_processing/include/audio_processing.h>
+#include <webrtc/modules/interface/module_common_types.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::WebRtcProcessor"
+
+genie::WebRtcProcessor::WebRtcProcessor()
+    : sample_rate(0), chunk(0), echo_cancel(false) {}
+
+genie::WebRtcProcessor::~WebRtcProcessor() {}
+
+bool genie::WebRtcProcessor::init(int sample_rate, bool echo_cancel,
+                                  bool noise_suppression, bool gain_control) {
+  this->sample_rate = sample_rate;
+  this->echo_cancel = echo_cancel;
+  chunk = sample_rate / 100;
+
+  webrtc::Config config;
+  // the longer filter copes with the large delays of USB and HDMI devices
+  config.Set<webrtc::ExtendedFilter>(new webrtc::ExtendedFilter(true));
+  config.Set<webrtc::DelayAgnostic>(new webrtc::DelayAgnostic(true));
+  apm.reset(webrtc::AudioProcessing::Create(config));
+  if (!apm) {
+    g_critical("Failed to create the WebRTC audio processing module");
+    return false;
+  }
+
+  apm->high_pass_filter()->Enable(true);
+
+  if (echo_cancel) {
+    apm->echo_cancellation()->enable_drift_compensation(false);
+    apm->echo_cancellation()->set_suppression_level(
+        webrtc::EchoCancellation::kHighSuppression);
+    apm->echo_cancellation()->Enable(true);
+  }
+
+  if (noise_suppression) {
+    apm->noise_suppression()->set_level(webrtc::NoiseSuppression::kHigh);
+    apm->noise_suppression()->Enable(true);
+  }
+
+  if (gain_control) {
+    apm->gain_control()->set_mode(webrtc::GainControl::kAdaptiveDigital);
+    apm->gain_control()->Enable(true);
+  }
+
+  g_message("Initialized WebRTC audio processing: echo cancellation %s, "
+            "noise suppression %s, gain control %s",
+            echo_cancel ? "on" : "off", noise_suppression ? "on" : "off",
+            gain_control ? "on" : "off");
+  return true;
+}
+
+bool genie::WebRtcProcessor::process(int16_t *samples,
+                                     const int16_t *reference,
+                                     size_t length) {
+  if (length % chunk) {
+    g_critical("WebRTC processing needs multiples of %zu samples, got %zu",
+               chunk, length);
+    return false;
+  }
+
+  webrtc::AudioFrame frame;
+  frame.sample_rate_hz_ = sample_rate;
+  frame.num_channels_ = 1;
+  frame.samples_per_channel_ = chunk;
+
+  for (size_t offset = 0; offset < length; offset += chunk) {
+    if (echo_cancel && reference) {
+      memcpy(frame.data_, reference + offset, chunk * sizeof(int16_t));
+      int error = apm->AnalyzeReverseStream(&frame);
+      if (error != webrtc::AudioProcessing::kNoError) {
+        g_warning("AnalyzeReverseStream failed with %d", error);
+      }
+      // the reference is recorded in the same frame as the microphone
+      apm->set_stream_delay_ms(0);
+    }
+
+    memcpy(frame.data_, samples + offset, chunk * sizeof(int16_t));
+    int error = apm->ProcessStream(&frame);
+    if (error != webrtc::AudioProcessing::kNoError) {
+      g_warning("ProcessStream failed with %d", error);
+      return false;
+    }
+    memcpy(samples + offset, frame.data_, chunk * sizeof(int16_t));
+  }
+
+  return true;
+}
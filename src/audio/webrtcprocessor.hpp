@@ -0,0 +1,72 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "audioprocessor.hpp"
+
+namespace webrtc {
+class AudioProcessing;
+} // namespace webrtc
+
+namespace genie {
+
+/**
+ * @brief Capture processing with the WebRTC `AudioProcessing` module: echo
+ * cancellation against a playback reference, noise suppression and automatic
+ * gain control.
+ *
+ * The module works on 10 ms chunks, so `process()` must be given a whole
+ * number of them.
+ */
+class WebRtcProcessor : public AudioProcessor {
+public:
+  WebRtcProcessor();
+  ~WebRtcProcessor();
+  const char *name() const { return "webrtc"; }
+
+  /**
+   * @brief Set up the module for mono audio at `sample_rate`.
+   *
+   * @param echo_cancel enable echo cancellation, `process()` must then be
+   * given the playback reference
+   */
+  bool init(int sample_rate, bool echo_cancel, bool noise_suppression,
+            bool gain_control);
+
+  /**
+   * @brief Process `length` samples of microphone audio in place.
+   *
+   * @param reference the playback signal recorded alongside the microphone,
+   * or `nullptr` without echo cancellation
+   */
+  bool process(int16_t *samples, const int16_t *reference, size_t length);
+
+  /**
+   * @brief Samples in one 10 ms chunk.
+   */
+  size_t chunk_length() const { return chunk; }
+
+private:
+  std::unique_ptr<webrtc::AudioProcessing> apm;
+  int sample_rate;
+  size_t chunk;
+  bool echo_cancel;
+};
+
+} // namespace genie
@@ -17,8 +17,11 @@
 // limitations under the License.
 
 #include "config.hpp"
+#include <algorithm>
 #include <glib-unix.h>
 #include <glib.h>
+#include <sched.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "leds.hpp"
@@ -45,6 +48,7 @@ genie::Config::~Config() {
   g_free(audio_output_device_alerts);
   g_free(audio_volume_control);
   g_free(audio_voice);
+  g_free(audio_processing);
   g_free(sound_wake);
   g_free(sound_no_input);
   g_free(sound_too_much_input);
@@ -54,6 +58,8 @@ genie::Config::~Config() {
   g_free(sound_stt_error);
   g_free(pv_model_path);
   g_free(pv_keyword_path);
+  for (auto &keyword : pv_keywords)
+    g_free(keyword.path);
   g_free(pv_wake_word_pattern);
   g_free(proxy);
   g_free(ssl_ca_file);
@@ -355,6 +361,8 @@ genie::AudioDriverType genie::Config::get_audio_backend() {
     backend = AudioDriverType::ALSA;
   } else if (strcmp(value, "pulse") == 0 || strcmp(value, "pulseaudio") == 0) {
     backend = AudioDriverType::PULSEAUDIO;
+  } else if (strcmp(value, "replay") == 0) {
+    backend = AudioDriverType::REPLAY;
   } else {
     g_warning("Invalid audio backend %s, using default 'pulseaudio'", value);
     backend = AudioDriverType::PULSEAUDIO;
@@ -364,6 +372,73 @@ genie::AudioDriverType genie::Config::get_audio_backend() {
   return backend;
 }
 
+static genie::WakeWordAction parse_wake_word_action(const char *action) {
+  if (strcmp(action, "stop") == 0)
+    return genie::WakeWordAction::STOP;
+  if (strcmp(action, "wake") != 0)
+    g_warning("Invalid wake-word action %s, using 'wake'", action);
+  return genie::WakeWordAction::WAKE;
+}
+
+void genie::Config::get_wake_word_keywords() {
+  gsize num_keywords = 0;
+  gchar **keywords = g_key_file_get_string_list(
+      key_file, "picovoice", "keywords", &num_keywords, nullptr);
+  if (!keywords || num_keywords == 0) {
+    g_strfreev(keywords);
+    pv_keywords.push_back(WakeWordKeyword{
+        g_strdup(pv_keyword_path), pv_sensitivity, WakeWordAction::WAKE});
+    return;
+  }
+
+  gsize num_sensitivities = 0;
+  gdouble *sensitivities = g_key_file_get_double_list(
+      key_file, "picovoice", "sensitivities", &num_sensitivities, nullptr);
+  gsize num_actions = 0;
+  gchar **actions = g_key_file_get_string_list(
+      key_file, "picovoice", "actions", &num_actions, nullptr);
+
+  for (gsize i = 0; i < num_keywords; i++) {
+    WakeWordKeyword keyword{g_strdup(keywords[i]), pv_sensitivity,
+                            WakeWordAction::WAKE};
+    if (i < num_sensitivities) {
+      keyword.sensitivity =
+          (float)std::min(1.0, std::max(0.0, sensitivities[i]));
+    }
+    if (i < num_actions) {
+      keyword.action = parse_wake_word_action(actions[i]);
+    }
+    pv_keywords.push_back(keyword);
+  }
+
+  g_strfreev(keywords);
+  g_free(sensitivities);
+  g_strfreev(actions);
+}
+
+void genie::Config::get_beamformer_mics() {
+  gsize num_mics = 0;
+  gchar **mics = g_key_file_get_string_list(key_file, "beamformer", "mics",
+                                            &num_mics, nullptr);
+  for (gsize i = 0; i < num_mics; i++) {
+    MicPosition mic;
+    if (sscanf(mics[i], "%lf,%lf", &mic.x, &mic.y) != 2) {
+      g_warning("Invalid [beamformer] mic position %s, expected x,y in "
+                "millimetres; beamforming disabled",
+                mics[i]);
+      beamformer_mics.clear();
+      break;
+    }
+    beamformer_mics.push_back(mic);
+  }
+  g_strfreev(mics);
+
+  if (beamformer_mics.size() == 1) {
+    g_warning("[beamformer] needs at least two mics, beamforming disabled");
+    beamformer_mics.clear();
+  }
+}
+
 void genie::Config::save() {
   GError *error = NULL;
   g_key_file_save_to_file(key_file, "config.ini", &error);
@@ -513,6 +588,19 @@ void genie::Config::load() {
       g_clear_error(&error);
       audio_input_stereo2mono = false;
     }
+  } else if (audio_backend == AudioDriverType::REPLAY) {
+    // [audio] input names the file or directory to play back, and
+    // everything we would play is discarded
+    audio_input_device = get_string("audio", "input", "replay");
+    audio_volume_control = nullptr;
+    audio_output_fifo = nullptr;
+    audio_input_stereo2mono = false;
+    audio_sink = g_strdup("fakesink");
+
+    audio_output_device = nullptr;
+    audio_output_device_music = nullptr;
+    audio_output_device_voice = nullptr;
+    audio_output_device_alerts = nullptr;
   } else {
     g_assert_not_reached();
     return;
@@ -520,6 +608,60 @@ void genie::Config::load() {
 
   audio_voice = get_string("audio", "voice", DEFAULT_VOICE);
 
+  audio_frame_pool_size = get_bounded_size(
+      "audio", "frame_pool_size", DEFAULT_AUDIO_FRAME_POOL_SIZE,
+      AUDIO_FRAME_POOL_MIN_SIZE, AUDIO_FRAME_POOL_MAX_SIZE);
+
+  audio_channel_size =
+      get_bounded_size("audio", "channel_size", DEFAULT_AUDIO_CHANNEL_SIZE,
+                       AUDIO_CHANNEL_MIN_SIZE, AUDIO_CHANNEL_MAX_SIZE);
+
+  audio_capture_period_ms = get_bounded_size(
+      "audio", "capture_period_ms", DEFAULT_AUDIO_CAPTURE_PERIOD_MS,
+      AUDIO_CAPTURE_PERIOD_MIN_MS, AUDIO_CAPTURE_PERIOD_MAX_MS);
+  audio_capture_buffer_ms = get_bounded_size(
+      "audio", "capture_buffer_ms", DEFAULT_AUDIO_CAPTURE_BUFFER_MS,
+      AUDIO_CAPTURE_BUFFER_MIN_MS, AUDIO_CAPTURE_BUFFER_MAX_MS);
+  audio_preroll_ms =
+      get_bounded_size("audio", "preroll_ms", DEFAULT_AUDIO_PREROLL_MS, 0,
+                       AUDIO_CAPTURE_BUFFER_MAX_MS);
+  audio_capture_priority =
+      get_bounded_size("audio", "capture_priority", 0, 0, 99);
+  audio_capture_cpu = -1;
+  if (g_key_file_has_key(key_file, "audio", "capture_cpu", NULL)) {
+    audio_capture_cpu =
+        (int)get_bounded_size("audio", "capture_cpu", 0, 0, CPU_SETSIZE - 1);
+  }
+
+  gchar *pulse_input = get_string("audio", "pulse_input", "simple");
+  if (strcmp(pulse_input, "stream") == 0) {
+    audio_pulse_stream_input = true;
+  } else {
+    if (strcmp(pulse_input, "simple") != 0) {
+      g_warning("Invalid [audio] pulse_input %s, using default 'simple'",
+                pulse_input);
+    }
+    audio_pulse_stream_input = false;
+  }
+  g_free(pulse_input);
+  audio_pulse_fragsize_ms = get_bounded_size(
+      "audio", "pulse_fragsize_ms", DEFAULT_PULSE_FRAGSIZE_MS,
+      PULSE_FRAGSIZE_MIN_MS, PULSE_FRAGSIZE_MAX_MS);
+
+  audio_alsa_mmap = get_bool("audio", "alsa_mmap", false);
+  audio_alsa_period_size =
+      get_bounded_size("audio", "alsa_period_size", 0, 0, ALSA_PERIOD_MAX_SIZE);
+  audio_alsa_buffer_size =
+      get_bounded_size("audio", "alsa_buffer_size", 0, 0, ALSA_BUFFER_MAX_SIZE);
+  audio_alsa_capture_rate = get_bounded_size("audio", "alsa_capture_rate", 0,
+                                             0, ALSA_CAPTURE_MAX_RATE);
+  audio_resampler_quality =
+      get_bounded_size("audio", "resampler_quality", DEFAULT_RESAMPLER_QUALITY,
+                       0, RESAMPLER_MAX_QUALITY);
+
+  audio_replay_realtime = get_bool("audio", "replay_realtime", true);
+  audio_replay_loop = get_bool("audio", "replay_loop", false);
+
   // Echo Cancellation
   // =========================================================================
 
@@ -536,6 +678,50 @@ void genie::Config::load() {
     audio_ec_loopback = false;
   }
 
+  gchar *ec_engine = get_string("ec", "engine", "speex");
+  if (strcmp(ec_engine, "webrtc") == 0) {
+    audio_ec_engine = EchoCancellerType::WEBRTC;
+  } else {
+    if (strcmp(ec_engine, "speex") != 0) {
+      g_warning("Invalid [ec] engine %s, using default 'speex'", ec_engine);
+    }
+    audio_ec_engine = EchoCancellerType::SPEEX;
+  }
+  g_free(ec_engine);
+  audio_ec_tail_ms = get_bounded_size("ec", "tail_ms", DEFAULT_EC_TAIL_MS,
+                                      EC_TAIL_MIN_MS, EC_TAIL_MAX_MS);
+  audio_ec_noise_suppression = get_bool("ec", "noise_suppression", true);
+  audio_ec_gain_control = get_bool("ec", "gain_control", true);
+
+  const char *default_processing = "";
+  if (audio_ec_enabled) {
+    default_processing = audio_ec_engine == EchoCancellerType::WEBRTC
+                             ? "webrtc"
+                             : "speex_aec,speex_denoise";
+  }
+  audio_processing = get_string("audio", "processing", default_processing);
+  audio_gain_db = get_bounded_double("audio", "gain_db", 0, AUDIO_GAIN_MIN_DB,
+                                     AUDIO_GAIN_MAX_DB);
+
+  // Beamformer
+  // =========================================================================
+
+  get_beamformer_mics();
+  gchar *steering = get_string("beamformer", "steering", "auto");
+  beamformer_auto_steer = strcmp(steering, "auto") == 0;
+  beamformer_azimuth = 0;
+  if (!beamformer_auto_steer) {
+    char *end;
+    beamformer_azimuth = g_ascii_strtod(steering, &end);
+    if (end == steering || *end != '\0') {
+      g_warning("Invalid [beamformer] steering %s, using default 'auto'",
+                steering);
+      beamformer_auto_steer = true;
+      beamformer_azimuth = 0;
+    }
+  }
+  g_free(steering);
+
   // Hacks
   // =========================================================================
 
@@ -552,12 +738,36 @@ void genie::Config::load() {
   // Picovoice
   // =========================================================================
 
+  gchar *engine = get_string("picovoice", "engine", "porcupine");
+  if (strcmp(engine, "template") == 0) {
+    pv_engine = WakeWordEngineType::TEMPLATE;
+  } else {
+    if (strcmp(engine, "porcupine") != 0) {
+      g_warning("Invalid [picovoice] engine %s, using default 'porcupine'",
+                engine);
+    }
+    pv_engine = WakeWordEngineType::PORCUPINE;
+  }
+  g_free(engine);
+
   pv_model_path = get_string("picovoice", "model", DEFAULT_PV_MODEL_PATH);
 
   pv_keyword_path = get_string("picovoice", "keyword", DEFAULT_PV_KEYWORD_PATH);
 
   pv_sensitivity = (float)get_bounded_double("picovoice", "sensitivity",
                                              DEFAULT_PV_SENSITIVITY, 0, 1);
+  get_wake_word_keywords();
+
+  pv_energy_gate = get_bool("picovoice", "energy_gate", false);
+  pv_gate_open_db = get_bounded_double("picovoice", "gate_open_db",
+                                       DEFAULT_PV_GATE_OPEN_DB, 1, 40);
+  pv_gate_min_dbfs = get_bounded_double("picovoice", "gate_min_dbfs",
+                                        DEFAULT_PV_GATE_MIN_DBFS, -96, 0);
+  pv_gate_hangover_ms =
+      get_bounded_size("picovoice", "gate_hangover_ms",
+                       DEFAULT_PV_GATE_HANGOVER_MS, 100, 10000);
+  pv_gate_context_ms = get_bounded_size(
+      "picovoice", "gate_context_ms", DEFAULT_PV_GATE_CONTEXT_MS, 0, 2000);
 
   pv_wake_word_pattern = get_string("picovoice", "wake_word_pattern",
                                     DEFAULT_PV_WAKE_WORD_PATTERN);
@@ -690,6 +900,16 @@ void genie::Config::load() {
   // Voice Activity Detection (VAD)
   // =========================================================================
 
+  vad_frame_ms =
+      get_bounded_size("vad", "frame_ms", DEFAULT_VAD_FRAME_MS, 10, 30);
+  if (vad_frame_ms % 10 != 0) {
+    g_warning("CONFIG [vad] frame_ms must be 10, 20 or 30, found %zu. "
+              "Using %zu.",
+              vad_frame_ms, DEFAULT_VAD_FRAME_MS);
+    vad_frame_ms = DEFAULT_VAD_FRAME_MS;
+  }
+  vad_mode = get_bounded_size("vad", "mode", DEFAULT_VAD_MODE, 0, 3);
+
   vad_start_speaking_ms =
       get_bounded_size("vad", "start_speaking_ms",
                        DEFAULT_VAD_START_SPEAKING_MS, VAD_MIN_MS, VAD_MAX_MS);
@@ -698,6 +918,11 @@ void genie::Config::load() {
       get_bounded_size("vad", "done_speaking_ms", DEFAULT_VAD_DONE_SPEAKING_MS,
                        VAD_MIN_MS, VAD_MAX_MS);
 
+  vad_adaptive_endpointing = get_bool("vad", "adaptive_endpointing", false);
+  vad_min_done_speaking_ms = get_bounded_size(
+      "vad", "min_done_speaking_ms", DEFAULT_VAD_MIN_DONE_SPEAKING_MS,
+      VAD_MIN_MS, vad_done_speaking_ms);
+
   vad_input_detected_noise_ms = get_bounded_size(
       "vad", "input_detected_noise_ms", DEFAULT_VAD_INPUT_DETECTED_NOISE_MS,
       VAD_MIN_MS, VAD_MAX_MS);
@@ -706,6 +931,51 @@ void genie::Config::load() {
       "vad", "listen_timeout_ms", DEFAULT_VAD_LISTEN_TIMEOUT_MS,
       VAD_LISTEN_TIMEOUT_MIN_MS, VAD_LISTEN_TIMEOUT_MAX_MS);
 
+  // Speech-To-Text (STT)
+  // =========================================================================
+
+  stt_prewarm = get_bool("stt", "prewarm", false);
+
+  gchar *stt_codec_name = get_string("stt", "codec", "pcm");
+  if (strcmp(stt_codec_name, "speex") == 0) {
+    stt_codec = STTCodec::SPEEX;
+  } else {
+    if (strcmp(stt_codec_name, "pcm") != 0) {
+      g_warning("Invalid [stt] codec %s, using default 'pcm'", stt_codec_name);
+    }
+    stt_codec = STTCodec::PCM;
+  }
+  g_free(stt_codec_name);
+  stt_speex_quality = (int)get_bounded_size(
+      "stt", "speex_quality", DEFAULT_STT_SPEEX_QUALITY, 0, 10);
+  stt_coalesce_ms = get_bounded_size("stt", "coalesce_ms", 0, 0, 500);
+  stt_coalesce_max_bytes =
+      get_bounded_size("stt", "coalesce_max_bytes",
+                       DEFAULT_STT_COALESCE_MAX_BYTES, 1024, 1024 * 1024);
+
+  stt_queue_max_ms = get_bounded_size("stt", "queue_max_ms",
+                                      DEFAULT_STT_QUEUE_MAX_MS, 100, 60000);
+  stt_queue_max_bytes =
+      get_bounded_size("stt", "queue_max_bytes", DEFAULT_STT_QUEUE_MAX_BYTES,
+                       3200, 16 * 1024 * 1024);
+  gchar *stt_queue_policy_name = get_string("stt", "queue_policy", "spill");
+  if (strcmp(stt_queue_policy_name, "drop_oldest") == 0) {
+    stt_queue_policy = STTQueuePolicy::DROP_OLDEST;
+  } else if (strcmp(stt_queue_policy_name, "fail") == 0) {
+    stt_queue_policy = STTQueuePolicy::FAIL;
+  } else {
+    if (strcmp(stt_queue_policy_name, "spill") != 0) {
+      g_warning("Invalid [stt] queue_policy %s, using default 'spill'",
+                stt_queue_policy_name);
+    }
+    stt_queue_policy = STTQueuePolicy::SPILL;
+  }
+  g_free(stt_queue_policy_name);
+
+  stt_interim = get_bool("stt", "interim", false);
+  stt_interim_stable = get_bounded_size("stt", "interim_stable",
+                                        DEFAULT_STT_INTERIM_STABLE, 1, 20);
+
   // Web UI
   // =========================================================================
   webui_port =
@@ -20,11 +20,45 @@
 
 #include "audio/audio.hpp"
 #include <glib.h>
+#include <vector>
 
 namespace genie {
 
 enum class AuthMode { NONE, BEARER, COOKIE, HOME_ASSISTANT, OAUTH2 };
 
+enum class EchoCancellerType { SPEEX, WEBRTC };
+
+enum class WakeWordEngineType { PORCUPINE, TEMPLATE };
+
+enum class STTCodec { PCM, SPEEX };
+
+enum class STTQueuePolicy { DROP_OLDEST, FAIL, SPILL };
+
+/**
+ * @brief What happens when a wake-word keyword is detected.
+ */
+enum class WakeWordAction {
+  // start listening for a command
+  WAKE,
+  // stop whatever is playing, like the panic button, without listening
+  STOP,
+};
+
+/**
+ * @brief Position of a microphone of an array, in millimetres, in the plane
+ * of the array.
+ */
+struct MicPosition {
+  double x;
+  double y;
+};
+
+struct WakeWordKeyword {
+  gchar *path;
+  float sensitivity;
+  WakeWordAction action;
+};
+
 class Config {
 public:
   static const size_t DEFAULT_WS_RETRY_INTERVAL = 3000;
@@ -33,13 +67,70 @@ public:
   static const size_t VAD_MAX_MS = 5000;
   static const size_t DEFAULT_VAD_START_SPEAKING_MS = 3000;
   static const size_t DEFAULT_VAD_DONE_SPEAKING_MS = 500;
+  static const size_t DEFAULT_VAD_MIN_DONE_SPEAKING_MS = 200;
   static const size_t DEFAULT_VAD_INPUT_DETECTED_NOISE_MS = 600;
+  // the WebRTC VAD only takes frames of 10, 20 or 30 ms
+  static const size_t DEFAULT_VAD_FRAME_MS = 30;
+  static const size_t DEFAULT_VAD_MODE = 3;
+
+  // about 28 kbit/s in wideband
+  static const size_t DEFAULT_STT_SPEEX_QUALITY = 8;
+  // half a second of raw PCM
+  static const size_t DEFAULT_STT_COALESCE_MAX_BYTES = 16000;
+  // audio held while the STT connection opens, 3 seconds of raw PCM
+  static const size_t DEFAULT_STT_QUEUE_MAX_MS = 3000;
+  static const size_t DEFAULT_STT_QUEUE_MAX_BYTES = 96000;
+  // identical interim results before a partial transcript counts as stable
+  static const size_t DEFAULT_STT_INTERIM_STABLE = 2;
 
   // Max time spent in AudioInput LISTENING state
   static const size_t DEFAULT_VAD_LISTEN_TIMEOUT_MS = 10000;
   static const size_t VAD_LISTEN_TIMEOUT_MIN_MS = 1000;
   static const size_t VAD_LISTEN_TIMEOUT_MAX_MS = 100000;
 
+  // Number of preallocated audio frames shared by the capture path
+  static const size_t DEFAULT_AUDIO_FRAME_POOL_SIZE = 256;
+  static const size_t AUDIO_FRAME_POOL_MIN_SIZE = 16;
+  static const size_t AUDIO_FRAME_POOL_MAX_SIZE = 4096;
+
+  // Frames the input thread can queue for the main loop
+  static const size_t DEFAULT_AUDIO_CHANNEL_SIZE = 128;
+  static const size_t AUDIO_CHANNEL_MIN_SIZE = 16;
+  static const size_t AUDIO_CHANNEL_MAX_SIZE = 4096;
+
+  // Capture stream shared by the capture and detection threads
+  static const size_t DEFAULT_AUDIO_CAPTURE_PERIOD_MS = 10;
+  static const size_t AUDIO_CAPTURE_PERIOD_MIN_MS = 5;
+  static const size_t AUDIO_CAPTURE_PERIOD_MAX_MS = 30;
+  static const size_t DEFAULT_AUDIO_CAPTURE_BUFFER_MS = 2000;
+  static const size_t AUDIO_CAPTURE_BUFFER_MIN_MS = 200;
+  static const size_t AUDIO_CAPTURE_BUFFER_MAX_MS = 10000;
+
+  // Audio from before the wake word that is sent to STT
+  static const size_t DEFAULT_AUDIO_PREROLL_MS = 1000;
+
+  // PulseAudio capture fragment size for the pa_stream driver
+  static const size_t DEFAULT_PULSE_FRAGSIZE_MS = 10;
+  static const size_t PULSE_FRAGSIZE_MIN_MS = 1;
+  static const size_t PULSE_FRAGSIZE_MAX_MS = 200;
+
+  // ALSA period and buffer size, in frames; 0 keeps the driver default
+  static const size_t ALSA_PERIOD_MAX_SIZE = 16384;
+  static const size_t ALSA_BUFFER_MAX_SIZE = 65536;
+  static const size_t ALSA_CAPTURE_MAX_RATE = 192000;
+  // speex resampler quality, 0 (fastest) to 10 (best)
+  static const size_t DEFAULT_RESAMPLER_QUALITY = 3;
+  static const size_t RESAMPLER_MAX_QUALITY = 10;
+
+  // Echo canceller filter length (speex only)
+  static const size_t DEFAULT_EC_TAIL_MS = 300;
+  static const size_t EC_TAIL_MIN_MS = 50;
+  static const size_t EC_TAIL_MAX_MS = 1000;
+
+  // Fixed capture gain
+  static const constexpr double AUDIO_GAIN_MIN_DB = -20;
+  static const constexpr double AUDIO_GAIN_MAX_DB = 30;
+
   static const constexpr char *DEFAULT_PULSE_AUDIO_OUTPUT_DEVICE = "echosink";
   static const constexpr char *DEFAULT_ALSA_AUDIO_OUTPUT_DEVICE = "hw:0";
   static const constexpr char *DEFAULT_ALSA_AUDIO_VOLUME_CONTROL =
@@ -73,6 +164,10 @@ public:
 #error "Unsupported architecture"
 #endif
   static const constexpr float DEFAULT_PV_SENSITIVITY = 0.7f;
+  static const constexpr double DEFAULT_PV_GATE_OPEN_DB = 9;
+  static const constexpr double DEFAULT_PV_GATE_MIN_DBFS = -65;
+  static const size_t DEFAULT_PV_GATE_HANGOVER_MS = 1000;
+  static const size_t DEFAULT_PV_GATE_CONTEXT_MS = 300;
   static const constexpr char *DEFAULT_PV_WAKE_WORD_PATTERN =
       "^([A-Za-z]+[ .,]? (gene|genie|jeannie|jenny|jennie|dean)|beijing|pg and "
       "e|ragini|pagini|paging)[.,]?";
@@ -163,6 +258,107 @@ public:
    */
   bool audio_input_stereo2mono;
 
+  /**
+   * @brief Number of audio frames preallocated for the capture path.
+   *
+   * Captured frames borrow their buffers from this pool until they are sent
+   * to the STT service. If the pool runs dry frames fall back to the heap.
+   */
+  size_t audio_frame_pool_size;
+
+  /**
+   * @brief Number of frames the audio input thread can queue for the main
+   * loop before it starts dropping them.
+   */
+  size_t audio_channel_size;
+
+  /**
+   * @brief How much audio the capture thread reads from the driver at a
+   * time, in milliseconds. Fixed, whatever the detectors consume.
+   */
+  size_t audio_capture_period_ms;
+
+  /**
+   * @brief How much captured audio the detection thread can fall behind by
+   * before samples are lost, in milliseconds.
+   */
+  size_t audio_capture_buffer_ms;
+
+  /**
+   * @brief How much audio before the end of the wake word is sent to STT
+   * when it is detected, in milliseconds. Limited by
+   * `audio_capture_buffer_ms`.
+   */
+  size_t audio_preroll_ms;
+
+  /**
+   * @brief `SCHED_FIFO` priority of the capture thread, 1 to 99. 0 leaves it
+   * on the normal scheduler.
+   */
+  size_t audio_capture_priority;
+
+  /**
+   * @brief CPU the capture thread is pinned to, -1 to let it float.
+   */
+  int audio_capture_cpu;
+
+  /**
+   * @brief Capture with the asynchronous `pa_stream` driver instead of
+   * `pa_simple`. PulseAudio backend only (`[audio] pulse_input=stream`).
+   */
+  bool audio_pulse_stream_input;
+
+  /**
+   * @brief Fragment size requested from PulseAudio by the `pa_stream`
+   * driver, in milliseconds. This is roughly the capture latency.
+   */
+  size_t audio_pulse_fragsize_ms;
+
+  /**
+   * @brief Capture with `SND_PCM_ACCESS_MMAP_INTERLEAVED` and read samples
+   * straight out of the ALSA ring buffer instead of copying them with
+   * `snd_pcm_readi`. ALSA backend only.
+   */
+  bool audio_alsa_mmap;
+
+  /**
+   * @brief ALSA capture period size, in frames (0 = driver default).
+   */
+  size_t audio_alsa_period_size;
+
+  /**
+   * @brief ALSA capture buffer size, in frames (0 = driver default).
+   */
+  size_t audio_alsa_buffer_size;
+
+  /**
+   * @brief Rate the ALSA capture device is opened at, resampled in-process
+   * to the wake-word engine rate (0 = capture at that rate directly).
+   *
+   * Capturing at the native rate of the device, typically 48000, avoids
+   * the conversion of the ALSA `plug` layer.
+   */
+  size_t audio_alsa_capture_rate;
+
+  /**
+   * @brief Quality of the speex resampler used for `audio_alsa_capture_rate`,
+   * 0 (fastest) to 10 (best).
+   */
+  size_t audio_resampler_quality;
+
+  /**
+   * @brief Pace replayed audio at the sample rate, as if it came from a
+   * microphone, instead of feeding it as fast as the pipeline consumes it.
+   * Replay backend only.
+   */
+  bool audio_replay_realtime;
+
+  /**
+   * @brief Start over from the first file when the replay reaches the end,
+   * instead of continuing with silence. Replay backend only.
+   */
+  bool audio_replay_loop;
+
   // Echo Cancellation
   // -------------------------------------------------------------------------
 
@@ -174,6 +370,64 @@ public:
    */
   bool audio_ec_loopback;
 
+  /**
+   * @brief Which echo canceller processes the capture stream,
+   * `[ec] engine=speex|webrtc`.
+   *
+   * The WebRTC audio processing module also does noise suppression and
+   * gain control, which do not need the loopback channel.
+   */
+  EchoCancellerType audio_ec_engine;
+
+  /**
+   * @brief Length of the echo the speex canceller can remove, in
+   * milliseconds.
+   */
+  size_t audio_ec_tail_ms;
+
+  /**
+   * @brief Enable noise suppression in the WebRTC engine.
+   */
+  bool audio_ec_noise_suppression;
+
+  /**
+   * @brief Enable adaptive digital gain control in the WebRTC engine.
+   */
+  bool audio_ec_gain_control;
+
+  /**
+   * @brief Comma-separated capture processing stages, run in order on every
+   * captured period: `speex_aec`, `speex_denoise`, `webrtc`, `gain`.
+   *
+   * Defaults to the echo canceller selected in `[ec]`, if it is enabled.
+   */
+  gchar *audio_processing;
+
+  /**
+   * @brief Gain applied by the `gain` processing stage, in dB.
+   */
+  double audio_gain_db;
+
+  /**
+   * @brief Positions of the microphones of the array, in capture channel
+   * order, `[beamformer] mics`. With two or more, the ALSA driver captures
+   * one channel per microphone (plus the loopback channel, last, with
+   * `audio_ec_loopback`) and combines them with a `Beamformer`.
+   */
+  std::vector<MicPosition> beamformer_mics;
+
+  /**
+   * @brief Steer the beam toward the estimated direction of the talker,
+   * `[beamformer] steering=auto`, instead of `beamformer_azimuth`.
+   */
+  bool beamformer_auto_steer;
+
+  /**
+   * @brief Fixed steering direction, in degrees counterclockwise from the x
+   * axis of `beamformer_mics`.
+   */
+  double beamformer_azimuth;
+
   // Hacks
   // -------------------------------------------------------------------------
   //
@@ -215,9 +469,53 @@ public:
   // Picovoice (Wake-Word Detection)
   // -------------------------------------------------------------------------
 
+  /**
+   * @brief Which engine detects the wake-word,
+   * `[picovoice] engine=porcupine|template`, see `WakeWordEngine`.
+   */
+  WakeWordEngineType pv_engine;
   gchar *pv_model_path;
   gchar *pv_keyword_path;
   float pv_sensitivity;
+
+  /**
+   * @brief Keywords the wake-word engine listens for, with their sensitivity
+   * and action. The index of a keyword in this list is the one carried by the
+   * `Wake` event.
+   *
+   * From the `keywords`, `sensitivities` and `actions` lists, or just
+   * `keyword` and `sensitivity`.
+   */
+  std::vector<WakeWordKeyword> pv_keywords;
+
+  /**
+   * @brief Skip the wake-word engine on frames that are clearly silence, see
+   * `EnergyGate`.
+   */
+  bool pv_energy_gate;
+
+  /**
+   * @brief How far above the noise floor a frame must be to open the energy
+   * gate, in dB.
+   */
+  double pv_gate_open_db;
+
+  /**
+   * @brief Frames quieter than this never open the energy gate, in dBFS.
+   */
+  double pv_gate_min_dbfs;
+
+  /**
+   * @brief How long the energy gate stays open after the last loud frame, in
+   * milliseconds.
+   */
+  size_t pv_gate_hangover_ms;
+
+  /**
+   * @brief Audio from before the frame that opened the energy gate that
+   * the wake-word engine still gets to hear, in milliseconds.
+   */
+  size_t pv_gate_context_ms;
   gchar *pv_wake_word_pattern;
 
   // Sounds
@@ -272,11 +570,91 @@ public:
   // Voice Activity Detection (VAD)
   // -------------------------------------------------------------------------
 
+  /**
+   * @brief Length of the frames the VAD decides on, 10, 20 or 30 ms.
+   *
+   * Shorter frames let the start and end of speech be detected sooner, at
+   * the cost of more calls into the VAD.
+   */
+  size_t vad_frame_ms;
+  /**
+   * @brief Aggressiveness of the WebRTC VAD, from 0 (least likely to drop
+   * speech) to 3 (least likely to take noise for speech).
+   */
+  size_t vad_mode;
+
   size_t vad_start_speaking_ms;
   size_t vad_done_speaking_ms;
+
+  /**
+   * @brief End the turn after a tail of silence that adapts to the noise
+   * floor and to how long the user has spoken, between
+   * `vad_min_done_speaking_ms` and `vad_done_speaking_ms`, instead of always
+   * waiting `vad_done_speaking_ms`. See `Endpointer`.
+   */
+  bool vad_adaptive_endpointing;
+  size_t vad_min_done_speaking_ms;
+
   size_t vad_input_detected_noise_ms;
   size_t vad_listen_timeout_ms;
 
+  // Speech-To-Text (STT)
+  // -------------------------------------------------------------------------
+
+  /**
+   * @brief Keep a connection to the STT service open ahead of the wake word,
+   * so the audio is not held back by DNS, TCP, TLS and the websocket
+   * handshake. Each session that takes it opens a replacement. Off by
+   * default, as it keeps a connection open on the server at all times.
+   */
+  bool stt_prewarm;
+
+  /**
+   * @brief Format of the audio streamed to the STT service, announced in the
+   * handshake. `SPEEX` cuts the uplink from 256 kbit/s of raw PCM to a few
+   * tens of kbit/s, which matters on slow or congested links.
+   */
+  STTCodec stt_codec;
+  // 0 to 10, see SpeexEncoder
+  int stt_speex_quality;
+
+  /**
+   * @brief Longest a captured frame waits to be sent to STT together with
+   * the frames that follow it, in milliseconds; 0 sends every frame as its
+   * own message.
+   *
+   * Fewer, larger messages save websocket and TLS overhead per frame. The
+   * end of speech is always sent right away.
+   */
+  size_t stt_coalesce_ms;
+  // a message is sent as soon as it reaches this size
+  size_t stt_coalesce_max_bytes;
+
+  /**
+   * @brief Most audio a session holds while its connection opens, as a
+   * duration and in bytes, and what happens to the audio beyond that.
+   *
+   * `DROP_OLDEST` loses the start of the command, `FAIL` ends the session
+   * with an error, `SPILL` keeps the oldest audio Speex-compressed and
+   * sends it when the connection opens: as is with a Speex uplink, decoded
+   * back to PCM only when the uplink is PCM.
+   */
+  size_t stt_queue_max_ms;
+  size_t stt_queue_max_bytes;
+  STTQueuePolicy stt_queue_policy;
+
+  /**
+   * @brief Ask the STT service for interim results and measure how often the
+   * first partial transcript that came back `stt_interim_stable` times in a
+   * row matched the final one, and how much earlier it came.
+   *
+   * The partial transcripts are never sent to Genie: it executes every
+   * command it receives and has no dry-run mode, so a command from a partial
+   * transcript that the final one then contradicts would still run.
+   */
+  bool stt_interim;
+  size_t stt_interim_stable;
+
   // Web UI
   // -------------------------------------------------------------------------
   int webui_port;
@@ -330,6 +708,8 @@ private:
                             const double max);
   bool get_bool(const char *section, const char *key, const bool default_value);
   AudioDriverType get_audio_backend();
+  void get_wake_word_keywords();
+  void get_beamformer_mics();
 };
 
 } // namespace genie
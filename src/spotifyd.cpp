@@ -197,6 +197,11 @@ static void child_setup(gpointer user_data) {
 }
 
 int genie::Spotifyd::spawn() {
+  if (app->config->audio_backend == AudioDriverType::REPLAY) {
+    g_message("Not starting spotifyd, the replay backend has no audio output");
+    return false;
+  }
+
   gchar *file_path = g_strdup_printf("%s/spotifyd", app->config->cache_dir);
   const gchar *device_name = "genie-cpp";
   const char *backend = audio_driver_type_to_string(app->config->audio_backend);
@@ -0,0 +1,53 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "state/events.hpp"
+
+namespace genie {
+namespace state {
+namespace events {
+
+// Enough for a few seconds of frames queued on the main loop
+static const size_t INPUT_FRAME_POOL_SIZE = 256;
+
+static BlockPool &input_frame_pool() {
+  static BlockPool pool(sizeof(InputFrame), INPUT_FRAME_POOL_SIZE);
+  return pool;
+}
+
+void *InputFrame::operator new(size_t size) {
+  if (size == sizeof(InputFrame)) {
+    void *block = input_frame_pool().acquire();
+    if (block)
+      return block;
+  }
+  return ::operator new(size);
+}
+
+void InputFrame::operator delete(void *ptr) {
+  if (!input_frame_pool().release(ptr))
+    ::operator delete(ptr);
+}
+
+BlockPool::Stats InputFrame::pool_stats() {
+  return input_frame_pool().stats();
+}
+
+} // namespace events
+} // namespace state
+} // namespace genie
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "../audio/audio.hpp"
+#include "../audio/framepool.hpp"
 #include <glib.h>
 #include <memory>
 #include <string>
@@ -82,18 +83,36 @@ private:
 // Audio Input Events
 // ===========================================================================
 
-struct Wake : Event {};
+struct Wake : Event {
+  // index in Config::pv_keywords of the keyword that was detected
+  int keyword;
+
+  Wake(int keyword = 0) : keyword(keyword) {}
+};
 
 struct InputFrame : Event {
   AudioFrame frame;
-
-  InputFrame(AudioFrame frame) : frame(std::move(frame)) {}
+  // smoothed probability that the user is speaking, 0 to 1, see
+  // Endpointer::speech_probability()
+  float speech_probability;
+
+  InputFrame(AudioFrame frame, float speech_probability = 0)
+      : frame(std::move(frame)), speech_probability(speech_probability) {}
+
+  // one of these is dispatched for every captured frame, so they are
+  // carved out of a preallocated pool rather than the heap
+  static void *operator new(size_t size);
+  static void operator delete(void *ptr);
+  static BlockPool::Stats pool_stats();
 };
 
 struct InputDone : Event {
   bool vad_detected;
+  // capture time of the end of speech, 0 if unknown
+  gint64 speech_end;
 
-  InputDone(bool vad_detected) : vad_detected(vad_detected) {}
+  InputDone(bool vad_detected, gint64 speech_end = 0)
+      : vad_detected(vad_detected), speech_end(speech_end) {}
 };
 
 struct InputNotDetected : Event {};
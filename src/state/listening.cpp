@@ -21,6 +21,7 @@
 #include "audio/audioinput.hpp"
 #include "audio/audioplayer.hpp"
 #include "audio/audiovolume.hpp"
+#include "audio/latency.hpp"
 #include "leds.hpp"
 #include "stt.hpp"
 
@@ -51,12 +52,14 @@ void Listening::react(events::Wake *) {
 }
 
 void Listening::react(events::InputFrame *input_frame) {
+  latency::record(latency::Stage::LISTENING, input_frame->frame.timestamp);
   app->stt->send_frame(std::move(input_frame->frame));
 }
 
 void Listening::react(events::InputDone *input_done) {
   g_message("Handling InputDone...\n");
-  app->stt->send_done();
+  app->stt->send_done(input_done->speech_end);
+  latency::record(latency::Stage::STT_DONE, input_done->speech_end);
   app->audio_player->stop();
   if (input_done->vad_detected) {
     app->audio_player->play_sound(Sound_t::WORKING);
@@ -67,6 +70,7 @@ void Listening::react(events::InputDone *input_done) {
 void Listening::react(events::InputNotDetected *) {
   g_message("Handling InputNotDetected...\n");
   app->stt->abort();
+  app->audio_input->cancel();
   app->audio_player->stop();
   app->audio_player->play_sound(Sound_t::NO_INPUT);
   app->transit(new Sleeping(app));
@@ -75,10 +79,23 @@ void Listening::react(events::InputNotDetected *) {
 void Listening::react(events::InputTimeout *) {
   g_message("Handling InputTimeout...\n");
   app->stt->abort();
+  app->audio_input->cancel();
   app->audio_player->stop();
   app->audio_player->play_sound(Sound_t::TOO_MUCH_INPUT);
   app->transit(new Sleeping(app));
 }
 
+void Listening::react(events::stt::ErrorResponse *response) {
+  // STT gave up before the user was done talking, e.g. it could not connect
+  g_warning("STT failed while listening (code=%d): %s", response->code,
+            response->message.c_str());
+  // AudioInput is still capturing the command, let it hear the wake word
+  app->audio_input->cancel();
+  app->audio_player->stop();
+  app->audio_player->play_sound(Sound_t::STT_ERROR);
+  app->leds->animate(LedsState_t::Error);
+  app->transit(new Sleeping(app));
+}
+
 } // namespace state
 } // namespace genie
@@ -40,6 +40,7 @@ public:
   void react(events::InputDone *) override;
   void react(events::InputNotDetected *) override;
   void react(events::InputTimeout *) override;
+  void react(events::stt::ErrorResponse *response) override;
 
 private:
   bool is_follow_up = false;
@@ -18,6 +18,7 @@
 
 #include "state/state.hpp"
 #include "app.hpp"
+#include "audio/audioinput.hpp"
 #include "audio/audioplayer.hpp"
 #include "audio/audiovolume.hpp"
 #include "spotifyd.hpp"
@@ -45,7 +46,8 @@ void State::exit() {
 // Event Handling Methods
 // ===========================================================================
 
-void State::react(events::Wake *) {
+void State::react(events::Wake *wake) {
+  g_debug("Woken up by keyword %d", wake->keyword);
   // Normally when we wake we start listening. The exception is the Listen
   // state itself.
   app->transit(new Listening(app));
@@ -119,6 +121,8 @@ void State::react(events::TogglePlayback *) {
 
 void State::react(events::Panic *) {
   g_warning("PANIC!!! :D");
+  // stop listening too, if a command was being captured
+  app->audio_input->cancel();
   app->conversation_client.get()->send_thingtalk("$stop;");
   app->spotifyd.get()->pause();
   app->transit(new Sleeping(app));
@@ -126,6 +130,7 @@ void State::react(events::Panic *) {
 
 void State::react(events::ToggleDisabled *) {
   g_message("DISABLING...");
+  app->audio_input->cancel();
   app->transit(new Disabled(app));
 }
 
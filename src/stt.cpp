@@ -17,7 +17,9 @@
 // limitations under the License.
 
 #include "stt.hpp"
+#include "audio/latency.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <glib-object.h>
 #include <glib-unix.h>
@@ -35,6 +37,13 @@
 
 using namespace genie::state::events::stt;
 
+// seconds between pings on the standby connection, well under the idle
+// timeouts of the proxies and NATs between us and the server
+static const guint STANDBY_KEEPALIVE_S = 20;
+
+// the capture side always hands STT audio at the wake-word engine rate
+static const size_t STT_SAMPLE_RATE = 16000;
+
 static std::string get_ws_url(genie::App *app) {
   const char *nl_url = app->config->nl_url;
   g_assert(g_str_has_prefix(nl_url, "http"));
@@ -47,21 +56,125 @@ static std::string get_ws_url(genie::App *app) {
 genie::STT::STT(App *app) : m_app(app), m_url(get_ws_url(app)) {
   wake_word_pattern = std::regex(app->config->pv_wake_word_pattern,
                                  std::regex_constants::icase);
+  if (app->config->stt_prewarm)
+    prewarm();
+}
+
+genie::STT::~STT() {
+  if (m_standby_retry_id > 0)
+    g_source_remove(m_standby_retry_id);
+  if (m_standby_cancellable)
+    g_cancellable_cancel(m_standby_cancellable.get());
+  if (m_standby) {
+    g_signal_handlers_disconnect_by_data(m_standby.get(), this);
+    soup_websocket_connection_close(m_standby.get(),
+                                    SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+  }
+}
+
+/**
+ * @brief Open the standby connection for the next session, unless it is
+ * already open or opening.
+ */
+void genie::STT::prewarm() {
+  if (m_standby || m_standby_cancellable || m_standby_retry_id > 0)
+    return;
+  g_debug("Opening standby STT connection...");
+
+  auto_gobject_ptr<SoupMessage> msg(
+      soup_message_new(SOUP_METHOD_GET, m_url.c_str()), adopt_mode::owned);
+  m_standby_cancellable =
+      auto_gobject_ptr<GCancellable>(g_cancellable_new(), adopt_mode::owned);
+
+  soup_session_websocket_connect_async(
+      m_app->get_soup_session(), msg.get(), NULL, NULL,
+      m_standby_cancellable.get(),
+      (GAsyncReadyCallback)genie::STT::on_standby_connection, this);
+}
+
+void genie::STT::on_standby_connection(SoupSession *session,
+                                       GAsyncResult *res, gpointer data) {
+  GError *error = NULL;
+  auto_gobject_ptr<SoupWebsocketConnection> connection(
+      soup_session_websocket_connect_finish(session, res, &error),
+      adopt_mode::owned);
+  if (error && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    // cancelled because the STT is being destroyed, do not touch it
+    g_error_free(error);
+    return;
+  }
+
+  STT *self = static_cast<STT *>(data);
+  self->m_standby_cancellable = nullptr;
+  if (error) {
+    g_warning("Failed to open standby STT connection: %s", error->message);
+    g_error_free(error);
+    self->m_standby_retry_id =
+        g_timeout_add(self->m_app->config->retry_interval,
+                      genie::STT::retry_prewarm, self);
+    return;
+  }
+
+  g_debug("Standby STT connection open");
+  self->m_standby = std::move(connection);
+  self->standby_opened++;
+  soup_websocket_connection_set_keepalive_interval(self->m_standby.get(),
+                                                   STANDBY_KEEPALIVE_S);
+  g_signal_connect(self->m_standby.get(), "closed",
+                   G_CALLBACK(genie::STT::on_standby_close), self);
+}
+
+void genie::STT::on_standby_close(SoupWebsocketConnection *conn,
+                                  gpointer data) {
+  STT *self = static_cast<STT *>(data);
+
+  g_message("Standby STT connection closed (%d), reopening",
+            soup_websocket_connection_get_close_code(conn));
+  g_signal_handlers_disconnect_by_data(conn, self);
+  self->m_standby = nullptr;
+  self->standby_lost++;
+  self->m_standby_retry_id = g_timeout_add(
+      self->m_app->config->retry_interval, genie::STT::retry_prewarm, self);
+}
+
+gboolean genie::STT::retry_prewarm(gpointer data) {
+  STT *self = static_cast<STT *>(data);
+  self->m_standby_retry_id = 0;
+  self->prewarm();
+  return G_SOURCE_REMOVE;
 }
 
 void genie::STT::complete_success(STTSession *session, const char *text) {
   if (session != m_current_session.get())
     return;
   m_current_session = nullptr;
+  latency::record(latency::Stage::STT_RESULT, m_speech_end);
 
   m_app->dispatch(new TextResponse(text));
 }
 
+void genie::STT::record_interim(STTSession *session, bool stable,
+                                bool matched, gint64 early_us) {
+  if (session != m_current_session.get())
+    return;
+
+  interim_turns++;
+  if (!stable)
+    return;
+  interim_stable++;
+  if (!matched)
+    return;
+  interim_matched++;
+  interim_early_total_us += early_us;
+  interim_early_max_us = std::max(interim_early_max_us, early_us);
+}
+
 void genie::STT::complete_error(STTSession *session, int error_code,
                                 const char *error_message) {
   if (session != m_current_session.get())
     return;
   m_current_session = nullptr;
+  latency::record(latency::Stage::STT_RESULT, m_speech_end);
 
   m_app->dispatch(new ErrorResponse(error_code, error_message));
 }
@@ -79,15 +192,30 @@ void genie::STT::begin_session(bool is_follow_up) {
     m_current_session = nullptr;
   }
 
-  m_current_session =
-      std::make_unique<STTSession>(this, m_url.c_str(), is_follow_up);
+  // take the standby connection if it is still usable, otherwise the session
+  // connects on its own
+  auto_gobject_ptr<SoupWebsocketConnection> standby;
+  if (m_standby && soup_websocket_connection_get_state(m_standby.get()) ==
+                       SOUP_WEBSOCKET_STATE_OPEN) {
+    g_signal_handlers_disconnect_by_data(m_standby.get(), this);
+    standby = std::move(m_standby);
+  }
+
+  m_session_start = g_get_monotonic_time();
+  m_speech_end = 0;
+  m_current_session = std::make_unique<STTSession>(
+      this, m_url.c_str(), is_follow_up, std::move(standby));
+
+  if (m_app->config->stt_prewarm)
+    prewarm();
 }
 
-void genie::STT::send_done() {
+void genie::STT::send_done(gint64 speech_end) {
   if (!m_current_session) {
     g_warning("Done event without an active speech to text request");
     return;
   }
+  m_speech_end = speech_end;
 
   m_current_session->send_done();
 }
@@ -103,6 +231,82 @@ void genie::STT::send_frame(AudioFrame frame) {
   m_current_session->send_frame(std::move(frame));
 }
 
+static void print_first_audio(const char *name, size_t sessions,
+                              gint64 total_us, gint64 max_us) {
+  if (sessions == 0)
+    return;
+  g_print("%12s: %zu sessions, first audio %.1f ms avg, %.1f ms max after "
+          "the wake word\n",
+          name, sessions, total_us / 1000.0 / sessions, max_us / 1000.0);
+}
+
+void genie::STT::print_stats() {
+  g_print("##################### STT Stats ######################\n");
+  g_print("%12s: %zu sent, %zu waited for the connection, largest queue "
+          "%zu (%zu ms)\n",
+          "Frames", frames_sent, frames_queued, largest_queue,
+          largest_queue_ms);
+  if (frames_queued > 0) {
+    g_print("%12s: %.1f ms avg, %.1f ms max in the queue; %zu dropped, %zu "
+            "spilled, %zu sessions failed\n",
+            "Queue",
+            queue_waits ? queue_wait_total_us / 1000.0 / queue_waits : 0.0,
+            queue_wait_max_us / 1000.0, frames_dropped, frames_spilled,
+            sessions_failed);
+  }
+  if (frames_sent > 0) {
+    g_print("%12s: %zu frames in %zu messages, %.1f frames per message\n",
+            "Coalescing", frames_sent, messages_sent,
+            messages_sent ? (double)frames_sent / messages_sent : 0.0);
+  }
+  if (turns > 0) {
+    g_print("%12s: %s, %zu turns, %.1f KiB avg per turn, %.0f%% of PCM, "
+            "%.1f ms encoding per turn\n",
+            "Uplink",
+            m_app->config->stt_codec == STTCodec::SPEEX ? "speex" : "pcm",
+            turns, bytes_sent / 1024.0 / turns,
+            pcm_bytes ? 100.0 * bytes_sent / pcm_bytes : 100.0,
+            encode_us / 1000.0 / turns);
+  }
+  if (m_app->config->stt_prewarm) {
+    g_print("%12s: %zu opened, %zu closed while idle, %zu dead when used\n",
+            "Standby", standby_opened, standby_lost, standby_dead);
+  }
+  if (m_app->config->stt_interim && interim_turns > 0) {
+    g_print("%12s: %zu turns, %zu stable before the end, %zu matched the "
+            "final transcript\n",
+            "Interim", interim_turns, interim_stable, interim_matched);
+  }
+  if (interim_matched > 0) {
+    g_print("%12s: %.1f ms avg, %.1f ms max between the stable partial and "
+            "the final transcript\n",
+            "Early", interim_early_total_us / 1000.0 / interim_matched,
+            interim_early_max_us / 1000.0);
+  }
+  print_first_audio("Warm start", warm_sessions, warm_total_us, warm_max_us);
+  print_first_audio("Cold start", cold_sessions, cold_total_us, cold_max_us);
+  g_print("######################################################\n");
+}
+
+void genie::STT::record_first_audio(STTSession *session, bool warm) {
+  if (session != m_current_session.get())
+    return;
+
+  gint64 us = g_get_monotonic_time() - m_session_start;
+  g_debug("First STT audio sent %.1f ms after the wake word, on a %s "
+          "connection",
+          us / 1000.0, warm ? "standby" : "new");
+  if (warm) {
+    warm_sessions++;
+    warm_total_us += us;
+    warm_max_us = std::max(warm_max_us, us);
+  } else {
+    cold_sessions++;
+    cold_total_us += us;
+    cold_max_us = std::max(cold_max_us, us);
+  }
+}
+
 void genie::STT::record_timing_event(STTSession *session,
                                      genie::STT::Event event) {
   if (session != m_current_session.get())
@@ -131,14 +335,34 @@ void genie::STT::record_timing_event(STTSession *session,
   }
 }
 
-genie::STTSession::STTSession(STT *controller, const char *url,
-                              bool is_follow_up)
-    : m_controller(controller), m_state(State::INITIAL), m_done(false),
-      is_follow_up(is_follow_up), m_url(url), retries(0) {
-  connect();
+genie::STTSession::STTSession(
+    STT *controller, const char *url, bool is_follow_up,
+    auto_gobject_ptr<SoupWebsocketConnection> standby)
+    : m_controller(controller), m_state(State::INITIAL), m_queued_samples(0),
+      m_spilled_samples(0), m_done(false),
+      is_follow_up(is_follow_up), m_url(url), retries(0),
+      m_warm(standby.get() != nullptr), m_resend_overflow(false),
+      m_heard_back(false), m_sent_audio(false),
+      m_flush_timeout_id(0), m_frames(0), m_messages(0), m_bytes(0),
+      m_partial_repeats(0), m_stable_at(0) {
+  if (controller->m_app->config->stt_codec == STTCodec::SPEEX) {
+    m_encoder = std::make_unique<SpeexEncoder>(STT_SAMPLE_RATE);
+    if (!m_encoder->init(controller->m_app->config->stt_speex_quality)) {
+      g_warning("Sending raw PCM to STT instead");
+      m_encoder = nullptr;
+    }
+  }
+  if (m_warm) {
+    g_debug("STT using the standby connection");
+    open(std::move(standby));
+  } else {
+    connect();
+  }
 }
 
 genie::STTSession::~STTSession() {
+  if (m_flush_timeout_id > 0)
+    g_source_remove(m_flush_timeout_id);
   if (m_connection) {
     // remove all signals because the object was deleted
     g_signal_handlers_disconnect_by_data(m_connection.get(), this);
@@ -168,7 +392,7 @@ void genie::STTSession::on_connection(SoupSession *session, GAsyncResult *res,
   self->m_controller->record_timing_event(self, STT::Event::FIRST_FRAME);
 
   GError *error = NULL;
-  self->m_connection = auto_gobject_ptr<SoupWebsocketConnection>(
+  auto_gobject_ptr<SoupWebsocketConnection> connection(
       soup_session_websocket_connect_finish(session, res, &error),
       adopt_mode::owned);
   if (error) {
@@ -185,16 +409,34 @@ void genie::STTSession::on_connection(SoupSession *session, GAsyncResult *res,
     }
     return;
   }
-  self->m_state = State::STREAMING;
-
-  soup_websocket_connection_send_text(self->m_connection.get(),
-                                      "{ \"ver\": 1 }");
-  self->flush_queue();
+  self->open(std::move(connection));
+}
 
-  g_signal_connect(self->m_connection.get(), "message",
-                   G_CALLBACK(genie::STTSession::on_message), self);
-  g_signal_connect(self->m_connection.get(), "closed",
-                   G_CALLBACK(genie::STTSession::on_close), self);
+void genie::STTSession::open(
+    auto_gobject_ptr<SoupWebsocketConnection> connection) {
+  m_connection = std::move(connection);
+  m_state = State::STREAMING;
+
+  // the format is only announced when it is not the raw PCM that servers
+  // assume without it, and interim results are only asked for when they
+  // are measured
+  gchar *format =
+      m_encoder
+          ? g_strdup_printf(", \"format\": \"speex\", \"sample_rate\": %zu",
+                            STT_SAMPLE_RATE)
+          : g_strdup("");
+  gchar *hello = g_strdup_printf(
+      "{ \"ver\": 1%s%s }", format,
+      m_controller->m_app->config->stt_interim ? ", \"interim\": true" : "");
+  soup_websocket_connection_send_text(m_connection.get(), hello);
+  g_free(hello);
+  g_free(format);
+  flush_queue();
+
+  g_signal_connect(m_connection.get(), "message",
+                   G_CALLBACK(genie::STTSession::on_message), this);
+  g_signal_connect(m_connection.get(), "closed",
+                   G_CALLBACK(genie::STTSession::on_close), this);
 }
 
 void genie::STTSession::handle_stt_result(const char *text) {
@@ -215,10 +457,90 @@ void genie::STTSession::handle_stt_result(const char *text) {
     m_controller->complete_error(this, 400, "wakeword only");
   } else {
     g_message("Mangled: %s", mangled.c_str());
+    if (m_controller->m_app->config->stt_interim)
+      record_interim(mangled);
     m_controller->complete_success(this, mangled.c_str());
   }
 }
 
+// a stable partial transcript would have been good enough when it differs
+// from the final one only in case, punctuation and spacing, which Genie
+// does not care about
+static std::string normalize_transcript(const std::string &text) {
+  gchar *folded = g_utf8_casefold(text.c_str(), -1);
+  std::string normalized;
+  bool separator = false;
+  for (const gchar *p = folded; *p; p = g_utf8_next_char(p)) {
+    gunichar c = g_utf8_get_char(p);
+    if (!g_unichar_isalnum(c)) {
+      separator = true;
+      continue;
+    }
+    if (separator && !normalized.empty())
+      normalized += ' ';
+    separator = false;
+
+    char utf8[6];
+    normalized.append(utf8, g_unichar_to_utf8(c, utf8));
+  }
+  g_free(folded);
+  return normalized;
+}
+
+void genie::STTSession::record_interim(const std::string &text) {
+  if (m_stable.empty()) {
+    m_controller->record_interim(this, false, false, 0);
+    return;
+  }
+
+  if (normalize_transcript(text) != normalize_transcript(m_stable)) {
+    g_message("Final transcript \"%s\" does not match the stable partial "
+              "\"%s\"",
+              text.c_str(), m_stable.c_str());
+    m_controller->record_interim(this, true, false, 0);
+    return;
+  }
+
+  // sending the partial to Genie would have started the command this much
+  // earlier
+  gint64 early_us = g_get_monotonic_time() - m_stable_at;
+  g_message("Stable partial transcript matched the final one, %.1f ms early",
+            early_us / 1000.0);
+  m_controller->record_interim(this, true, true, early_us);
+}
+
+void genie::STTSession::handle_partial_result(const char *text) {
+  if (!m_stable.empty())
+    return;
+
+  if (m_partial == text) {
+    m_partial_repeats++;
+  } else {
+    m_partial = text;
+    m_partial_repeats = 1;
+  }
+  if (m_partial_repeats < m_controller->m_app->config->stt_interim_stable)
+    return;
+
+  // the same checks as the final result, minus the errors: a transcript
+  // that fails them would not have been worth sending yet
+  if (m_controller->m_app->config->hacks_wake_word_verification &&
+      !is_follow_up &&
+      !std::regex_search(text, m_controller->wake_word_pattern))
+    return;
+  std::string mangled =
+      std::regex_replace(text, m_controller->wake_word_pattern, "");
+  if (mangled.empty())
+    return;
+
+  g_message("Partial transcript stable after %zu results: %s",
+            m_partial_repeats, mangled.c_str());
+  // only measured: the partial transcript is never sent to Genie, which
+  // would execute it even if the final one turns out different
+  m_stable = mangled;
+  m_stable_at = g_get_monotonic_time();
+}
+
 void genie::STTSession::on_message(SoupWebsocketConnection *conn, gint type,
                                    GBytes *message, gpointer data) {
   STTSession *self = static_cast<STTSession *>(data);
@@ -228,13 +550,12 @@ void genie::STTSession::on_message(SoupWebsocketConnection *conn, gint type,
     return;
   }
   if (self->m_state != State::STREAMING) {
-    g_warning("Received STT final message in invalid state %d",
-              (int)self->m_state);
+    g_warning("Received STT message in invalid state %d", (int)self->m_state);
     return;
   }
-
-  self->m_controller->record_timing_event(self, STT::Event::DONE);
-  self->m_state = State::CLOSING;
+  // the connection works, no need to keep the audio for another one
+  self->m_heard_back = true;
+  std::vector<int16_t>().swap(self->m_resend);
 
   gsize sz;
   const gchar *ptr = (const gchar *)g_bytes_get_data(message, &sz);
@@ -249,27 +570,43 @@ void genie::STTSession::on_message(SoupWebsocketConnection *conn, gint type,
   int status = json_reader_get_int_value(reader);
   json_reader_end_member(reader);
 
+  const gchar *result = nullptr;
   if (status == 0) {
     json_reader_read_member(reader, "result");
-    const gchar *result = json_reader_get_string_value(reader);
+    result = json_reader_get_string_value(reader);
     json_reader_end_member(reader);
+  }
 
-    if (strcmp(result, "ok") == 0) {
-      json_reader_read_member(reader, "text");
-      const gchar *text = json_reader_get_string_value(reader);
-      json_reader_end_member(reader);
+  if (result && strcmp(result, "partial") == 0) {
+    // an interim result, the final one is still to come
+    json_reader_read_member(reader, "text");
+    const gchar *text = json_reader_get_string_value(reader);
+    json_reader_end_member(reader);
 
-      PROF_PRINT("STT text: %s\n", text);
-      self->handle_stt_result(text);
-    }
+    if (text)
+      self->handle_partial_result(text);
   } else {
-    g_print("STT status %d\n", status);
+    self->m_controller->record_timing_event(self, STT::Event::DONE);
+    self->m_state = State::CLOSING;
+
+    if (status == 0) {
+      if (result && strcmp(result, "ok") == 0) {
+        json_reader_read_member(reader, "text");
+        const gchar *text = json_reader_get_string_value(reader);
+        json_reader_end_member(reader);
+
+        PROF_PRINT("STT text: %s\n", text);
+        self->handle_stt_result(text);
+      }
+    } else {
+      g_print("STT status %d\n", status);
 
-    json_reader_read_member(reader, "code");
-    const char *code = json_reader_get_string_value(reader);
-    json_reader_end_member(reader);
+      json_reader_read_member(reader, "code");
+      const char *code = json_reader_get_string_value(reader);
+      json_reader_end_member(reader);
 
-    self->m_controller->complete_error(self, status, code);
+      self->m_controller->complete_error(self, status, code);
+    }
   }
 
   g_object_unref(reader);
@@ -280,6 +617,13 @@ void genie::STTSession::on_close(SoupWebsocketConnection *conn, gpointer data) {
   STTSession *self = static_cast<STTSession *>(data);
 
   gushort code = soup_websocket_connection_get_close_code(conn);
+
+  if (self->m_state == State::STREAMING && self->m_warm &&
+      !self->m_heard_back && !self->m_resend_overflow) {
+    // the standby connection was dead when it was handed over
+    self->reconnect_cold();
+    return;
+  }
   self->m_connection = nullptr;
 
   if (self->m_state != State::CLOSING) {
@@ -294,11 +638,172 @@ void genie::STTSession::on_close(SoupWebsocketConnection *conn, gpointer data) {
   }
 }
 
+/**
+ * @brief Start over on a new connection after the standby one closed before
+ * the server answered: the audio sent on it goes into the queue again,
+ * followed by the end of speech if it was sent.
+ */
+void genie::STTSession::reconnect_cold() {
+  g_warning("Standby STT connection closed before the server answered, "
+            "reconnecting");
+  m_controller->standby_dead++;
+  g_signal_handlers_disconnect_by_data(m_connection.get(), this);
+  m_connection = nullptr;
+  m_warm = false;
+
+  if (m_flush_timeout_id > 0) {
+    g_source_remove(m_flush_timeout_id);
+    m_flush_timeout_id = 0;
+  }
+  m_batch.clear();
+  m_batch_timestamps.clear();
+  if (m_encoder) {
+    // the new connection needs a stream from the start
+    m_encoder = std::make_unique<SpeexEncoder>(STT_SAMPLE_RATE);
+    if (!m_encoder->init(m_controller->m_app->config->stt_speex_quality))
+      m_encoder = nullptr;
+  }
+
+  std::vector<int16_t> samples;
+  samples.swap(m_resend);
+  gint64 now = g_get_monotonic_time();
+  static const size_t RESEND_FRAME_LENGTH = STT_SAMPLE_RATE * 30 / 1000;
+  for (size_t pos = 0; pos < samples.size(); pos += RESEND_FRAME_LENGTH) {
+    size_t length = std::min(RESEND_FRAME_LENGTH, samples.size() - pos);
+    AudioFrame frame(length);
+    memcpy(frame.samples, &samples[pos], length * sizeof(int16_t));
+    m_queued_samples += length;
+    queue.push(QueuedFrame{std::move(frame), now});
+  }
+  if (m_done)
+    queue.push(QueuedFrame{AudioFrame(0), now});
+
+  retries = 0;
+  connect();
+}
+
 void genie::STTSession::flush_queue() {
+  flush_spill();
+
+  gint64 now = g_get_monotonic_time();
   while (!queue.empty()) {
-    dispatch_frame(std::move(queue.front()));
+    gint64 waited = now - queue.front().queued_at;
+    m_controller->queue_waits++;
+    m_controller->queue_wait_total_us += waited;
+    m_controller->queue_wait_max_us =
+        std::max(m_controller->queue_wait_max_us, waited);
+
+    dispatch_frame(std::move(queue.front().frame));
+    queue.pop();
+  }
+  m_queued_samples = 0;
+}
+
+/**
+ * @brief Send the audio that was spilled out of the queue ahead of what is
+ * still queued: as it is with a Speex uplink, decoded with a PCM one.
+ */
+void genie::STTSession::flush_spill() {
+  if (m_spilled_samples == 0)
+    return;
+
+  if (m_encoder) {
+    g_debug("Sending %zu spilled samples (%zu bytes)", m_spilled_samples,
+            m_encoder->size());
+    flush_batch();
+    m_spilled_samples = 0;
+    return;
+  }
+  if (!m_spill)
+    return;
+
+  // the samples short of a whole Speex frame go out raw, padding them would
+  // put silence in the middle of the command
+  std::vector<int16_t> tail = m_spill->take_pending();
+  std::vector<char> bits = m_spill->take();
+  m_spill = nullptr;
+
+  std::vector<int16_t> samples;
+  SpeexDecoder decoder(STT_SAMPLE_RATE);
+  if (!decoder.init())
+    return;
+  decoder.decode(bits, samples);
+  samples.insert(samples.end(), tail.begin(), tail.end());
+  g_debug("Sending %zu spilled samples (%zu bytes compressed)",
+          samples.size(), bits.size());
+
+  // the capture time of the spilled audio is lost, so these frames are not
+  // counted in the latency stats
+  static const size_t SPILL_FRAME_LENGTH = STT_SAMPLE_RATE * 30 / 1000;
+  for (size_t pos = 0; pos < samples.size(); pos += SPILL_FRAME_LENGTH) {
+    size_t length = std::min(SPILL_FRAME_LENGTH, samples.size() - pos);
+    AudioFrame frame(length);
+    memcpy(frame.samples, &samples[pos], length * sizeof(int16_t));
+    dispatch_frame(std::move(frame));
+  }
+  m_spilled_samples = 0;
+}
+
+/**
+ * @brief Apply the queue policy to the audio over the queue limit.
+ *
+ * @return false if the session failed, in which case it has been destroyed
+ */
+bool genie::STTSession::enforce_queue_limit() {
+  const Config *config = m_controller->m_app->config.get();
+  size_t max_samples =
+      std::min(config->stt_queue_max_ms * STT_SAMPLE_RATE / 1000,
+               config->stt_queue_max_bytes / sizeof(int16_t));
+
+  // never touches the empty frame that marks the end of speech, it is last
+  while (m_queued_samples > max_samples && queue.front().frame.length > 0) {
+    AudioFrame &oldest = queue.front().frame;
+    switch (config->stt_queue_policy) {
+      case STTQueuePolicy::DROP_OLDEST:
+        m_controller->frames_dropped++;
+        break;
+
+      case STTQueuePolicy::SPILL:
+        if (m_encoder) {
+          // the uplink encoder takes the audio for good, it is sent as it
+          // is once connected, without decoding and encoding it again
+          gint64 start = g_get_monotonic_time();
+          m_encoder->encode(oldest.samples, oldest.length);
+          m_controller->encode_us += g_get_monotonic_time() - start;
+          m_controller->pcm_bytes += oldest.length * sizeof(int16_t);
+          m_controller->frames_sent++;
+          m_frames++;
+          m_spilled_samples += oldest.length;
+          m_controller->frames_spilled++;
+          break;
+        }
+        if (!m_spill) {
+          m_spill = std::make_unique<SpeexEncoder>(STT_SAMPLE_RATE);
+          if (!m_spill->init(config->stt_speex_quality)) {
+            m_spill = nullptr;
+            m_controller->frames_dropped++;
+            break;
+          }
+        }
+        m_spill->encode(oldest.samples, oldest.length);
+        m_spilled_samples += oldest.length;
+        m_controller->frames_spilled++;
+        break;
+
+      case STTQueuePolicy::FAIL:
+        g_warning("STT connection not open after %zu ms of audio, giving up",
+                  m_queued_samples * 1000 / STT_SAMPLE_RATE);
+        m_controller->sessions_failed++;
+        // note that this function will free this session, we cannot access
+        // it afterwards
+        m_controller->complete_error(this, SOUP_WEBSOCKET_CLOSE_ABNORMAL,
+                                     "STT connection too slow");
+        return false;
+    }
+    m_queued_samples -= oldest.length;
     queue.pop();
   }
+  return true;
 }
 
 /**
@@ -322,7 +827,18 @@ void genie::STTSession::send_frame(AudioFrame frame) {
   } else {
     // The connection is not open yet, queue the frame to be sent when it does
     // open.
-    queue.push(std::move(frame));
+    m_queued_samples += frame.length;
+    queue.push(QueuedFrame{std::move(frame), g_get_monotonic_time()});
+    m_controller->frames_queued++;
+    if (!enforce_queue_limit())
+      return;
+
+    m_controller->largest_queue =
+        std::max(m_controller->largest_queue, queue.size());
+    m_controller->largest_queue_ms =
+        std::max(m_controller->largest_queue_ms,
+                 (m_queued_samples + m_spilled_samples) * 1000 /
+                     STT_SAMPLE_RATE);
   }
 }
 
@@ -338,10 +854,110 @@ void genie::STTSession::send_done() {
   m_done = true;
 }
 
+void genie::STTSession::send_audio(const void *data, size_t size) {
+  soup_websocket_connection_send_binary(m_connection.get(), data, size);
+  m_controller->messages_sent++;
+  m_controller->bytes_sent += size;
+  m_messages++;
+  m_bytes += size;
+
+  if (!m_sent_audio) {
+    m_sent_audio = true;
+    m_controller->record_first_audio(this, m_warm);
+  }
+}
+
+size_t genie::STTSession::batch_size() {
+  return m_encoder ? m_encoder->size() : m_batch.size();
+}
+
+/**
+ * @brief Send the frames waiting in the batch as one message.
+ */
+void genie::STTSession::flush_batch() {
+  if (m_flush_timeout_id > 0) {
+    g_source_remove(m_flush_timeout_id);
+    m_flush_timeout_id = 0;
+  }
+  if (!m_connection) {
+    // closed while the batch was waiting, the session is ending anyway
+    m_batch.clear();
+    m_batch_timestamps.clear();
+    return;
+  }
+
+  if (m_encoder) {
+    const std::vector<char> &bytes = m_encoder->take();
+    if (!bytes.empty())
+      send_audio(bytes.data(), bytes.size());
+  } else if (!m_batch.empty()) {
+    send_audio(m_batch.data(), m_batch.size());
+    m_batch.clear();
+  }
+
+  for (gint64 timestamp : m_batch_timestamps) {
+    latency::record(latency::Stage::STT_SEND, timestamp);
+  }
+  m_batch_timestamps.clear();
+}
+
+gboolean genie::STTSession::on_flush_timeout(gpointer data) {
+  STTSession *self = static_cast<STTSession *>(data);
+  self->m_flush_timeout_id = 0;
+  self->flush_batch();
+  return G_SOURCE_REMOVE;
+}
+
 void genie::STTSession::dispatch_frame(AudioFrame frame) {
-  soup_websocket_connection_send_binary(m_connection.get(), frame.samples,
-                                        frame.length * sizeof(int16_t));
+  const Config *config = m_controller->m_app->config.get();
+
   if (frame.length == 0) {
+    // end of speech: what is still waiting goes out right away, then the
+    // empty message
+    if (m_encoder)
+      m_encoder->finish();
+    flush_batch();
+    soup_websocket_connection_send_binary(m_connection.get(), frame.samples, 0);
+    m_controller->turns++;
     m_controller->record_timing_event(this, STT::Event::LAST_FRAME);
+    g_message("STT turn: %zu frames in %zu messages, %zu bytes", m_frames,
+              m_messages, m_bytes);
+    return;
+  }
+
+  size_t frame_bytes = frame.length * sizeof(int16_t);
+  if (m_warm && !m_heard_back && !m_resend_overflow) {
+    if ((m_resend.size() + frame.length) * sizeof(int16_t) >
+        config->stt_queue_max_bytes) {
+      // too much to send again, a dead connection fails the turn
+      m_resend_overflow = true;
+      std::vector<int16_t>().swap(m_resend);
+    } else {
+      m_resend.insert(m_resend.end(), frame.samples,
+                      frame.samples + frame.length);
+    }
+  }
+  if (m_encoder) {
+    gint64 start = g_get_monotonic_time();
+    m_encoder->encode(frame.samples, frame.length);
+    m_controller->encode_us += g_get_monotonic_time() - start;
+  } else {
+    if (!m_batch.empty() &&
+        m_batch.size() + frame_bytes > config->stt_coalesce_max_bytes)
+      flush_batch();
+    const char *bytes = reinterpret_cast<const char *>(frame.samples);
+    m_batch.insert(m_batch.end(), bytes, bytes + frame_bytes);
+  }
+  m_batch_timestamps.push_back(frame.timestamp);
+  m_controller->pcm_bytes += frame_bytes;
+  m_controller->frames_sent++;
+  m_frames++;
+
+  if (config->stt_coalesce_ms == 0 ||
+      batch_size() >= config->stt_coalesce_max_bytes) {
+    flush_batch();
+  } else if (m_flush_timeout_id == 0) {
+    m_flush_timeout_id =
+        g_timeout_add(config->stt_coalesce_ms, on_flush_timeout, this);
   }
 }
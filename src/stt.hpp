@@ -22,6 +22,7 @@
 #include <libsoup/soup.h>
 
 #include "app.hpp"
+#include "audio/speexencoder.hpp"
 #include "utils/autoptrs.hpp"
 #include <queue>
 #include <regex>
@@ -43,18 +44,74 @@ public:
 private:
   STT *const m_controller;
 
+  struct QueuedFrame {
+    AudioFrame frame;
+    // g_get_monotonic_time() when it was queued
+    gint64 queued_at;
+  };
+
   State m_state;
-  std::queue<AudioFrame> queue;
+  // frames waiting for the connection to open, bounded by [stt] queue_max_ms
+  // and queue_max_bytes
+  std::queue<QueuedFrame> queue;
+  size_t m_queued_samples;
+  // with the SPILL policy and a PCM uplink, the oldest audio that did not
+  // fit in the queue, compressed; with a Speex uplink it goes straight into
+  // `m_encoder`
+  std::unique_ptr<SpeexEncoder> m_spill;
+  size_t m_spilled_samples;
   auto_gobject_ptr<SoupWebsocketConnection> m_connection;
   bool m_done;
   bool is_follow_up;
   const char *m_url;
   int retries;
+  // the session started on a connection that was already open
+  bool m_warm;
+  // until the server answers on a warm connection, the audio sent on it, to
+  // send again on a new connection if it turns out to be dead; bounded by
+  // [stt] queue_max_bytes
+  std::vector<int16_t> m_resend;
+  bool m_resend_overflow;
+  bool m_heard_back;
+  bool m_sent_audio;
+  // nullptr when streaming raw PCM
+  std::unique_ptr<SpeexEncoder> m_encoder;
+
+  // frames waiting to go out as one message, up to [stt] coalesce_ms after
+  // the first of them; the audio is in the encoder when there is one
+  std::vector<char> m_batch;
+  std::vector<gint64> m_batch_timestamps;
+  guint m_flush_timeout_id;
+  size_t m_frames;
+  size_t m_messages;
+  size_t m_bytes;
+
+  // the latest interim result and how many times in a row it came back,
+  // and the first one that came back [stt] interim_stable times, with when
+  std::string m_partial;
+  size_t m_partial_repeats;
+  std::string m_stable;
+  gint64 m_stable_at;
 
   void handle_stt_result(const char *text);
+  void handle_partial_result(const char *text);
+  void record_interim(const std::string &text);
+  bool enforce_queue_limit();
+  void flush_spill();
+  size_t batch_size();
+  void flush_batch();
+  static gboolean on_flush_timeout(gpointer data);
+  void send_audio(const void *data, size_t size);
+  void open(auto_gobject_ptr<SoupWebsocketConnection> connection);
+  void reconnect_cold();
 
 public:
-  STTSession(STT *controller, const char *url, bool is_follow_up);
+  /**
+   * @brief Start a session on the `standby` connection, if it is not null,
+   * or on a new connection to `url`.
+   */
+  STTSession(STT *controller, const char *url, bool is_follow_up,
+             auto_gobject_ptr<SoupWebsocketConnection> standby);
   ~STTSession();
   void connect();
 
@@ -79,11 +136,17 @@ class STT {
 
 public:
   STT(App *app);
+  ~STT();
 
   void begin_session(bool is_follow_up);
   void send_frame(AudioFrame frame);
-  void send_done();
+  /**
+   * @brief End the input; `speech_end` is the capture time of the end of
+   * speech, if known, to measure the time to the result.
+   */
+  void send_done(gint64 speech_end = 0);
   void abort();
+  void print_stats();
 
 private:
   enum class Event {
@@ -94,16 +157,81 @@ private:
   };
 
   void complete_success(STTSession *session, const char *text);
+  /**
+   * @brief Record how a session's interim results compared with its final
+   * transcript: whether one became `stable` before it, whether that one
+   * `matched` it, and how much earlier it came.
+   */
+  void record_interim(STTSession *session, bool stable, bool matched,
+                      gint64 early_us);
   void complete_error(STTSession *session, int error_code,
                       const char *error_message);
   void record_timing_event(STTSession *session, Event ev);
+  void record_first_audio(STTSession *session, bool warm);
+
+  void prewarm();
+  static void on_standby_connection(SoupSession *session, GAsyncResult *res,
+                                    gpointer data);
+  static void on_standby_close(SoupWebsocketConnection *conn, gpointer data);
+  static gboolean retry_prewarm(gpointer data);
 
   App *const m_app;
   const std::string m_url;
   std::unique_ptr<STTSession> m_current_session;
 
+  // with [stt] prewarm, the connection that the next session starts on,
+  // opened as soon as the previous one was taken and kept alive with pings
+  auto_gobject_ptr<SoupWebsocketConnection> m_standby;
+  auto_gobject_ptr<GCancellable> m_standby_cancellable;
+  guint m_standby_retry_id = 0;
+  size_t standby_opened = 0;
+  size_t standby_lost = 0;
+  size_t standby_dead = 0;
+
+  // time from the start of a session (the wake word) to the first audio
+  // written to the websocket, split by whether the session started on an
+  // open connection or had to connect
+  gint64 m_session_start = 0;
+  size_t warm_sessions = 0;
+  size_t cold_sessions = 0;
+  gint64 warm_total_us = 0;
+  gint64 cold_total_us = 0;
+  gint64 warm_max_us = 0;
+  gint64 cold_max_us = 0;
+
   std::regex wake_word_pattern;
 
+  // frames written to the websocket, and how many of them had to wait in
+  // a session's queue for the connection to open first, for how long, and
+  // what the queue limit did with the others
+  size_t frames_sent = 0;
+  size_t frames_queued = 0;
+  size_t largest_queue = 0;
+  size_t largest_queue_ms = 0;
+  size_t queue_waits = 0;
+  gint64 queue_wait_total_us = 0;
+  gint64 queue_wait_max_us = 0;
+  size_t frames_dropped = 0;
+  size_t frames_spilled = 0;
+  size_t sessions_failed = 0;
+
+  // what went up the websocket, against what raw PCM would have taken
+  size_t turns = 0;
+  size_t messages_sent = 0;
+  size_t bytes_sent = 0;
+  size_t pcm_bytes = 0;
+  gint64 encode_us = 0;
+  gint64 m_speech_end = 0;
+
+  // with [stt] interim, the turns whose final transcript came, how many of
+  // them had a stable partial transcript before it and how many of those
+  // matched it, and how much earlier it came
+  size_t interim_turns = 0;
+  size_t interim_stable = 0;
+  size_t interim_matched = 0;
+  gint64 interim_early_total_us = 0;
+  gint64 interim_early_max_us = 0;
+
   struct timeval tConnect;
   struct timeval tFirstFrame;
   struct timeval tLastFrame;
@@ -0,0 +1,104 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace genie {
+
+/**
+ * @brief Bounded lock-free single-producer / single-consumer queue.
+ *
+ * `push()` must only ever be called from one thread, and `pop()` from one
+ * (possibly different) thread. All slots are allocated up front, so neither
+ * operation allocates.
+ *
+ * `T` must be default constructible and move assignable.
+ */
+template <typename T> class SPSCRing {
+public:
+  explicit SPSCRing(size_t min_capacity)
+      : m_capacity(round_up_pow2(min_capacity)), mask(m_capacity - 1),
+        slots(new T[m_capacity]), head(0), tail(0) {}
+
+  SPSCRing(const SPSCRing &) = delete;
+  SPSCRing &operator=(const SPSCRing &) = delete;
+
+  /**
+   * @brief Append an item. Producer only.
+   *
+   * Returns `false`, leaving `item` untouched, if the ring is full.
+   */
+  bool push(T &&item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= m_capacity)
+      return false;
+    slots[h & mask] = std::move(item);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Remove the oldest item. Consumer only.
+   *
+   * Returns `false` if the ring is empty.
+   */
+  bool pop(T &item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+      return false;
+    item = std::move(slots[t & mask]);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Number of queued items. Exact only when called from the producer
+   * or the consumer thread, approximate otherwise.
+   */
+  size_t size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return m_capacity; }
+
+private:
+  static size_t round_up_pow2(size_t n) {
+    size_t v = 1;
+    while (v < n)
+      v <<= 1;
+    return v;
+  }
+
+  const size_t m_capacity;
+  const size_t mask;
+  std::unique_ptr<T[]> slots;
+
+  // keep the producer and consumer indices on separate cache lines
+  // so the two threads don't keep stealing the line from each other
+  std::atomic<size_t> head;
+  char pad[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail;
+};
+
+} // namespace genie